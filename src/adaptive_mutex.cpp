@@ -0,0 +1,310 @@
+/**
+ * @file adaptive_mutex.cpp
+ * @brief Tutorial code for an adaptive mutex that spins briefly before
+ * putting the thread to sleep.
+ */
+
+// The critical sections in mutex.cpp and scoped_lock.cpp are a single
+// count += 1, a few nanoseconds of work. When a thread finds a std::mutex
+// locked, it (on Linux) quickly makes a futex system call and goes to sleep,
+// and the thread that unlocks has to make another system call to wake it up.
+// Both cost microseconds, a thousand times longer than the critical section.
+// If the waiting thread had simply spun for a few hundred nanoseconds, the
+// lock would most likely have been free.
+
+// Spinning forever is not the answer either. A pure spinlock burns CPU while
+// it waits, and if the thread holding the lock is descheduled (because there
+// are more threads than cores), the spinners waste their whole time slice.
+
+// AdaptiveMutex combines the two:
+//   1. Try to take the lock with one atomic exchange.
+//   2. Otherwise spin, re-checking the lock with exponentially growing pauses
+//      between checks (the x86 `pause` instruction tells the core we're in a
+//      spin loop, which saves power and frees resources for a hyperthread).
+//   3. If the lock is still taken after the spin budget, sleep in the kernel
+//      until the owner wakes us.
+// The spin budget is a number of pause instructions, and it tunes itself,
+// like glibc's PTHREAD_MUTEX_ADAPTIVE_NP: every time a spin succeeds, the
+// budget moves toward the number of pauses it took, and every time spinning
+// fails, it shrinks, so a lock with long critical sections quickly stops
+// wasting CPU on spinning.
+
+// AdaptiveMutex has lock(), try_lock() and unlock(), so it satisfies the
+// standard Lockable requirements and works with std::scoped_lock,
+// std::unique_lock and std::lock_guard.
+
+// The benchmark runs count += 1 under each lock with 1 to 16 threads (pass a
+// different maximum as the second argument), with no work and with some work
+// outside the critical section, and reports throughput and the median, 99th
+// and 99.9th percentile time to acquire the lock. Pass a different number of
+// total lock acquisitions as the first argument (default 1,000,000).
+
+// Includes std::sort, for the latency percentiles.
+#include <algorithm>
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint32_t.
+#include <cstdint>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes the header for std::vector.
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+// Includes _mm_pause.
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+// Includes FUTEX_WAIT_PRIVATE and FUTEX_WAKE_PRIVATE.
+#include <linux/futex.h>
+// Includes SYS_futex.
+#include <sys/syscall.h>
+// Includes syscall().
+#include <unistd.h>
+#endif
+
+// Tells the CPU that we are in a spin loop.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Sleeping and waking. On Linux we use the futex system call directly: it
+// puts the thread to sleep only if the word still holds the expected value,
+// which is exactly what a mutex needs to avoid missed wakeups. Elsewhere, we
+// fall back to yielding the CPU, which is correct but not as efficient.
+inline void futex_wait(std::atomic<uint32_t> *word, uint32_t expected) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+  if (word->load(std::memory_order_relaxed) == expected) {
+    std::this_thread::yield();
+  }
+#endif
+}
+
+inline void futex_wake_one(std::atomic<uint32_t> *word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+// The adaptive mutex. The lock word has three states, following Ulrich
+// Drepper's "Futexes Are Tricky": 0 is unlocked, 1 is locked with no
+// sleeping waiters, and 2 is locked with (possibly) sleeping waiters. Only
+// unlocking from state 2 needs a system call, so an uncontended lock and
+// unlock are one atomic operation each.
+class AdaptiveMutex {
+ public:
+  AdaptiveMutex() = default;
+  AdaptiveMutex(const AdaptiveMutex &) = delete;
+  AdaptiveMutex &operator=(const AdaptiveMutex &) = delete;
+
+  void lock() {
+    uint32_t expected = kUnlocked;
+    if (state_.compare_exchange_strong(expected, kLocked, std::memory_order_acquire, std::memory_order_relaxed)) {
+      return;
+    }
+    if (!SpinLock()) {
+      Park();
+    }
+  }
+
+  bool try_lock() {
+    uint32_t expected = kUnlocked;
+    return state_.compare_exchange_strong(expected, kLocked, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+
+  void unlock() {
+    if (state_.exchange(kUnlocked, std::memory_order_release) == kSleepers) {
+      futex_wake_one(&state_);
+    }
+  }
+
+  // The current spin estimate in pauses, for the curious.
+  uint32_t SpinEstimate() const { return spin_estimate_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr uint32_t kUnlocked = 0;
+  static constexpr uint32_t kLocked = 1;
+  static constexpr uint32_t kSleepers = 2;
+  // A pause takes from about 10 cycles on older x86 cores to about 140 on
+  // Skylake and later, so the cap is a few hundred nanoseconds to a few
+  // microseconds, and the default budget of 2 * 16 + 16 pauses is at most
+  // about two microseconds.
+  static constexpr uint32_t kMaxSpinPauses = 256;
+  static constexpr uint32_t kMaxPausesPerCheck = 16;
+
+  // Spins for up to twice the current estimate of pauses (plus a little, so
+  // that the estimate can grow again after it shrank). The budget counts
+  // every pause, not every check of the lock, because the pauses between
+  // checks grow. Returns true if we got the lock. The estimate is a plain
+  // relaxed atomic: it is only a hint, so lost updates don't matter.
+  bool SpinLock() {
+    uint32_t estimate = spin_estimate_.load(std::memory_order_relaxed);
+    uint32_t budget = std::min(2 * estimate + 16, kMaxSpinPauses);
+    uint32_t pauses = 1;
+    for (uint32_t spent = 0; spent < budget;) {
+      pauses = std::min(pauses, budget - spent);
+      for (uint32_t i = 0; i < pauses; i++) {
+        cpu_relax();
+      }
+      spent += pauses;
+      pauses = std::min(2 * pauses, kMaxPausesPerCheck);
+      // Read before trying to write, so spinners don't steal the cache line
+      // from the owner while the lock is taken.
+      if (state_.load(std::memory_order_relaxed) == kUnlocked && try_lock()) {
+        spin_estimate_.store(estimate + (static_cast<int32_t>(spent - estimate) / 8), std::memory_order_relaxed);
+        return true;
+      }
+    }
+    spin_estimate_.store(estimate - estimate / 8, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Sleeps until the lock is ours. We always set the state to kSleepers when
+  // we take the lock from here, because we can't know whether other threads
+  // are still sleeping, so the next unlock() must wake one of them.
+  void Park() {
+    uint32_t state = state_.exchange(kSleepers, std::memory_order_acquire);
+    while (state != kUnlocked) {
+      futex_wait(&state_, kSleepers);
+      state = state_.exchange(kSleepers, std::memory_order_acquire);
+    }
+  }
+
+  std::atomic<uint32_t> state_{kUnlocked};
+  std::atomic<uint32_t> spin_estimate_{16};
+};
+
+// The pure spinlock we compare against: test-and-test-and-set with pause.
+class SpinLock {
+ public:
+  void lock() {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+      while (locked_.load(std::memory_order_relaxed)) {
+        cpu_relax();
+      }
+    }
+  }
+
+  bool try_lock() {
+    return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+  }
+
+  void unlock() { locked_.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> locked_{false};
+};
+
+struct Result {
+  double mops_;
+  double p50_ns_;
+  double p99_ns_;
+  double p999_ns_;
+};
+
+// Runs total_ops lock acquisitions spread over num_threads threads. Each
+// acquisition increments count under the lock, then does `work` iterations
+// of unrelated computation outside the lock. Every 16th acquisition is timed.
+template <typename Mutex>
+Result run(int num_threads, int total_ops, int work) {
+  Mutex m;
+  long long count = 0;
+  std::vector<std::vector<double>> latencies(num_threads);
+  const int ops = total_ops / num_threads;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      std::vector<double> &samples = latencies[t];
+      samples.reserve(ops / 16 + 1);
+      volatile unsigned sink = 0;
+      for (int i = 0; i < ops; i++) {
+        if (i % 16 == 0) {
+          auto before = std::chrono::steady_clock::now();
+          std::scoped_lock lk(m);
+          auto waited = std::chrono::steady_clock::now() - before;
+          samples.push_back(std::chrono::duration<double, std::nano>(waited).count());
+          count += 1;
+        } else {
+          std::scoped_lock lk(m);
+          count += 1;
+        }
+        for (int w = 0; w < work; w++) {
+          sink = sink + w;
+        }
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (count != static_cast<long long>(ops) * num_threads) {
+    std::cout << "Wrong count: " << count << "\n";
+  }
+
+  std::vector<double> all;
+  for (const std::vector<double> &samples : latencies) {
+    all.insert(all.end(), samples.begin(), samples.end());
+  }
+  std::sort(all.begin(), all.end());
+  // With fewer operations than threads, no thread took any samples.
+  auto percentile = [&](double p) {
+    return all.empty() ? 0.0 : all[static_cast<size_t>(p * static_cast<double>(all.size() - 1))];
+  };
+  return {static_cast<double>(count) / seconds / 1e6, percentile(0.5), percentile(0.99), percentile(0.999)};
+}
+
+template <typename Mutex>
+void report(const char *name, int num_threads, int total_ops, int work) {
+  Result r = run<Mutex>(num_threads, total_ops, work);
+  std::cout << "  " << name << r.mops_ << " M ops/s, acquire p50 " << r.p50_ns_ << " ns, p99 " << r.p99_ns_
+            << " ns, p99.9 " << r.p999_ns_ << " ns\n";
+}
+
+int main(int argc, char **argv) {
+  const int total_ops = argc > 1 ? std::stoi(argv[1]) : 1000000;
+  const int max_threads = argc > 2 ? std::stoi(argv[2]) : 16;
+
+  // The mutex.cpp demo, with an AdaptiveMutex and std::scoped_lock.
+  AdaptiveMutex m;
+  int demo_count = 0;
+  auto add_count = [&] {
+    std::scoped_lock slk(m);
+    demo_count += 1;
+  };
+  std::thread t1(add_count);
+  std::thread t2(add_count);
+  t1.join();
+  t2.join();
+  std::cout << "Printing count: " << demo_count << std::endl;
+
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n";
+  for (int work : {0, 200}) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      std::cout << threads << " threads, " << work << " iterations of work outside the lock:\n";
+      report<std::mutex>("std::mutex:    ", threads, total_ops, work);
+      report<SpinLock>("SpinLock:      ", threads, total_ops, work);
+      report<AdaptiveMutex>("AdaptiveMutex: ", threads, total_ops, work);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,313 @@
+/**
+ * @file batched_lookup.cpp
+ * @brief Tutorial code for looking up many keys in a hash map at once, with
+ * prefetching, so that the cache misses of different lookups overlap.
+ */
+
+// unordered_maps.cpp looks up keys one at a time: map.find("jignesh"). When
+// the map is much bigger than the CPU's last level cache, each lookup waits
+// for memory several times in a row: for the bucket, then for the node the
+// bucket points to, then maybe for the next node in the chain. Each wait is
+// around 100 nanoseconds, and while the CPU waits, it has nothing else to do,
+// because the next step depends on the load it is waiting for.
+
+// But if we have many keys to look up, the lookups don't depend on each
+// other. Group prefetching takes a group of keys and runs each step of the
+// lookup for the whole group before moving on to the next step: hash all the
+// keys and prefetch their buckets, then read all the buckets and prefetch
+// their nodes, then compare all the keys. While the CPU hashes key 2, the
+// memory system is already fetching key 1's bucket, so a group of 16 lookups
+// pays for about one round of memory waits per step instead of 16. (A
+// refinement called AMAC keeps a small ring of lookups in flight, each at its
+// own step, which helps when chains have very different lengths. With short
+// chains, the simpler group version gets nearly all of the benefit.)
+
+// find_many(keys, count, out) does this for two maps:
+//   - UnorderedMapAdapter wraps std::unordered_map. The standard map doesn't
+//     tell us where its buckets live, so the first step is only hashing;
+//     reading the first node of each bucket with begin(bucket) is the second
+//     step, whose independent loads overlap anyway, and we prefetch the node
+//     itself before comparing keys.
+//   - FlatMap is an open addressing map that stores its entries in one
+//     array, with one control byte per slot holding 7 bits of the hash. Both
+//     the control byte and the slot of each key can be prefetched right after
+//     hashing.
+
+// The benchmark builds both maps with 2,000,000 string keys (pass a different
+// size as the first argument), far larger than the last level cache, and
+// looks up 2,000,000 random keys one at a time and with find_many for group
+// sizes from 4 to 32.
+
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint8_t and uint64_t.
+#include <cstdint>
+// Includes std::hash.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::mt19937_64.
+#include <random>
+// Includes the C++ string library.
+#include <string>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes std::move and std::swap.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// Asks the CPU to start loading the cache line holding p, without waiting for
+// it. A prefetch never faults, so p may point anywhere.
+inline void prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(p);
+#else
+  (void)p;
+#endif
+}
+
+template <typename K, typename V, typename Hash = std::hash<K>>
+class UnorderedMapAdapter {
+ public:
+  explicit UnorderedMapAdapter(std::unordered_map<K, V, Hash> &map) : map_(map) {}
+
+  const V *find(const K &key) const {
+    auto it = map_.find(key);
+    return it == map_.end() ? nullptr : &it->second;
+  }
+
+  // Sets out[i] to the value for keys[i], or nullptr if there is none.
+  template <size_t Group = 16>
+  void find_many(const K *keys, size_t count, const V **out) const {
+    using LocalIterator = typename std::unordered_map<K, V, Hash>::const_local_iterator;
+    size_t buckets[Group];
+    LocalIterator first[Group];
+    for (size_t base = 0; base < count; base += Group) {
+      const size_t n = count - base < Group ? count - base : Group;
+      // Step 1: hash every key of the group.
+      for (size_t i = 0; i < n; i++) {
+        buckets[i] = map_.bucket(keys[base + i]);
+      }
+      // Step 2: find the first node of every bucket, and prefetch it.
+      for (size_t i = 0; i < n; i++) {
+        first[i] = map_.cbegin(buckets[i]);
+        if (first[i] != map_.cend(buckets[i])) {
+          prefetch(&*first[i]);
+        }
+      }
+      // Step 3: compare keys along each chain.
+      for (size_t i = 0; i < n; i++) {
+        out[base + i] = nullptr;
+        for (auto it = first[i]; it != map_.cend(buckets[i]); ++it) {
+          if (it->first == keys[base + i]) {
+            out[base + i] = &it->second;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  std::unordered_map<K, V, Hash> &map_;
+};
+
+// An open addressing hash map with linear probing. ctrl_[i] is 0 for an
+// empty slot, and otherwise 0x80 plus the low 7 bits of the key's hash, so
+// that most mismatching slots are skipped without comparing keys. No erase,
+// to keep the probing simple.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class FlatMap {
+ public:
+  FlatMap() { Rehash(16); }
+
+  bool insert(const K &key, const V &value) {
+    if ((size_ + 1) * 8 > ctrl_.size() * 7) {
+      Rehash(ctrl_.size() * 2);
+    }
+    uint64_t h = Hash{}(key);
+    for (size_t i = Index(h);; i = (i + 1) & mask_) {
+      if (ctrl_[i] == 0) {
+        ctrl_[i] = Tag(h);
+        slots_[i].key_ = key;
+        slots_[i].value_ = value;
+        size_++;
+        return true;
+      }
+      if (ctrl_[i] == Tag(h) && slots_[i].key_ == key) {
+        return false;
+      }
+    }
+  }
+
+  const V *find(const K &key) const {
+    uint64_t h = Hash{}(key);
+    return Probe(key, h, Index(h));
+  }
+
+  template <size_t Group = 16>
+  void find_many(const K *keys, size_t count, const V **out) const {
+    uint64_t hashes[Group];
+    for (size_t base = 0; base < count; base += Group) {
+      const size_t n = count - base < Group ? count - base : Group;
+      // Step 1: hash every key, and prefetch its control byte and slot.
+      for (size_t i = 0; i < n; i++) {
+        hashes[i] = Hash{}(keys[base + i]);
+        size_t index = Index(hashes[i]);
+        prefetch(&ctrl_[index]);
+        prefetch(&slots_[index]);
+      }
+      // Step 2: probe.
+      for (size_t i = 0; i < n; i++) {
+        out[base + i] = Probe(keys[base + i], hashes[i], Index(hashes[i]));
+      }
+    }
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  struct Slot {
+    K key_;
+    V value_;
+  };
+
+  static uint8_t Tag(uint64_t h) { return static_cast<uint8_t>(0x80 | (h & 0x7f)); }
+
+  // Takes the slot index from the high bits of a multiplied hash, because
+  // std::hash of an integer is the integer itself.
+  size_t Index(uint64_t h) const { return static_cast<size_t>((h * 0x9e3779b97f4a7c15ULL) >> shift_); }
+
+  const V *Probe(const K &key, uint64_t h, size_t i) const {
+    for (;; i = (i + 1) & mask_) {
+      if (ctrl_[i] == 0) {
+        return nullptr;
+      }
+      if (ctrl_[i] == Tag(h) && slots_[i].key_ == key) {
+        return &slots_[i].value_;
+      }
+    }
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<uint8_t> old_ctrl(capacity, 0);
+    std::vector<Slot> old_slots(capacity);
+    std::swap(old_ctrl, ctrl_);
+    std::swap(old_slots, slots_);
+    mask_ = capacity - 1;
+    shift_ = 64;
+    for (size_t c = capacity; c > 1; c /= 2) {
+      shift_--;
+    }
+    for (size_t i = 0; i < old_ctrl.size(); i++) {
+      if (old_ctrl[i] != 0) {
+        uint64_t h = Hash{}(old_slots[i].key_);
+        size_t j = Index(h);
+        while (ctrl_[j] != 0) {
+          j = (j + 1) & mask_;
+        }
+        ctrl_[j] = old_ctrl[i];
+        slots_[j] = std::move(old_slots[i]);
+      }
+    }
+  }
+
+  std::vector<uint8_t> ctrl_;
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+  int shift_ = 64;
+  size_t size_ = 0;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns nanoseconds per lookup, one key at a time. Adds the sum of the
+// values found to *checksum so that the compiler can't skip the lookups.
+template <typename Map>
+double one_at_a_time_ns(const Map &map, const std::vector<std::string> &probes, long *checksum) {
+  auto start = std::chrono::steady_clock::now();
+  long sum = 0;
+  for (const std::string &probe : probes) {
+    const int *value = map.find(probe);
+    sum += value ? *value : 0;
+  }
+  double ns = seconds_since(start) * 1e9 / static_cast<double>(probes.size());
+  *checksum += sum;
+  return ns;
+}
+
+template <size_t Group, typename Map>
+double find_many_ns(const Map &map, const std::vector<std::string> &probes, long *checksum) {
+  std::vector<const int *> out(probes.size());
+  auto start = std::chrono::steady_clock::now();
+  map.template find_many<Group>(probes.data(), probes.size(), out.data());
+  long sum = 0;
+  for (const int *value : out) {
+    sum += value ? *value : 0;
+  }
+  double ns = seconds_since(start) * 1e9 / static_cast<double>(probes.size());
+  *checksum += sum;
+  return ns;
+}
+
+template <typename Map>
+void benchmark(const char *name, const Map &map, const std::vector<std::string> &probes) {
+  long checksum = 0;
+  std::cout << name << ":\n  one at a time: " << one_at_a_time_ns(map, probes, &checksum) << " ns per lookup\n";
+  std::cout << "  find_many, groups of 4: " << find_many_ns<4>(map, probes, &checksum) << " ns per lookup\n";
+  std::cout << "  find_many, groups of 8: " << find_many_ns<8>(map, probes, &checksum) << " ns per lookup\n";
+  std::cout << "  find_many, groups of 16: " << find_many_ns<16>(map, probes, &checksum) << " ns per lookup\n";
+  std::cout << "  find_many, groups of 32: " << find_many_ns<32>(map, probes, &checksum) << " ns per lookup\n";
+  std::cout << "  (checksum " << checksum / 5 << ")\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 2000000;
+
+  // The lookups from unordered_maps.cpp, batched.
+  std::unordered_map<std::string, int> map;
+  map.insert({{"foo", 2}, {"jignesh", 445}, {"spam", 1}, {"eggs", 2}, {"garlic rice", 3}});
+  UnorderedMapAdapter<std::string, int> adapter(map);
+  std::vector<std::string> wanted = {"jignesh", "spam", "tomato"};
+  std::vector<const int *> found(wanted.size());
+  adapter.find_many(wanted.data(), wanted.size(), found.data());
+  for (size_t i = 0; i < wanted.size(); i++) {
+    if (found[i] != nullptr) {
+      std::cout << "Found key " << wanted[i] << " with value " << *found[i] << std::endl;
+    } else {
+      std::cout << "Key " << wanted[i] << " is not in the map" << std::endl;
+    }
+  }
+
+  // The benchmark maps. Keys like "key-123" fit in std::string's inline
+  // buffer, so comparing them doesn't add another cache miss.
+  std::vector<std::string> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    keys.push_back("key-" + std::to_string(i));
+  }
+  std::unordered_map<std::string, int> big_map;
+  big_map.reserve(n);
+  FlatMap<std::string, int> flat_map;
+  for (size_t i = 0; i < n; i++) {
+    big_map.insert({keys[i], static_cast<int>(i)});
+  }
+  for (size_t i = 0; i < n; i++) {
+    flat_map.insert(keys[i], static_cast<int>(i));
+  }
+
+  std::mt19937_64 rng(42);
+  std::vector<std::string> probes;
+  probes.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    probes.push_back(keys[rng() % n]);
+  }
+
+  std::cout << n << " keys, " << probes.size() << " random lookups:\n";
+  benchmark("std::unordered_map", UnorderedMapAdapter<std::string, int>(big_map), probes);
+  benchmark("FlatMap", flat_map, probes);
+  return 0;
+}
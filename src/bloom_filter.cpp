@@ -0,0 +1,405 @@
+/**
+ * @file bloom_filter.cpp
+ * @brief Tutorial code for putting a Bloom filter in front of a hash map, so
+ * lookups of missing keys usually don't touch the map at all.
+ */
+
+// unordered_maps.cpp checks map.count("eggs") == 0 and
+// map.count("garlic rice") == 0: lookups of keys that aren't there. For a map
+// much bigger than the CPU caches, every such lookup hashes the key, loads a
+// bucket from memory (a cache miss), follows the bucket's chain (more cache
+// misses) and compares strings, all to find nothing.
+
+// A Bloom filter answers "is this key definitely not in the set?" using a
+// few bits per key. Inserting a key sets k bits chosen by hashing it; a
+// lookup checks those k bits, and if any of them is 0, the key was never
+// inserted. If all are 1, the key is probably there (with a tunable false
+// positive rate), and we ask the map. Since the filter is about 10 bits per
+// key instead of the map's ~100 bytes, it fits in cache where the map
+// doesn't.
+
+// A classic Bloom filter spreads a key's k bits over the whole bit array,
+// so a lookup costs k cache misses. A blocked Bloom filter first picks one
+// 64-byte block (one cache line) from the hash, and sets all k bits inside
+// it. A lookup then costs one cache miss. The price is a slightly higher
+// false positive rate for the same number of bits, which we compensate for
+// when sizing the filter.
+
+// Bloom filters can't delete: clearing a key's bits might clear bits that
+// other keys share. CountingBloomFilter replaces every bit by a 4-bit
+// counter, so erase() can decrement them. It uses 4 times the memory. (A
+// quotient filter also supports deletion in less space, but is much more
+// involved; counting is the simple way to get there.)
+
+// FilteredMap puts either filter in front of a std::unordered_map<std::string,
+// int>. The benchmark builds a map of 1,000,000 keys (pass a different size
+// as the first argument) and sweeps the fraction of lookups that miss, for
+// false positive rates of 1% and 0.1%. The filter isn't free: for a key
+// that is present, we now load the filter's block and then search the map
+// anyway, so lookups that hit get slower. It only pays off when most
+// lookups miss; where the break-even point lies depends on how expensive a
+// miss in the map is compared to a filter lookup on your machine, which is
+// what the sweep shows.
+
+// Includes std::max and std::min.
+#include <algorithm>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::exp, std::log and std::pow.
+#include <cmath>
+// Includes the header for uint64_t.
+#include <cstdint>
+// Includes std::hash.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::mt19937_64 and std::uniform_real_distribution.
+#include <random>
+// Includes std::invalid_argument.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes the header for std::vector.
+#include <vector>
+
+// Spreads the bits of a hash; used to derive the bit positions.
+inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// The positions inside a block are the top bits of mix(hash), multiplied by
+// an odd constant once per position. Each product's top bits depend on all
+// the bits below them, so the positions are nearly independent. The usual
+// hash + i * step doesn't work well in a 512-bit block: only the top 9 bits
+// of step matter, and whenever they are small, all k positions land close
+// together, which raises the false positive rate above what the sizing
+// below expects.
+inline uint64_t NextProbe(uint64_t probe) { return probe * 0x9e3779b97f4a7c15ULL; }
+
+// Computes bits per key and number of hash functions for a target false
+// positive rate. For a classic Bloom filter, the optimum is
+// -ln(p) / ln(2)^2 bits per key and ln(2) * bits hash functions. Blocking
+// raises the false positive rate, because keys don't spread evenly over
+// blocks: a block that got more than its share of keys has more bits set.
+// How much more depends on the target, so instead of a fixed correction we
+// use the blocked filter's own false positive rate (Putze, Sanders and
+// Singler, "Cache-, Hash- and Space-Efficient Bloom Filters", 2007): with c
+// bits per key and B bits per block, the number of keys in a block is about
+// Poisson distributed with mean B / c, and a block with i keys gives a false
+// positive with probability (1 - e^(-k i / B))^k. We add bits per key, and
+// pick the best k for each, until that rate reaches the target.
+struct BloomParameters {
+  BloomParameters(double false_positive_rate, size_t bits_per_block) {
+    if (false_positive_rate <= 0 || false_positive_rate >= 1) {
+      throw std::invalid_argument("false positive rate must be between 0 and 1");
+    }
+    const double ln2 = std::log(2.0);
+    for (bits_per_key_ = -std::log(false_positive_rate) / (ln2 * ln2);; bits_per_key_ += 0.1) {
+      hashes_ = 1;
+      double best = BlockedRate(bits_per_key_, 1, bits_per_block);
+      for (int k = 2; k <= 16; k++) {
+        double rate = BlockedRate(bits_per_key_, k, bits_per_block);
+        if (rate < best) {
+          best = rate;
+          hashes_ = k;
+        }
+      }
+      if (best <= false_positive_rate) {
+        break;
+      }
+    }
+  }
+
+  // The false positive rate of a blocked filter, summed over the number of
+  // keys per block until the Poisson weights become negligible.
+  static double BlockedRate(double bits_per_key, int hashes, size_t bits_per_block) {
+    const double block = static_cast<double>(bits_per_block);
+    const double mean = block / bits_per_key;
+    double weight = std::exp(-mean);
+    double rate = 0;
+    for (int i = 0; i < 1000 && (i < mean || weight > 1e-12); i++) {
+      rate += weight * std::pow(1 - std::exp(-hashes * i / block), hashes);
+      weight *= mean / (i + 1);
+    }
+    return rate;
+  }
+
+  double bits_per_key_;
+  int hashes_;
+};
+
+// The blocked Bloom filter. Each block is one cache line of 512 bits.
+class BlockedBloomFilter {
+ public:
+  static constexpr bool kSupportsErase = false;
+
+  BlockedBloomFilter(size_t expected_keys, double false_positive_rate)
+      : params_(false_positive_rate, kBitsPerBlock) {
+    size_t bits = static_cast<size_t>(params_.bits_per_key_ * static_cast<double>(std::max<size_t>(expected_keys, 1)));
+    blocks_.resize((bits + kBitsPerBlock - 1) / kBitsPerBlock);
+  }
+
+  void Insert(uint64_t hash) {
+    Block &block = BlockFor(hash);
+    uint64_t probe = mix(hash);
+    for (int i = 0; i < params_.hashes_; i++) {
+      uint64_t bit = probe >> 55;
+      probe = NextProbe(probe);
+      block.words_[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+  }
+
+  bool MayContain(uint64_t hash) const {
+    const Block &block = BlockFor(hash);
+    uint64_t probe = mix(hash);
+    for (int i = 0; i < params_.hashes_; i++) {
+      uint64_t bit = probe >> 55;
+      probe = NextProbe(probe);
+      if ((block.words_[bit / 64] & (uint64_t{1} << (bit % 64))) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t Bytes() const { return blocks_.size() * sizeof(Block); }
+
+ private:
+  static constexpr size_t kBitsPerBlock = 512;
+
+  struct alignas(64) Block {
+    uint64_t words_[8]{};
+  };
+
+  // Maps the hash onto [0, number of blocks) with a multiply instead of a
+  // slower modulo (Lemire's "fast range").
+  size_t BlockIndex(uint64_t hash) const {
+    return static_cast<size_t>(((hash & 0xffffffff) * blocks_.size()) >> 32);
+  }
+  Block &BlockFor(uint64_t hash) { return blocks_[BlockIndex(hash)]; }
+  const Block &BlockFor(uint64_t hash) const { return blocks_[BlockIndex(hash)]; }
+
+  BloomParameters params_;
+  std::vector<Block> blocks_;
+};
+
+// The counting variant: 128 4-bit counters per 64-byte block. A counter
+// that reaches 15 sticks there, because we no longer know how many keys
+// share it; erasing a key that was never inserted breaks the filter, so
+// FilteredMap only erases keys it found in the map.
+class CountingBloomFilter {
+ public:
+  static constexpr bool kSupportsErase = true;
+
+  CountingBloomFilter(size_t expected_keys, double false_positive_rate)
+      : params_(false_positive_rate, kCountersPerBlock) {
+    size_t counters =
+        static_cast<size_t>(params_.bits_per_key_ * static_cast<double>(std::max<size_t>(expected_keys, 1)));
+    blocks_.resize((counters + kCountersPerBlock - 1) / kCountersPerBlock);
+  }
+
+  void Insert(uint64_t hash) {
+    Block &block = BlockFor(hash);
+    uint64_t probe = mix(hash);
+    for (int i = 0; i < params_.hashes_; i++) {
+      uint64_t counter = probe >> 57;
+      probe = NextProbe(probe);
+      uint64_t value = Get(block, counter);
+      if (value < kMaxCount) {
+        Set(block, counter, value + 1);
+      }
+    }
+  }
+
+  void Erase(uint64_t hash) {
+    Block &block = BlockFor(hash);
+    uint64_t probe = mix(hash);
+    for (int i = 0; i < params_.hashes_; i++) {
+      uint64_t counter = probe >> 57;
+      probe = NextProbe(probe);
+      uint64_t value = Get(block, counter);
+      if (value > 0 && value < kMaxCount) {
+        Set(block, counter, value - 1);
+      }
+    }
+  }
+
+  bool MayContain(uint64_t hash) const {
+    const Block &block = BlockFor(hash);
+    uint64_t probe = mix(hash);
+    for (int i = 0; i < params_.hashes_; i++) {
+      if (Get(block, probe >> 57) == 0) {
+        return false;
+      }
+      probe = NextProbe(probe);
+    }
+    return true;
+  }
+
+  size_t Bytes() const { return blocks_.size() * sizeof(Block); }
+
+ private:
+  static constexpr size_t kCountersPerBlock = 128;
+  static constexpr uint64_t kMaxCount = 15;
+
+  struct alignas(64) Block {
+    uint64_t words_[8]{};
+  };
+
+  // Counter c lives in bits 4 * (c % 16) .. +3 of word c / 16.
+  static uint64_t Get(const Block &block, uint64_t c) { return (block.words_[c / 16] >> (4 * (c % 16))) & 0xf; }
+  static void Set(Block &block, uint64_t c, uint64_t value) {
+    uint64_t &word = block.words_[c / 16];
+    word = (word & ~(uint64_t{0xf} << (4 * (c % 16)))) | (value << (4 * (c % 16)));
+  }
+
+  size_t BlockIndex(uint64_t hash) const {
+    return static_cast<size_t>(((hash & 0xffffffff) * blocks_.size()) >> 32);
+  }
+  Block &BlockFor(uint64_t hash) { return blocks_[BlockIndex(hash)]; }
+  const Block &BlockFor(uint64_t hash) const { return blocks_[BlockIndex(hash)]; }
+
+  BloomParameters params_;
+  std::vector<Block> blocks_;
+};
+
+// The map from unordered_maps.cpp with a filter in front. count() only
+// touches the map if the filter says the key may be there. erase() is only
+// available with a filter that supports it.
+template <typename Filter>
+class FilteredMap {
+ public:
+  FilteredMap(size_t expected_keys, double false_positive_rate) : filter_(expected_keys, false_positive_rate) {
+    map_.reserve(expected_keys);
+  }
+
+  void insert(const std::string &key, int value) {
+    if (map_.insert({key, value}).second) {
+      filter_.Insert(Hash(key));
+    }
+  }
+
+  size_t count(const std::string &key) const {
+    if (!filter_.MayContain(Hash(key))) {
+      return 0;
+    }
+    return map_.count(key);
+  }
+
+  size_t erase(const std::string &key) {
+    static_assert(Filter::kSupportsErase, "erase needs a filter that supports deletion, like CountingBloomFilter");
+    if (map_.erase(key) == 0) {
+      return 0;
+    }
+    filter_.Erase(Hash(key));
+    return 1;
+  }
+
+  const Filter &filter() const { return filter_; }
+
+ private:
+  static uint64_t Hash(const std::string &key) { return std::hash<std::string>{}(key); }
+
+  std::unordered_map<std::string, int> map_;
+  Filter filter_;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns nanoseconds per lookup, and adds the number of keys found to
+// *found so the compiler can't skip the lookups.
+template <typename Map>
+double lookup_ns(const Map &map, const std::vector<std::string> &probes, size_t *found) {
+  auto start = std::chrono::steady_clock::now();
+  size_t hits = 0;
+  for (const std::string &probe : probes) {
+    hits += map.count(probe);
+  }
+  double ns = seconds_since(start) * 1e9 / static_cast<double>(probes.size());
+  *found += hits;
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+  // The demo from unordered_maps.cpp, with a counting filter so that erase
+  // works.
+  FilteredMap<CountingBloomFilter> demo(16, 0.01);
+  demo.insert("foo", 2);
+  demo.insert("jignesh", 445);
+  demo.insert("tomato", 20);
+  if (demo.count("eggs") == 0) {
+    std::cout << "Key \"eggs\" is not in the map (the filter answered without the map).\n";
+  }
+  demo.erase("tomato");
+  std::cout << "After erase, count(\"tomato\") is " << demo.count("tomato") << "\n";
+
+  // The benchmark map and its probes. Keys that are present look like
+  // "key-123", keys that are absent like "absent-123".
+  std::vector<std::string> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    keys.push_back("key-" + std::to_string(i));
+  }
+  std::unordered_map<std::string, int> plain;
+  plain.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    plain.insert({keys[i], static_cast<int>(i)});
+  }
+
+  const size_t probes_per_run = 1000000;
+  std::mt19937_64 rng(42);
+  for (double fpr : {0.01, 0.001}) {
+    FilteredMap<BlockedBloomFilter> blocked(n, fpr);
+    FilteredMap<CountingBloomFilter> counting(n, fpr);
+    // One map after the other, so that each map's nodes are as close
+    // together in memory as the plain map's.
+    for (size_t i = 0; i < n; i++) {
+      blocked.insert(keys[i], static_cast<int>(i));
+    }
+    for (size_t i = 0; i < n; i++) {
+      counting.insert(keys[i], static_cast<int>(i));
+    }
+
+    // Measure the actual false positive rate on keys that are absent.
+    size_t false_positives = 0;
+    const size_t fp_probes = 1000000;
+    for (size_t i = 0; i < fp_probes; i++) {
+      false_positives += blocked.filter().MayContain(std::hash<std::string>{}("absent-" + std::to_string(i)));
+    }
+    std::cout << "Target false positive rate " << fpr * 100 << "%: measured "
+              << static_cast<double>(false_positives) / fp_probes * 100 << "%, blocked filter "
+              << blocked.filter().Bytes() / 1024 << " KB, counting filter " << counting.filter().Bytes() / 1024
+              << " KB\n";
+
+    for (double miss_ratio : {0.0, 0.5, 0.9, 0.99}) {
+      std::vector<std::string> probes;
+      probes.reserve(probes_per_run);
+      for (size_t i = 0; i < probes_per_run; i++) {
+        if (std::uniform_real_distribution<double>(0, 1)(rng) < miss_ratio) {
+          probes.push_back("absent-" + std::to_string(rng() % (10 * n)));
+        } else {
+          probes.push_back(keys[rng() % n]);
+        }
+      }
+      size_t found = 0;
+      double plain_ns = lookup_ns(plain, probes, &found);
+      double blocked_ns = lookup_ns(blocked, probes, &found);
+      double counting_ns = lookup_ns(counting, probes, &found);
+      std::cout << "  " << miss_ratio * 100 << "% misses: unordered_map " << plain_ns << " ns, blocked Bloom "
+                << blocked_ns << " ns, counting Bloom " << counting_ns << " ns per lookup (" << found / 3
+                << " found)\n";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,402 @@
+/**
+ * @file buffered_output.cpp
+ * @brief Tutorial code for fast text output: per-thread buffers, std::to_chars
+ * formatting and a background writer thread.
+ */
+
+// The demos print with std::cout, usually ending lines with std::endl (see
+// PrintPoint in vectors.cpp, or the iteration loops in sets.cpp and
+// unordered_maps.cpp). std::endl is not just a newline: it also flushes the
+// stream, and flushing means a write(2) system call for every line. A
+// system call costs about as much as formatting hundreds of characters, so
+// a program that logs a lot spends most of its time in the kernel. On top
+// of that, std::cout formats numbers through locale-aware iostream
+// machinery, and when several threads share it, their writes contend.
+
+// This file builds a small output subsystem instead:
+//   - OutputSink owns a file descriptor and a background writer thread.
+//     Full buffers are handed to the writer, which writes everything queued
+//     with a single writev(2) call, and recycles the buffers.
+//   - BufferedWriter is a per-thread buffer with an operator<< like
+//     std::cout. It formats integers and floating point numbers with
+//     std::to_chars (C++17), which doesn't look at the locale and doesn't
+//     allocate. When the buffer fills up, it hands over the complete lines
+//     in it, so lines from different threads never interleave.
+//   - out() is a ready-made BufferedWriter for stdout, one per thread.
+// Output reaches the file descriptor when a buffer fills, when flush() is
+// called, and when the thread or program exits. wait() flushes and also
+// blocks until the sink has written everything.
+
+// The benchmark writes 1,000,000 lines like PrintPoint's (pass a different
+// number as the first argument) to /dev/null (pass a different file as the
+// second argument), with std::endl, with '\n', and with BufferedWriter from
+// one and from four threads.
+
+// Includes std::min.
+#include <algorithm>
+// Includes std::to_chars.
+#include <charconv>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::condition_variable, used to wake the writer thread.
+#include <condition_variable>
+// Includes errno.
+#include <cerrno>
+// Includes open() and its flags.
+#include <fcntl.h>
+// Includes std::ofstream, for the baseline.
+#include <fstream>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::runtime_error.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::string_view.
+#include <string_view>
+// Includes writev() and struct iovec.
+#include <sys/uio.h>
+// Includes the thread library header.
+#include <thread>
+// Includes std::is_arithmetic_v.
+#include <type_traits>
+// Includes close().
+#include <unistd.h>
+// Includes the utility header for std::move and std::swap.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+class OutputSink {
+ public:
+  // Writes to fd, which must stay open for the lifetime of the sink.
+  explicit OutputSink(int fd, size_t buffer_size = 64 * 1024)
+      : fd_(fd), buffer_size_(buffer_size), writer_([this] { WriterLoop(); }) {}
+
+  // Writes everything still queued, then stops the writer thread.
+  ~OutputSink() {
+    {
+      std::scoped_lock lk(m_);
+      stop_ = true;
+    }
+    work_cv_.notify_one();
+    writer_.join();
+  }
+
+  OutputSink(const OutputSink &) = delete;
+  OutputSink &operator=(const OutputSink &) = delete;
+
+  size_t BufferSize() const { return buffer_size_; }
+
+  // Returns an empty buffer, recycled if possible.
+  std::string TakeBuffer() {
+    std::string buffer;
+    {
+      std::scoped_lock lk(m_);
+      if (!free_.empty()) {
+        buffer = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+    buffer.reserve(buffer_size_);
+    return buffer;
+  }
+
+  // Queues a buffer of complete lines for the writer thread.
+  void Submit(std::string buffer) {
+    if (buffer.empty()) {
+      return;
+    }
+    {
+      std::scoped_lock lk(m_);
+      queue_.push_back(std::move(buffer));
+      submitted_ += 1;
+    }
+    work_cv_.notify_one();
+  }
+
+  // Blocks until everything submitted so far has been written. Throws if a
+  // write failed.
+  void Wait() {
+    std::unique_lock lk(m_);
+    done_cv_.wait(lk, [this] { return written_ == submitted_; });
+    if (error_ != 0) {
+      throw std::runtime_error("OutputSink: write failed with errno " + std::to_string(error_));
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxFreeBuffers = 64;
+  static constexpr size_t kMaxBatch = 64;
+
+  void WriterLoop() {
+    std::vector<std::string> batch;
+    std::unique_lock lk(m_);
+    while (true) {
+      work_cv_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      std::swap(batch, queue_);
+      lk.unlock();
+
+      for (size_t i = 0; i < batch.size(); i += kMaxBatch) {
+        WriteAll(&batch[i], std::min(kMaxBatch, batch.size() - i));
+      }
+
+      lk.lock();
+      written_ += batch.size();
+      for (std::string &buffer : batch) {
+        if (free_.size() < kMaxFreeBuffers) {
+          buffer.clear();
+          free_.push_back(std::move(buffer));
+        }
+      }
+      batch.clear();
+      done_cv_.notify_all();
+    }
+  }
+
+  // Writes n buffers with as few writev calls as possible, handling
+  // partial writes and interrupted calls.
+  void WriteAll(std::string *buffers, size_t n) {
+    iovec iov[kMaxBatch];
+    for (size_t i = 0; i < n; i++) {
+      iov[i].iov_base = buffers[i].data();
+      iov[i].iov_len = buffers[i].size();
+    }
+    iovec *next = iov;
+    size_t left = n;
+    while (left > 0) {
+      ssize_t written = writev(fd_, next, static_cast<int>(left));
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::scoped_lock lk(m_);
+        error_ = errno;
+        return;
+      }
+      size_t remaining = static_cast<size_t>(written);
+      while (left > 0 && remaining >= next->iov_len) {
+        remaining -= next->iov_len;
+        next++;
+        left--;
+      }
+      if (left > 0) {
+        next->iov_base = static_cast<char *>(next->iov_base) + remaining;
+        next->iov_len -= remaining;
+      }
+    }
+  }
+
+  const int fd_;
+  const size_t buffer_size_;
+
+  std::mutex m_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::vector<std::string> queue_;
+  std::vector<std::string> free_;
+  size_t submitted_{0};
+  size_t written_{0};
+  int error_{0};
+  bool stop_{false};
+
+  // Declared last, so the thread starts after everything it uses exists.
+  std::thread writer_;
+};
+
+// A per-thread buffer in front of an OutputSink. Don't share one between
+// threads; give each thread its own.
+class BufferedWriter {
+ public:
+  explicit BufferedWriter(OutputSink &sink) : sink_(sink), buffer_(sink.TakeBuffer()) {}
+  ~BufferedWriter() { sink_.Submit(std::move(buffer_)); }
+
+  BufferedWriter(const BufferedWriter &) = delete;
+  BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+  BufferedWriter &operator<<(std::string_view s) {
+    buffer_.append(s);
+    MaybeSubmit();
+    return *this;
+  }
+
+  BufferedWriter &operator<<(const char *s) { return *this << std::string_view(s); }
+
+  BufferedWriter &operator<<(char c) {
+    buffer_.push_back(c);
+    MaybeSubmit();
+    return *this;
+  }
+
+  // Integers and floating point numbers, formatted with std::to_chars.
+  // Floating point numbers use the shortest representation that reads back
+  // as the same value.
+  template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+                                                    !std::is_same_v<T, char>>>
+  BufferedWriter &operator<<(T value) {
+    char digits[64];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, result.ptr);
+    MaybeSubmit();
+    return *this;
+  }
+
+  // Hands everything written so far to the sink. The sink writes it soon,
+  // on its own thread; call OutputSink::Wait() to wait for that.
+  void flush() {
+    sink_.Submit(std::move(buffer_));
+    buffer_ = sink_.TakeBuffer();
+  }
+
+  // Flushes, then blocks until the sink has written everything submitted
+  // so far, from any thread.
+  void wait() {
+    flush();
+    sink_.Wait();
+  }
+
+ private:
+  // When the buffer is full, submit the complete lines and keep the partial
+  // last line. A single line longer than the buffer just grows it.
+  void MaybeSubmit() {
+    if (buffer_.size() < sink_.BufferSize()) {
+      return;
+    }
+    size_t end_of_lines = buffer_.rfind('\n');
+    if (end_of_lines == std::string::npos) {
+      return;
+    }
+    std::string next = sink_.TakeBuffer();
+    next.append(buffer_, end_of_lines + 1, std::string::npos);
+    buffer_.resize(end_of_lines + 1);
+    sink_.Submit(std::move(buffer_));
+    buffer_ = std::move(next);
+  }
+
+  OutputSink &sink_;
+  std::string buffer_;
+};
+
+// The BufferedWriter for stdout of the calling thread. The sink is a
+// function-local static, so it is destroyed (and drained) after the main
+// thread's thread_local writer has handed over its last lines.
+BufferedWriter &out() {
+  static OutputSink stdout_sink(STDOUT_FILENO);
+  thread_local BufferedWriter writer(stdout_sink);
+  return writer;
+}
+
+// The Point class from vectors.cpp, printing through out().
+class Point {
+public:
+  Point() : x_(0), y_(0) {}
+  Point(int x, int y) : x_(x), y_(y) {}
+
+  inline int GetX() const { return x_; }
+  inline int GetY() const { return y_; }
+  inline void SetX(int x) { x_ = x; }
+  inline void SetY(int y) { y_ = y; }
+  void PrintPoint() const {
+    out() << "Point value is (" << x_ << ", " << y_ << ")\n";
+  }
+
+private:
+  int x_;
+  int y_;
+};
+
+// print_int_vector from vectors.cpp, printing through out().
+void print_int_vector(const std::vector<int> &vec) {
+  for (const int &elem : vec) {
+    out() << elem << ' ';
+  }
+  out() << '\n';
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char *name, int lines, double seconds) {
+  std::cout << "  " << name << static_cast<double>(lines) / seconds / 1e6 << " M lines/s\n";
+}
+
+int main(int argc, char **argv) {
+  const int lines = argc > 1 ? std::stoi(argv[1]) : 1000000;
+  const std::string path = argc > 2 ? argv[2] : "/dev/null";
+
+  // The demo from vectors.cpp.
+  std::vector<Point> point_vector = {Point(35, 36), Point(37, 38), Point(39, 40)};
+  for (const Point &item : point_vector) {
+    item.PrintPoint();
+  }
+  print_int_vector({0, 1, 2, 3, 4, 5, 6});
+  out() << "Floats are formatted exactly: " << 0.1 << ' ' << 1.0 / 3 << ' ' << 2.5f << '\n';
+  out().flush();
+
+  // Lines from several threads never interleave mid-line.
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 3; t++) {
+    threads.emplace_back([t] { out() << "Hello from thread " << t << '\n'; });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  // The threads' writers flushed when the threads exited; wait for the
+  // writer thread to print the demo before the benchmark output.
+  out().wait();
+  std::cout << "Writing " << lines << " lines to " << path << ":\n";
+
+  {
+    std::ofstream file(path);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lines; i++) {
+      file << "Point value is (" << i << ", " << i * 0.5 << ")" << std::endl;
+    }
+    report("std::endl:                ", lines, seconds_since(start));
+  }
+
+  {
+    std::ofstream file(path);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lines; i++) {
+      file << "Point value is (" << i << ", " << i * 0.5 << ")\n";
+    }
+    file.flush();
+    report("'\\n':                     ", lines, seconds_since(start));
+  }
+
+  for (int num_threads : {1, 4}) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + path);
+    }
+    auto start = std::chrono::steady_clock::now();
+    {
+      OutputSink sink(fd);
+      std::vector<std::thread> writers;
+      for (int t = 0; t < num_threads; t++) {
+        writers.emplace_back([&, t] {
+          BufferedWriter writer(sink);
+          for (int i = t; i < lines; i += num_threads) {
+            writer << "Point value is (" << i << ", " << i * 0.5 << ")\n";
+          }
+        });
+      }
+      for (std::thread &t : writers) {
+        t.join();
+      }
+      sink.Wait();
+    }
+    close(fd);
+    report(num_threads == 1 ? "BufferedWriter, 1 thread:  " : "BufferedWriter, 4 threads: ", lines,
+           seconds_since(start));
+  }
+  return 0;
+}
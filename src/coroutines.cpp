@@ -0,0 +1,672 @@
+/**
+ * @file coroutines.cpp
+ * @brief Tutorial code for a small C++20 coroutine runtime: tasks, an event
+ * loop, an async mutex, async events and condition variables, and when_all.
+ */
+
+// In condition_variable.cpp, waiter_thread blocks in cv.wait, and every demo
+// blocks its main thread in join(). A blocked thread does nothing, but it
+// still costs an OS thread: a kernel task, a stack (8 MB of address space,
+// of which at least a few pages are touched), and a kernel context switch
+// of a microsecond or more whenever it sleeps or wakes. Tens of thousands of
+// waiters means tens of thousands of threads.
+
+// C++20 coroutines let a function suspend in the middle (at a co_await) and
+// resume later, without a thread of its own. The state that has to survive
+// the suspension lives in a heap-allocated "coroutine frame", typically a
+// few hundred bytes, and resuming is an indirect function call. What C++20
+// does not provide is the library around them. This file builds a minimal
+// one:
+//   - task<T>, a coroutine that produces a T. Tasks are lazy: they start
+//     when they are co_awaited, and when they finish they resume the
+//     coroutine that awaited them.
+//   - EventLoop, a single-threaded executor with a queue of coroutines that
+//     are ready to run. Spawn() starts a task, Run() runs until every task
+//     is done, and co_await loop.Yield() lets other coroutines run.
+//   - AsyncMutex, AsyncEvent and AsyncConditionVariable. Waiting on them
+//     suspends the coroutine instead of blocking the thread, and releasing
+//     them schedules the waiters on the event loop.
+//   - when_all, which runs several tasks concurrently and waits for all of
+//     them.
+// All of this runs on one thread, so there are no data races between
+// coroutines; they only interleave at co_await points. AsyncMutex is still
+// needed whenever a critical section contains a co_await.
+
+// This file needs C++20, so CMakeLists.txt compiles just this target with
+// CXX_STANDARD 20. The benchmark compares 100,000 coroutine waiters against
+// 1,000 thread waiters (pass different numbers as the first and second
+// arguments), in memory per waiter and time to wake them all, and then
+// compares the time of a coroutine switch against an OS thread switch.
+
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the coroutine support library.
+#include <coroutine>
+// Includes std::condition_variable, for the thread comparison.
+#include <condition_variable>
+// Includes std::deque, the event loop's ready queue.
+#include <deque>
+// Includes std::exception_ptr.
+#include <exception>
+// Includes std::ifstream, for reading memory usage from /proc.
+#include <fstream>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::optional, which holds a task's result.
+#include <optional>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes the utility header for std::move and std::exchange.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+template <typename T = void>
+class task;
+
+// The promise is the part of a coroutine frame that the coroutine's return
+// object talks to. This base holds what every task promise needs: the
+// coroutine to resume when this one finishes, and any exception it threw.
+class TaskPromiseBase {
+ public:
+  // Tasks are lazy: they don't run until someone co_awaits them.
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  // When a task finishes, it resumes whoever awaited it. Returning the
+  // handle from await_suspend ("symmetric transfer") jumps straight to it,
+  // without growing the stack.
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+      return h.promise().continuation_;
+    }
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { error_ = std::current_exception(); }
+
+  std::coroutine_handle<> continuation_{std::noop_coroutine()};
+  std::exception_ptr error_;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+ public:
+  task<T> get_return_object();
+
+  template <typename U>
+  void return_value(U &&value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T Result() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+ public:
+  task<void> get_return_object();
+
+  void return_void() {}
+
+  void Result() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+};
+
+// The task type. It owns the coroutine frame, and is move-only, like
+// std::unique_ptr.
+template <typename T>
+class task {
+ public:
+  using promise_type = TaskPromise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit task(Handle handle) : handle_(handle) {}
+  task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      Destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() { Destroy(); }
+
+  // co_await on a task starts it, and resumes the awaiting coroutine with
+  // the task's result when it finishes.
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return handle_.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation_ = awaiting;
+        return handle_;
+      }
+      T await_resume() { return handle_.promise().Result(); }
+      Handle handle_;
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  void Destroy() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  Handle handle_;
+};
+
+template <typename T>
+task<T> TaskPromise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline task<void> TaskPromise<void>::get_return_object() {
+  return task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// A fire-and-forget coroutine, used to run spawned tasks. It waits to be
+// scheduled, and its frame frees itself when it finishes.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+  std::coroutine_handle<> handle_;
+};
+
+// The single-threaded executor.
+class EventLoop {
+ public:
+  void Schedule(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+  // Starts a task once Run() is called. If the task throws, Run() rethrows
+  // the first such exception after everything else has finished.
+  void Spawn(task<void> t) { Schedule(RunDetached(std::move(t)).handle_); }
+
+  // Resumes ready coroutines until there are none left.
+  void Run() {
+    while (!ready_.empty()) {
+      std::coroutine_handle<> h = ready_.front();
+      ready_.pop_front();
+      h.resume();
+    }
+    if (error_) {
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+
+  // co_await loop.Yield() puts the current coroutine at the back of the
+  // ready queue.
+  auto Yield() {
+    struct Awaiter {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { loop_->Schedule(h); }
+      void await_resume() noexcept {}
+      EventLoop *loop_;
+    };
+    return Awaiter{this};
+  }
+
+ private:
+  Detached RunDetached(task<void> t) {
+    try {
+      co_await std::move(t);
+    } catch (...) {
+      if (!error_) {
+        error_ = std::current_exception();
+      }
+    }
+  }
+
+  std::deque<std::coroutine_handle<>> ready_;
+  std::exception_ptr error_;
+};
+
+// A mutex for coroutines. lock() suspends the coroutine if the mutex is
+// taken; unlock() hands the mutex directly to the first waiter and
+// schedules it, so waiters get the lock in FIFO order.
+class AsyncMutex {
+ public:
+  explicit AsyncMutex(EventLoop &loop) : loop_(loop) {}
+
+  // RAII ownership of the mutex, like std::scoped_lock. Obtain one with
+  // co_await m.scoped_lock().
+  class Guard {
+   public:
+    explicit Guard(AsyncMutex *m) : m_(m) {}
+    Guard(Guard &&other) noexcept : m_(std::exchange(other.m_, nullptr)) {}
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+    ~Guard() {
+      if (m_ != nullptr) {
+        m_->unlock();
+      }
+    }
+
+   private:
+    AsyncMutex *m_;
+  };
+
+  struct LockAwaiter {
+    bool await_ready() noexcept {
+      if (!m_->locked_) {
+        m_->locked_ = true;
+        return true;
+      }
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> h) { m_->waiters_.push_back(h); }
+    void await_resume() noexcept {}
+    AsyncMutex *m_;
+  };
+
+  struct ScopedLockAwaiter : LockAwaiter {
+    Guard await_resume() noexcept { return Guard(m_); }
+  };
+
+  LockAwaiter lock() { return {this}; }
+  ScopedLockAwaiter scoped_lock() { return {{this}}; }
+
+  void unlock() {
+    if (waiters_.empty()) {
+      locked_ = false;
+    } else {
+      // The mutex stays locked; it now belongs to the waiter.
+      loop_.Schedule(waiters_.front());
+      waiters_.pop_front();
+    }
+  }
+
+ private:
+  EventLoop &loop_;
+  bool locked_{false};
+  std::deque<std::coroutine_handle<>> waiters_;
+};
+
+// A manual-reset event: co_await event.Wait() suspends until Set() is
+// called, and returns immediately afterwards.
+class AsyncEvent {
+ public:
+  explicit AsyncEvent(EventLoop &loop) : loop_(loop) {}
+
+  auto Wait() {
+    struct Awaiter {
+      bool await_ready() noexcept { return event_->set_; }
+      void await_suspend(std::coroutine_handle<> h) { event_->waiters_.push_back(h); }
+      void await_resume() noexcept {}
+      AsyncEvent *event_;
+    };
+    return Awaiter{this};
+  }
+
+  void Set() {
+    set_ = true;
+    for (std::coroutine_handle<> h : waiters_) {
+      loop_.Schedule(h);
+    }
+    waiters_.clear();
+  }
+
+ private:
+  EventLoop &loop_;
+  bool set_{false};
+  std::vector<std::coroutine_handle<>> waiters_;
+};
+
+// A condition variable for coroutines, used with an AsyncMutex the way
+// std::condition_variable is used with a std::mutex.
+class AsyncConditionVariable {
+ public:
+  explicit AsyncConditionVariable(EventLoop &loop) : loop_(loop) {}
+
+  // Must be called with m locked; returns with m locked and pred() true.
+  template <typename Predicate>
+  task<void> Wait(AsyncMutex &m, Predicate pred) {
+    while (!pred()) {
+      m.unlock();
+      co_await Suspend();
+      co_await m.lock();
+    }
+  }
+
+  void notify_one() {
+    if (!waiters_.empty()) {
+      loop_.Schedule(waiters_.front());
+      waiters_.pop_front();
+    }
+  }
+
+  void notify_all() {
+    for (std::coroutine_handle<> h : waiters_) {
+      loop_.Schedule(h);
+    }
+    waiters_.clear();
+  }
+
+ private:
+  auto Suspend() {
+    struct Awaiter {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { cv_->waiters_.push_back(h); }
+      void await_resume() noexcept {}
+      AsyncConditionVariable *cv_;
+    };
+    return Awaiter{this};
+  }
+
+  EventLoop &loop_;
+  std::deque<std::coroutine_handle<>> waiters_;
+};
+
+// when_all runs a set of tasks concurrently and finishes when all of them
+// have. Each task is wrapped in a WhenAllChild coroutine that stores the
+// result and, if it is the last one to finish, resumes the parent.
+struct WhenAllState {
+  size_t remaining_;
+  std::coroutine_handle<> parent_;
+  std::exception_ptr error_;
+};
+
+class WhenAllChild {
+ public:
+  struct promise_type {
+    WhenAllChild get_return_object() { return WhenAllChild(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        WhenAllState *state = h.promise().state_;
+        return --state->remaining_ == 0 ? state->parent_ : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+    WhenAllState *state_;
+  };
+
+  explicit WhenAllChild(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+  WhenAllChild(WhenAllChild &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  WhenAllChild(const WhenAllChild &) = delete;
+  WhenAllChild &operator=(const WhenAllChild &) = delete;
+  ~WhenAllChild() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  void Start(WhenAllState *state) {
+    handle_.promise().state_ = state;
+    handle_.resume();
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Starts every child, then suspends the parent until the last child
+// finishes. The counter starts at one more than the number of children, so
+// a child that finishes while we are still starting the others can't
+// resume the parent early; the parent's own decrement settles it.
+inline auto WaitForChildren(WhenAllState &state, std::vector<WhenAllChild> &children) {
+  struct Awaiter {
+    bool await_ready() noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> parent) {
+      state_.parent_ = parent;
+      for (WhenAllChild &child : children_) {
+        child.Start(&state_);
+      }
+      return --state_.remaining_ > 0;
+    }
+    void await_resume() {
+      if (state_.error_) {
+        std::rethrow_exception(state_.error_);
+      }
+    }
+    WhenAllState &state_;
+    std::vector<WhenAllChild> &children_;
+  };
+  return Awaiter{state, children};
+}
+
+template <typename T>
+WhenAllChild RunWhenAllChild(task<T> t, std::optional<T> &out, WhenAllState &state) {
+  try {
+    out.emplace(co_await std::move(t));
+  } catch (...) {
+    if (!state.error_) {
+      state.error_ = std::current_exception();
+    }
+  }
+}
+
+inline WhenAllChild RunWhenAllChild(task<void> t, WhenAllState &state) {
+  try {
+    co_await std::move(t);
+  } catch (...) {
+    if (!state.error_) {
+      state.error_ = std::current_exception();
+    }
+  }
+}
+
+template <typename T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+  WhenAllState state{tasks.size() + 1, nullptr, nullptr};
+  std::vector<std::optional<T>> results(tasks.size());
+  std::vector<WhenAllChild> children;
+  children.reserve(tasks.size());
+  for (size_t i = 0; i < tasks.size(); i++) {
+    children.push_back(RunWhenAllChild(std::move(tasks[i]), results[i], state));
+  }
+  co_await WaitForChildren(state, children);
+  std::vector<T> values;
+  values.reserve(results.size());
+  for (std::optional<T> &result : results) {
+    values.push_back(std::move(*result));
+  }
+  co_return values;
+}
+
+inline task<void> when_all(std::vector<task<void>> tasks) {
+  WhenAllState state{tasks.size() + 1, nullptr, nullptr};
+  std::vector<WhenAllChild> children;
+  children.reserve(tasks.size());
+  for (task<void> &t : tasks) {
+    children.push_back(RunWhenAllChild(std::move(t), state));
+  }
+  co_await WaitForChildren(state, children);
+}
+
+// condition_variable.cpp, ported. Two coroutines increment count, and the
+// waiter resumes once count is 2. No threads are created.
+int count = 0;
+
+task<void> add_count_and_notify(AsyncMutex &m, AsyncConditionVariable &cv) {
+  auto lk = co_await m.scoped_lock();
+  count += 1;
+  if (count == 2) {
+    cv.notify_one();
+  }
+}
+
+task<void> waiter(AsyncMutex &m, AsyncConditionVariable &cv) {
+  co_await m.lock();
+  co_await cv.Wait(m, [] { return count == 2; });
+  std::cout << "Printing count: " << count << std::endl;
+  m.unlock();
+}
+
+// Resident and virtual memory of this process in bytes, from
+// /proc/self/statm. Returns zeros where /proc isn't available.
+struct MemoryUsage {
+  long long virtual_bytes_{0};
+  long long resident_bytes_{0};
+};
+
+MemoryUsage memory_usage() {
+  MemoryUsage usage;
+  std::ifstream statm("/proc/self/statm");
+  long long pages_virtual = 0;
+  long long pages_resident = 0;
+  if (statm >> pages_virtual >> pages_resident) {
+    usage.virtual_bytes_ = pages_virtual * 4096;
+    usage.resident_bytes_ = pages_resident * 4096;
+  }
+  return usage;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+task<int> wait_for_event(AsyncEvent &event, int id) {
+  co_await event.Wait();
+  co_return id;
+}
+
+task<void> many_waiters(EventLoop &loop, AsyncEvent &event, int n) {
+  MemoryUsage before = memory_usage();
+  std::vector<task<int>> tasks;
+  tasks.reserve(n);
+  for (int i = 0; i < n; i++) {
+    tasks.push_back(wait_for_event(event, i));
+  }
+  task<std::vector<int>> all = when_all(std::move(tasks));
+  // Start the waiters, then measure and wake them from another coroutine.
+  std::chrono::steady_clock::time_point woken_at;
+  loop.Spawn([](AsyncEvent &event, MemoryUsage before, int n,
+                std::chrono::steady_clock::time_point &woken_at) -> task<void> {
+    MemoryUsage after = memory_usage();
+    std::cout << "  " << n << " coroutine waiters: "
+              << static_cast<double>(after.resident_bytes_ - before.resident_bytes_) / n << " resident bytes each\n";
+    woken_at = std::chrono::steady_clock::now();
+    event.Set();
+    co_return;
+  }(event, before, n, woken_at));
+  std::vector<int> ids = co_await std::move(all);
+  std::cout << "  woke all " << ids.size() << " coroutines in " << seconds_since(woken_at) * 1000 << " ms\n";
+}
+
+void thread_waiters(int n) {
+  std::mutex m;
+  std::condition_variable cv;
+  bool ready = false;
+  int waiting = 0;
+  int done = 0;
+
+  MemoryUsage before = memory_usage();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n; i++) {
+    threads.emplace_back([&] {
+      std::unique_lock lk(m);
+      waiting += 1;
+      cv.notify_all();
+      cv.wait(lk, [&] { return ready; });
+      done += 1;
+    });
+  }
+  {
+    std::unique_lock lk(m);
+    cv.wait(lk, [&] { return waiting == n; });
+  }
+  MemoryUsage after = memory_usage();
+  std::cout << "  " << n << " thread waiters: "
+            << static_cast<double>(after.resident_bytes_ - before.resident_bytes_) / n << " resident bytes and "
+            << static_cast<double>(after.virtual_bytes_ - before.virtual_bytes_) / n / 1024
+            << " KB of address space each\n";
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::scoped_lock lk(m);
+    ready = true;
+  }
+  cv.notify_all();
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  std::cout << "  woke and joined all " << done << " threads in " << seconds_since(start) * 1000 << " ms\n";
+}
+
+// Two coroutines take turns through the event loop.
+task<void> ping(EventLoop &loop, int rounds) {
+  for (int i = 0; i < rounds; i++) {
+    co_await loop.Yield();
+  }
+}
+
+// Two threads take turns through a mutex and condition variable.
+double thread_switch_ns(int rounds) {
+  std::mutex m;
+  std::condition_variable cv;
+  int turn = 0;
+  auto player = [&](int me) {
+    for (int i = 0; i < rounds; i++) {
+      std::unique_lock lk(m);
+      cv.wait(lk, [&] { return turn == me; });
+      turn = 1 - me;
+      cv.notify_one();
+    }
+  };
+  auto start = std::chrono::steady_clock::now();
+  std::thread t1(player, 0);
+  std::thread t2(player, 1);
+  t1.join();
+  t2.join();
+  return seconds_since(start) * 1e9 / (2.0 * rounds);
+}
+
+int main(int argc, char **argv) {
+  const int coroutine_waiters = argc > 1 ? std::stoi(argv[1]) : 100000;
+  const int thread_waiters_count = argc > 2 ? std::stoi(argv[2]) : 1000;
+
+  EventLoop loop;
+  AsyncMutex m(loop);
+  AsyncConditionVariable cv(loop);
+  loop.Spawn(waiter(m, cv));
+  loop.Spawn(add_count_and_notify(m, cv));
+  loop.Spawn(add_count_and_notify(m, cv));
+  loop.Run();
+
+  std::cout << "Waiting for an event:\n";
+  AsyncEvent event(loop);
+  loop.Spawn(many_waiters(loop, event, coroutine_waiters));
+  loop.Run();
+  thread_waiters(thread_waiters_count);
+
+  const int rounds = 200000;
+  loop.Spawn(ping(loop, rounds));
+  loop.Spawn(ping(loop, rounds));
+  auto start = std::chrono::steady_clock::now();
+  loop.Run();
+  double coroutine_ns = seconds_since(start) * 1e9 / (2.0 * rounds);
+  std::cout << "Switching between two waiters:\n"
+            << "  coroutines: " << coroutine_ns << " ns per switch\n"
+            << "  threads:    " << thread_switch_ns(rounds / 10) << " ns per switch" << std::endl;
+  return 0;
+}
@@ -0,0 +1,577 @@
+/**
+ * @file cuckoo_map.cpp
+ * @brief Tutorial code for a bucketized cuckoo hash map that stays fast when
+ * it is over 90% full, and lets readers look up keys without taking locks.
+ */
+
+// std::unordered_map<std::string, int> from unordered_maps.cpp allocates one
+// node per key: the key, the value, a next pointer and the cached hash,
+// rounded up by the allocator, plus an 8-byte bucket pointer. That is over
+// 70 bytes for a 20-byte entry. And a lookup follows a chain of nodes whose
+// length depends on luck.
+
+// A cuckoo hash map stores the entries themselves in an array of buckets of
+// 4 slots each. Every key has exactly two buckets it may live in, picked by
+// two hash functions, so a lookup looks at no more than 8 slots, in two
+// places in memory, every time. A bucket is a version word, an occupancy
+// byte and the 4 slots, not padded to a cache line so that entries stay
+// dense: with the demo's 24-byte entries a bucket is 112 bytes, so each of
+// the two places is two or three adjacent cache lines. When both buckets of
+// a new key are full, insert makes room by moving one of the keys in them
+// to its other bucket, which may in turn move another key, and so on; like
+// a cuckoo chick pushing eggs out of the nest. We search for the shortest such chain of
+// moves breadth first (BFS), which finds one almost always while the table
+// is up to about 95% full. So the table can be sized for 95% load, and an
+// entry costs little more than its own bytes.
+
+// Concurrency follows MemC3 and libcuckoo:
+//   - Each bucket has a version counter that doubles as its writer lock, as
+//     in seqlock.cpp: a writer makes it odd, changes the bucket, and makes
+//     it even again. Writers lock only the (at most two) buckets they
+//     change, so writers on different buckets don't wait for each other.
+//   - A reader never writes shared memory. It reads the versions of the
+//     key's two buckets, searches both buckets, and reads the versions
+//     again. If nothing changed, its answer is consistent; otherwise it
+//     retries. Because a key only ever moves between its own two buckets,
+//     checking both buckets under one snapshot can't miss a key that is
+//     being moved.
+//   - Insert runs the BFS without locks, then performs the moves one by
+//     one, last one first, each under the locks of its two buckets, checking
+//     that the slot still holds what the BFS saw. If another writer got in
+//     the way, the insert starts over.
+// As in seqlock.cpp, reading a slot that a writer may be changing is only
+// allowed for atomics, so the slots hold relaxed std::atomic words and keys
+// and values must be trivially copyable. ShortKey is such a key: a string of
+// up to 15 characters stored inline, like "garlic rice". To keep readers
+// lock-free, the table doesn't grow; it is sized for a capacity up front,
+// and insert throws std::length_error once no room can be made.
+
+// The benchmark fills a table sized for 1,000,000 keys (pass a different
+// number as the first argument) to 95% load, compares its memory per entry
+// with std::unordered_map<std::string, int>, and then measures read
+// throughput with 1 to 16 readers next to one writer, against
+// std::unordered_map behind a std::shared_mutex.
+
+// Includes std::min.
+#include <algorithm>
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint8_t, uint32_t and uint64_t.
+#include <cstdint>
+// Includes std::memcpy and std::memcmp.
+#include <cstring>
+// Includes std::ifstream, to read /proc/self/statm.
+#include <fstream>
+// Includes std::hash.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::mt19937_64.
+#include <random>
+// Includes the shared mutex library header.
+#include <shared_mutex>
+// Includes std::length_error and std::invalid_argument.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::string_view.
+#include <string_view>
+// Includes the thread library header.
+#include <thread>
+// Includes std::is_trivially_copyable_v.
+#include <type_traits>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes the header for std::vector.
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+// Includes _mm_pause.
+#include <immintrin.h>
+#endif
+
+// Tells the CPU that we are in a spin loop.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// A string of up to 15 characters, stored inline so that it is trivially
+// copyable. Unused bytes are zero, so keys compare with one memcmp.
+class ShortKey {
+ public:
+  ShortKey() = default;
+  ShortKey(std::string_view s) {
+    if (s.size() > kMaxSize) {
+      throw std::invalid_argument("ShortKey holds at most 15 characters");
+    }
+    std::memcpy(chars_, s.data(), s.size());
+    size_ = static_cast<uint8_t>(s.size());
+  }
+
+  std::string_view view() const { return std::string_view(chars_, size_); }
+  bool operator==(const ShortKey &other) const { return std::memcmp(this, &other, sizeof(ShortKey)) == 0; }
+
+ private:
+  static constexpr size_t kMaxSize = 15;
+
+  char chars_[kMaxSize]{};
+  uint8_t size_ = 0;
+};
+
+struct ShortKeyHash {
+  uint64_t operator()(const ShortKey &key) const { return std::hash<std::string_view>{}(key.view()); }
+};
+
+template <typename K, typename V, typename Hash = std::hash<K>>
+class CuckooMap {
+  static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                "CuckooMap copies keys and values through atomic words, so they must be trivially copyable");
+
+ public:
+  // Sizes the table so that `capacity` keys fill 95% of its slots.
+  explicit CuckooMap(size_t capacity)
+      : buckets_(std::max<size_t>(2, static_cast<size_t>(static_cast<double>(capacity) / (kSlots * 0.95)) + 1)) {}
+
+  CuckooMap(const CuckooMap &) = delete;
+  CuckooMap &operator=(const CuckooMap &) = delete;
+
+  // Copies the value for key into *value and returns true, or returns false.
+  // Takes no locks and writes no shared memory.
+  bool find(const K &key, V *value) const {
+    uint64_t h = Hash{}(key);
+    size_t b1 = Primary(h);
+    size_t b2 = Alternate(h, b1);
+    while (true) {
+      uint64_t v1 = buckets_[b1].version_.load(std::memory_order_acquire);
+      uint64_t v2 = buckets_[b2].version_.load(std::memory_order_acquire);
+      if (v1 % 2 == 1 || v2 % 2 == 1) {
+        cpu_relax();
+        continue;
+      }
+      V copy;
+      bool found = Search(b1, key, &copy) || Search(b2, key, &copy);
+      // The fence keeps the second reads of the versions from moving before
+      // the reads of the slots.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (buckets_[b1].version_.load(std::memory_order_relaxed) == v1 &&
+          buckets_[b2].version_.load(std::memory_order_relaxed) == v2) {
+        if (found) {
+          *value = copy;
+        }
+        return found;
+      }
+    }
+  }
+
+  // Inserts the key, or overwrites its value. Returns true if the key is
+  // new. Throws std::length_error if the table is too full to make room.
+  bool insert(const K &key, const V &value) {
+    uint64_t h = Hash{}(key);
+    size_t b1 = Primary(h);
+    size_t b2 = Alternate(h, b1);
+    while (true) {
+      LockPair(b1, b2);
+      int slot = FindSlot(b1, key);
+      size_t b = b1;
+      if (slot < 0) {
+        slot = FindSlot(b2, key);
+        b = b2;
+      }
+      if (slot >= 0) {
+        StorePair(b, slot, {key, value});
+        UnlockPair(b1, b2);
+        return false;
+      }
+      for (size_t candidate : {b1, b2}) {
+        int free = FreeSlot(candidate);
+        if (free >= 0) {
+          StorePair(candidate, free, {key, value});
+          SetOccupied(candidate, free, true);
+          UnlockPair(b1, b2);
+          size_.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      UnlockPair(b1, b2);
+      // Both buckets are full: move keys out of the way, then try again.
+      if (!MakeRoom(b1, b2)) {
+        throw std::length_error("cuckoo map is full");
+      }
+    }
+  }
+
+  bool erase(const K &key) {
+    uint64_t h = Hash{}(key);
+    size_t b1 = Primary(h);
+    size_t b2 = Alternate(h, b1);
+    LockPair(b1, b2);
+    bool erased = false;
+    for (size_t b : {b1, b2}) {
+      int slot = FindSlot(b, key);
+      if (slot >= 0) {
+        SetOccupied(b, slot, false);
+        erased = true;
+        break;
+      }
+    }
+    UnlockPair(b1, b2);
+    if (erased) {
+      size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return erased;
+  }
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+  size_t slots() const { return buckets_.size() * kSlots; }
+  size_t bytes() const { return buckets_.size() * sizeof(Bucket); }
+
+ private:
+  static constexpr int kSlots = 4;
+  // The BFS gives up after looking at this many buckets, which covers
+  // paths of up to 5 moves.
+  static constexpr size_t kMaxBfsBuckets = 1 + 4 + 16 + 64 + 256 + 1024;
+
+  struct Pair {
+    K key_;
+    V value_;
+  };
+  static constexpr size_t kWords = (sizeof(Pair) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  using Words = uint64_t[kWords];
+
+  struct Bucket {
+    std::atomic<uint64_t> version_{0};
+    std::atomic<uint8_t> occupied_{0};
+    std::atomic<uint64_t> words_[kSlots][kWords]{};
+  };
+
+  // Maps 32 bits of the mixed hash onto the buckets with a multiply instead
+  // of a modulo, so the number of buckets need not be a power of two. The
+  // mix matters because std::hash of an integer is the integer itself.
+  size_t Reduce(uint32_t bits) const { return static_cast<size_t>((uint64_t{bits} * buckets_.size()) >> 32); }
+  size_t Primary(uint64_t h) const { return Reduce(static_cast<uint32_t>(mix(h))); }
+  size_t Alternate(uint64_t h, size_t primary) const {
+    size_t b = Reduce(static_cast<uint32_t>(mix(h) >> 32));
+    return b != primary ? b : (primary + 1) % buckets_.size();
+  }
+  // The other bucket of a key that lives in bucket b.
+  size_t OtherBucket(const K &key, size_t b) const {
+    uint64_t h = Hash{}(key);
+    size_t b1 = Primary(h);
+    size_t b2 = Alternate(h, b1);
+    return b == b1 ? b2 : b1;
+  }
+
+  bool Occupied(size_t b, int slot) const {
+    return (buckets_[b].occupied_.load(std::memory_order_relaxed) >> slot) & 1;
+  }
+
+  Pair LoadPair(size_t b, int slot) const {
+    Words copy;
+    for (size_t i = 0; i < kWords; i++) {
+      copy[i] = buckets_[b].words_[slot][i].load(std::memory_order_relaxed);
+    }
+    Pair pair;
+    std::memcpy(&pair, copy, sizeof(Pair));
+    return pair;
+  }
+
+  // Only called with bucket b locked.
+  void StorePair(size_t b, int slot, const Pair &pair) {
+    Words copy{};
+    std::memcpy(copy, &pair, sizeof(Pair));
+    for (size_t i = 0; i < kWords; i++) {
+      buckets_[b].words_[slot][i].store(copy[i], std::memory_order_relaxed);
+    }
+  }
+
+  void SetOccupied(size_t b, int slot, bool occupied) {
+    uint8_t bits = buckets_[b].occupied_.load(std::memory_order_relaxed);
+    bits = occupied ? bits | (1 << slot) : bits & ~(1 << slot);
+    buckets_[b].occupied_.store(bits, std::memory_order_relaxed);
+  }
+
+  bool Search(size_t b, const K &key, V *value) const {
+    for (int slot = 0; slot < kSlots; slot++) {
+      if (Occupied(b, slot)) {
+        Pair pair = LoadPair(b, slot);
+        if (pair.key_ == key) {
+          *value = pair.value_;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  int FindSlot(size_t b, const K &key) const {
+    for (int slot = 0; slot < kSlots; slot++) {
+      if (Occupied(b, slot) && LoadPair(b, slot).key_ == key) {
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  int FreeSlot(size_t b) const {
+    for (int slot = 0; slot < kSlots; slot++) {
+      if (!Occupied(b, slot)) {
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  // Locks a bucket by making its version odd, as seqlock.cpp's BeginWrite.
+  void Lock(size_t b) {
+    std::atomic<uint64_t> &version = buckets_[b].version_;
+    uint64_t v = version.load(std::memory_order_relaxed);
+    while (v % 2 == 1 ||
+           !version.compare_exchange_weak(v, v + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+      cpu_relax();
+      v = version.load(std::memory_order_relaxed);
+    }
+    // The fence keeps the writes to the bucket from moving before the
+    // version becomes odd.
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void Unlock(size_t b) { buckets_[b].version_.fetch_add(1, std::memory_order_release); }
+
+  // Locks two buckets in index order, so two writers can't deadlock.
+  void LockPair(size_t a, size_t b) {
+    if (a == b) {
+      Lock(a);
+    } else {
+      Lock(std::min(a, b));
+      Lock(std::max(a, b));
+    }
+  }
+
+  void UnlockPair(size_t a, size_t b) {
+    Unlock(a);
+    if (a != b) {
+      Unlock(b);
+    }
+  }
+
+  // Finds the shortest chain of moves that frees a slot in b1 or b2, and
+  // performs it. Returns false if there is no such chain within the BFS
+  // limit. Returns true also when another writer interfered, so that the
+  // caller looks again.
+  bool MakeRoom(size_t b1, size_t b2) {
+    // Each BFS entry is a bucket, reached by moving the key in `slot_` of
+    // the parent entry's bucket to this bucket.
+    struct Step {
+      size_t bucket_;
+      int parent_;
+      int slot_;
+    };
+    std::vector<Step> steps{{b1, -1, -1}, {b2, -1, -1}};
+    steps.reserve(kMaxBfsBuckets);
+    for (size_t i = 0; i < steps.size() && steps.size() < kMaxBfsBuckets; i++) {
+      for (int slot = 0; slot < kSlots; slot++) {
+        if (!Occupied(steps[i].bucket_, slot)) {
+          // A slot opened up since we looked; nothing to move.
+          return true;
+        }
+        size_t next = OtherBucket(LoadPair(steps[i].bucket_, slot).key_, steps[i].bucket_);
+        steps.push_back({next, static_cast<int>(i), slot});
+        if (FreeSlot(next) >= 0) {
+          // Perform the moves from the free slot back to b1 or b2.
+          for (int s = static_cast<int>(steps.size()) - 1; steps[s].parent_ >= 0; s = steps[s].parent_) {
+            if (!Move(steps[steps[s].parent_].bucket_, steps[s].slot_, steps[s].bucket_)) {
+              return true;
+            }
+          }
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Moves the key in slot `slot` of bucket `from` to a free slot of bucket
+  // `to`, if it is still a key whose other bucket is `to`, and `to` still
+  // has room.
+  bool Move(size_t from, int slot, size_t to) {
+    LockPair(from, to);
+    bool moved = false;
+    if (Occupied(from, slot)) {
+      Pair pair = LoadPair(from, slot);
+      int free = FreeSlot(to);
+      if (free >= 0 && OtherBucket(pair.key_, from) == to) {
+        StorePair(to, free, pair);
+        SetOccupied(to, free, true);
+        SetOccupied(from, slot, false);
+        moved = true;
+      }
+    }
+    UnlockPair(from, to);
+    return moved;
+  }
+
+  std::vector<Bucket> buckets_;
+  std::atomic<size_t> size_{0};
+};
+
+// Resident memory of the process, from /proc/self/statm, or 0 where /proc
+// isn't available.
+long long resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  long long pages_virtual = 0;
+  long long pages_resident = 0;
+  statm >> pages_virtual >> pages_resident;
+  return pages_resident * 4096;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string key_name(size_t i) { return "key-" + std::to_string(i); }
+
+// Runs `readers` reader threads looking up random keys, next to one writer
+// that keeps overwriting values, for `ms` milliseconds. Values are always
+// the key's number plus a multiple of n, which readers check. Returns
+// millions of reads per second.
+template <typename Find, typename Write>
+double read_throughput(int readers, int ms, size_t n, const std::vector<ShortKey> &keys, Find find, Write write,
+                       size_t *errors) {
+  std::atomic<bool> stop{false};
+  std::atomic<long> reads{0};
+  std::atomic<size_t> bad{0};
+  std::vector<std::thread> threads;
+  for (int r = 0; r < readers; r++) {
+    threads.emplace_back([&, r] {
+      std::mt19937_64 rng(r);
+      long local_reads = 0;
+      size_t local_bad = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 256; i++) {
+          size_t k = rng() % n;
+          int value = -1;
+          local_bad += !find(keys[k], &value) || static_cast<size_t>(value) % n != k;
+        }
+        local_reads += 256;
+      }
+      reads.fetch_add(local_reads);
+      bad.fetch_add(local_bad);
+    });
+  }
+  threads.emplace_back([&] {
+    std::mt19937_64 rng(1000);
+    for (int round = 1; !stop.load(std::memory_order_relaxed); round++) {
+      size_t k = rng() % n;
+      write(keys[k], static_cast<int>(k + (round % 4) * n));
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  stop.store(true);
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  *errors += bad.load();
+  return static_cast<double>(reads.load()) / (ms * 1e3);
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+  // The map from unordered_maps.cpp, as a cuckoo map.
+  CuckooMap<ShortKey, int, ShortKeyHash> demo(16);
+  demo.insert(ShortKey("foo"), 2);
+  demo.insert(ShortKey("jignesh"), 445);
+  demo.insert(ShortKey("garlic rice"), 3);
+  demo.insert(ShortKey("spam"), 15);
+  int value = 0;
+  if (demo.find(ShortKey("jignesh"), &value)) {
+    std::cout << "Found key jignesh with value " << value << std::endl;
+  }
+  demo.erase(ShortKey("spam"));
+  std::cout << "After erase, spam is " << (demo.find(ShortKey("spam"), &value) ? "still there" : "gone") << std::endl;
+
+  std::vector<ShortKey> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    keys.emplace_back(key_name(i));
+  }
+
+  // Memory per entry.
+  long long before = resident_bytes();
+  CuckooMap<ShortKey, int, ShortKeyHash> cuckoo(n);
+  for (size_t i = 0; i < n; i++) {
+    cuckoo.insert(keys[i], static_cast<int>(i));
+  }
+  long long cuckoo_bytes = resident_bytes() - before;
+  before = resident_bytes();
+  std::unordered_map<std::string, int> unordered;
+  for (size_t i = 0; i < n; i++) {
+    unordered.insert({key_name(i), static_cast<int>(i)});
+  }
+  long long unordered_bytes = resident_bytes() - before;
+  std::cout << n << " keys: cuckoo map at " << 100.0 * cuckoo.size() / cuckoo.slots() << "% load, "
+            << static_cast<double>(cuckoo_bytes) / n << " bytes per entry; std::unordered_map "
+            << static_cast<double>(unordered_bytes) / n << " bytes per entry\n";
+
+  // How full a table gets before insert fails.
+  CuckooMap<ShortKey, int, ShortKeyHash> full(n);
+  size_t inserted = 0;
+  try {
+    for (size_t i = 0;; i++) {
+      full.insert(ShortKey(key_name(i)), static_cast<int>(i));
+      inserted++;
+    }
+  } catch (const std::length_error &) {
+  }
+  std::cout << "A table for " << n << " keys took " << inserted << " before insert failed: "
+            << 100.0 * inserted / full.slots() << "% load\n";
+
+  // Read throughput next to one writer.
+  std::shared_mutex m;
+  size_t errors = 0;
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n";
+  for (int readers : {1, 2, 4, 8, 16}) {
+    double cuckoo_rate = read_throughput(
+        readers, 200, n, keys, [&](const ShortKey &key, int *v) { return cuckoo.find(key, v); },
+        [&](const ShortKey &key, int v) { cuckoo.insert(key, v); }, &errors);
+    double locked_rate = read_throughput(
+        readers, 200, n, keys,
+        [&](const ShortKey &key, int *v) {
+          std::string k(key.view());
+          std::shared_lock lk(m);
+          auto it = unordered.find(k);
+          if (it == unordered.end()) {
+            return false;
+          }
+          *v = it->second;
+          return true;
+        },
+        [&](const ShortKey &key, int v) {
+          std::string k(key.view());
+          std::unique_lock lk(m);
+          unordered[k] = v;
+        },
+        &errors);
+    std::cout << "  " << readers << " readers + 1 writer: cuckoo map " << cuckoo_rate
+              << " M reads/s, std::unordered_map + std::shared_mutex " << locked_rate << " M reads/s\n";
+  }
+  std::cout << "Wrong or missing values read: " << errors << std::endl;
+  return 0;
+}
@@ -0,0 +1,303 @@
+/**
+ * @file expression_templates.cpp
+ * @brief Tutorial code for expression templates: lazy, zero-temporary
+ * arithmetic on arrays.
+ */
+
+// templated_functions.cpp defines add<T>(T a, T b), which returns a + b by
+// value. For ints and floats that is perfect. For an array type, it is not:
+// evaluating add(add(a, b), mul(c, d)) creates one full-size temporary array
+// per operation, and every temporary is written to memory once and read back
+// once. For arrays much bigger than the CPU caches, that memory traffic is
+// what the computation spends its time on.
+
+// Expression templates fix this. Instead of computing a result, a + b returns
+// a tiny object that *describes* the computation: "element i is a[i] + b[i]".
+// Combining such objects builds an expression tree whose shape is encoded in
+// its type, e.g. AddExpr<AddExpr<NumArray, NumArray>, MulExpr<NumArray,
+// NumArray>> for a + b + c * d. Nothing is computed until the tree is assigned
+// to a NumArray. At that point a single loop evaluates the whole tree for each
+// index, and because the compiler sees the entire tree in the type, it inlines
+// everything into one loop body that it can vectorize. No temporaries, one
+// pass over memory.
+
+// This program checks that the lazy and the eager versions compute the same
+// values, and then compares their runtime and memory traffic for a + b + c * d.
+// Pass a different array size as the first argument (default 10,000,000).
+
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::invalid_argument.
+#include <stdexcept>
+// Includes the C++ string library, for std::stoull.
+#include <string>
+// Includes std::enable_if_t and std::is_arithmetic_v.
+#include <type_traits>
+// Includes the header for std::vector.
+#include <vector>
+
+// Every node of an expression tree derives from Expr<Derived>. This is the
+// "curiously recurring template pattern" (CRTP): the base class knows the type
+// of the derived class, so it can call into it without virtual functions.
+// Self() is how generic code gets back the concrete expression type.
+template <typename Derived>
+struct Expr {
+  const Derived &Self() const { return static_cast<const Derived &>(*this); }
+};
+
+// The array type. It owns its data, and it is also a leaf of expression trees:
+// element i of the expression "a" is just a[i].
+template <typename T>
+class NumArray : public Expr<NumArray<T>> {
+ public:
+  using value_type = T;
+
+  NumArray() = default;
+  explicit NumArray(size_t n, T value = T()) : data_(n, value) {}
+
+  // Constructing or assigning from an expression is where evaluation happens.
+  template <typename E>
+  NumArray(const Expr<E> &expr) : data_(expr.Self().size()) {
+    Assign(expr.Self());
+  }
+
+  template <typename E>
+  NumArray &operator=(const Expr<E> &expr) {
+    data_.resize(expr.Self().size());
+    Assign(expr.Self());
+    return *this;
+  }
+
+  T operator[](size_t i) const { return data_[i]; }
+  T &operator[](size_t i) { return data_[i]; }
+  size_t size() const { return data_.size(); }
+
+ private:
+  // The single pass. After inlining, expr[i] for a + b + c * d becomes
+  // a[i] + b[i] + c[i] * d[i], and the compiler vectorizes this loop like any
+  // hand-written one. We read through a raw pointer so the compiler doesn't
+  // have to prove that writing to data_ doesn't change data_'s own size.
+  template <typename E>
+  void Assign(const E &expr) {
+    T *out = data_.data();
+    const size_t n = data_.size();
+    for (size_t i = 0; i < n; i++) {
+      out[i] = expr[i];
+    }
+  }
+
+  std::vector<T> data_;
+};
+
+// How an expression node stores a child. Arrays are stored by reference (we
+// never want to copy an array), but inner expression nodes are stored by
+// value. Those nodes are small temporaries that die at the end of the
+// statement that creates them, so `auto e = a + b + c;` would otherwise hold
+// a dangling reference to the temporary a + b.
+template <typename E>
+struct ExprStorage {
+  using type = const E;
+};
+
+template <typename T>
+struct ExprStorage<NumArray<T>> {
+  using type = const NumArray<T> &;
+};
+
+template <typename E>
+using ExprStorageT = typename ExprStorage<E>::type;
+
+// Element-wise operations need operands of the same length. The check runs
+// once, when a node is built, not once per element.
+inline void CheckSizes(size_t a, size_t b) {
+  if (a != b) {
+    throw std::invalid_argument("expression operands have different sizes");
+  }
+}
+
+// An expression node for a binary operation. The Op type supplies the
+// operation.
+template <typename L, typename R, typename Op>
+class BinaryExpr : public Expr<BinaryExpr<L, R, Op>> {
+ public:
+  BinaryExpr(const L &lhs, const R &rhs) : lhs_(lhs), rhs_(rhs) { CheckSizes(lhs.size(), rhs.size()); }
+
+  auto operator[](size_t i) const { return Op::Apply(lhs_[i], rhs_[i]); }
+  size_t size() const { return lhs_.size(); }
+
+ private:
+  ExprStorageT<L> lhs_;
+  ExprStorageT<R> rhs_;
+};
+
+// A fused multiply-add node: element i is a[i] * b[i] + c[i]. Expression
+// templates make fused operations easy to express as their own node type, so
+// they evaluate in the same single pass as everything else.
+template <typename A, typename B, typename C>
+class FmaExpr : public Expr<FmaExpr<A, B, C>> {
+ public:
+  FmaExpr(const A &a, const B &b, const C &c) : a_(a), b_(b), c_(c) {
+    CheckSizes(a.size(), b.size());
+    CheckSizes(a.size(), c.size());
+  }
+
+  auto operator[](size_t i) const { return a_[i] * b_[i] + c_[i]; }
+  size_t size() const { return a_.size(); }
+
+ private:
+  ExprStorageT<A> a_;
+  ExprStorageT<B> b_;
+  ExprStorageT<C> c_;
+};
+
+// The operations, as tiny structs with a static Apply function.
+struct AddOp {
+  template <typename T>
+  static T Apply(T a, T b) {
+    return a + b;
+  }
+};
+
+struct MulOp {
+  template <typename T>
+  static T Apply(T a, T b) {
+    return a * b;
+  }
+};
+
+template <typename L, typename R>
+using AddExpr = BinaryExpr<L, R, AddOp>;
+template <typename L, typename R>
+using MulExpr = BinaryExpr<L, R, MulOp>;
+
+// The operators. They accept any two expressions and return a new expression
+// node; no arithmetic happens here.
+template <typename L, typename R>
+AddExpr<L, R> operator+(const Expr<L> &lhs, const Expr<R> &rhs) {
+  return AddExpr<L, R>(lhs.Self(), rhs.Self());
+}
+
+template <typename L, typename R>
+MulExpr<L, R> operator*(const Expr<L> &lhs, const Expr<R> &rhs) {
+  return MulExpr<L, R>(lhs.Self(), rhs.Self());
+}
+
+// add and mul mirror add<T> from templated_functions.cpp, but for expressions
+// they return a lazy node instead of a value. add<T> is limited to arithmetic
+// types: unconstrained, add(a, b) on two NumArrays would pick it (T = NumArray
+// is an exact match, while the Expr overload needs a conversion to the base
+// class), copying both arrays and evaluating eagerly.
+template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+T add(T a, T b) {
+  return a + b;
+}
+
+template <typename L, typename R>
+AddExpr<L, R> add(const Expr<L> &lhs, const Expr<R> &rhs) {
+  return lhs + rhs;
+}
+
+template <typename L, typename R>
+MulExpr<L, R> mul(const Expr<L> &lhs, const Expr<R> &rhs) {
+  return lhs * rhs;
+}
+
+template <typename A, typename B, typename C>
+FmaExpr<A, B, C> fma(const Expr<A> &a, const Expr<B> &b, const Expr<C> &c) {
+  return FmaExpr<A, B, C>(a.Self(), b.Self(), c.Self());
+}
+
+// For comparison, the eager way: every operation returns a freshly allocated
+// std::vector, just like add<T> returns its result by value.
+template <typename T>
+std::vector<T> eager_add(const std::vector<T> &a, const std::vector<T> &b) {
+  std::vector<T> out(a.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    out[i] = a[i] + b[i];
+  }
+  return out;
+}
+
+template <typename T>
+std::vector<T> eager_mul(const std::vector<T> &a, const std::vector<T> &b) {
+  std::vector<T> out(a.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    out[i] = a[i] * b[i];
+  }
+  return out;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 10000000;
+  const int reps = 10;
+
+  // add<T> still works as before on scalars.
+  std::cout << "Printing add<int>(3, 5): " << add<int>(3, 5) << std::endl;
+
+  // Build some inputs, both as NumArrays and as plain vectors.
+  NumArray<float> a(n), b(n), c(n), d(n);
+  std::vector<float> va(n), vb(n), vc(n), vd(n);
+  for (size_t i = 0; i < n; i++) {
+    a[i] = va[i] = static_cast<float>(i % 13);
+    b[i] = vb[i] = static_cast<float>(i % 7) * 0.5f;
+    c[i] = vc[i] = static_cast<float>(i % 5);
+    d[i] = vd[i] = 2.0f;
+  }
+
+  // Nothing is computed on this line. expr is just a small tree of nodes
+  // pointing at a, b, c and d; its type spells out the whole computation.
+  auto expr = add(a + b, c * d);
+  static_assert(std::is_same_v<decltype(add(a, b)), AddExpr<NumArray<float>, NumArray<float>>>,
+                "add on arrays must build an expression, not copy and evaluate");
+  NumArray<float> lazy = expr;
+  NumArray<float> fused = fma(c, d, a + b);
+  std::vector<float> eager = eager_add(eager_add(va, vb), eager_mul(vc, vd));
+
+  bool same = true;
+  for (size_t i = 0; i < n; i++) {
+    same = same && lazy[i] == eager[i] && fused[i] == eager[i];
+  }
+  std::cout << "Lazy, fused and eager results match: " << (same ? "yes" : "NO") << "\n";
+
+  // The benchmark. The eager version reads 6 arrays and writes 3 (two
+  // temporaries plus the result); the lazy version reads 4 and writes 1.
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    eager = eager_add(eager_add(va, vb), eager_mul(vc, vd));
+  }
+  double eager_time = seconds_since(start) / reps;
+
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    lazy = a + b + c * d;
+  }
+  double lazy_time = seconds_since(start) / reps;
+
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    fused = fma(c, d, a + b);
+  }
+  double fused_time = seconds_since(start) / reps;
+
+  const double mb = static_cast<double>(n * sizeof(float)) / (1 << 20);
+  std::cout << "a + b + c * d over " << n << " floats, average of " << reps << " runs:\n"
+            << "  eager: " << eager_time * 1000 << " ms, ~" << 9 * mb << " MB of memory traffic, "
+            << "2 temporary arrays\n"
+            << "  lazy:  " << lazy_time * 1000 << " ms, ~" << 5 * mb << " MB of memory traffic, "
+            << "0 temporary arrays\n"
+            << "  fma:   " << fused_time * 1000 << " ms, ~" << 5 * mb << " MB of memory traffic, "
+            << "0 temporary arrays\n"
+            << "  speedup (eager / lazy): " << eager_time / lazy_time << "x" << std::endl;
+
+  // A word of caution: expression nodes hold references to the arrays they
+  // read. `auto e = a + b;` is fine while a and b live; returning e from a
+  // function that owns a and b is a dangling reference, just like
+  // dumb_generator in spring2024/s24_my_ptr.cpp.
+  return 0;
+}
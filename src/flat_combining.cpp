@@ -0,0 +1,348 @@
+/**
+ * @file flat_combining.cpp
+ * @brief Tutorial code for flat combining, where one thread performs the
+ * operations of all the threads waiting for a lock.
+ */
+
+// In mutex.cpp, every thread takes the mutex m to do count += 1. Under
+// contention, that means the cache line holding count (and the one holding
+// m) bounces from core to core, and each transfer costs far more than the
+// increment itself. The same is true for any data structure behind a lock.
+
+// Flat combining (Hendler, Incze, Shavit and Tzafrir, 2010) turns this
+// around. Each thread has its own slot in a "publication list". To perform an
+// operation, a thread writes a pointer to it into its slot and then tries to
+// take the lock. The thread that gets the lock becomes the combiner: it walks
+// all slots and runs every pending operation, one after another, before
+// releasing the lock. All other threads just wait for their slot to be
+// cleared, spinning on their own cache line. The protected data stays in the
+// combiner's cache for the whole batch, and the lock is taken once per batch
+// instead of once per operation.
+
+// combining<T> wraps any T this way. Its apply(f) runs f(value) with
+// exclusive access to the wrapped value, and returns what f returns (or
+// rethrows what f throws), just like
+//   std::scoped_lock lk(m);
+//   return f(value);
+// The benchmark applies it to the counter from mutex.cpp, to the DLL from
+// iterator.cpp and to a std::priority_queue, each compared against the same
+// structure behind a std::mutex, for 1 to 64 threads (pass a different
+// maximum as the second argument). Pass a different number of total
+// operations as the first argument (default 1,000,000). Flat combining pays
+// off when the waiting threads run on other cores; with more threads than
+// cores, a waiter may be descheduled before its operation is combined, and
+// a plain mutex wins.
+
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::exception_ptr.
+#include <exception>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::optional, which holds results until they are returned.
+#include <optional>
+// Includes std::priority_queue.
+#include <queue>
+// Includes std::runtime_error.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes std::invoke_result_t.
+#include <type_traits>
+// Includes the utility header for std::forward and std::move.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+// Includes _mm_pause.
+#include <immintrin.h>
+#endif
+
+// Tells the CPU that we are in a spin loop.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Every thread that uses a combining<T> gets a small slot index. Indices are
+// handed out lowest-first and returned when the thread exits, so the
+// combiner only has to scan as many slots as there are live threads.
+class ThreadSlots {
+ public:
+  static constexpr size_t kMaxThreads = 256;
+
+  static size_t Mine() {
+    thread_local Registration registration;
+    return registration.slot_;
+  }
+
+  // One more than the highest slot index in use.
+  static size_t HighWater() { return high_water.load(std::memory_order_acquire); }
+
+ private:
+  struct Registration {
+    Registration() {
+      std::scoped_lock lk(m);
+      while (slot_ < kMaxThreads && used[slot_]) {
+        slot_++;
+      }
+      if (slot_ == kMaxThreads) {
+        throw std::runtime_error("combining<T> supports at most 256 concurrent threads");
+      }
+      used[slot_] = true;
+      if (slot_ + 1 > high_water.load(std::memory_order_relaxed)) {
+        high_water.store(slot_ + 1, std::memory_order_release);
+      }
+    }
+    ~Registration() {
+      std::scoped_lock lk(m);
+      used[slot_] = false;
+    }
+    size_t slot_{0};
+  };
+
+  static inline std::mutex m;
+  static inline bool used[kMaxThreads];
+  static inline std::atomic<size_t> high_water{0};
+};
+
+template <typename T>
+class combining {
+ public:
+  template <typename... Args>
+  explicit combining(Args &&...args) : value_(std::forward<Args>(args)...) {}
+
+  combining(const combining &) = delete;
+  combining &operator=(const combining &) = delete;
+
+  // Runs f(value) with exclusive access to the value and returns its result.
+  // f runs on whichever thread is combining, so it must not depend on
+  // thread-local state, and it must not call apply on the same object.
+  template <typename F>
+  std::invoke_result_t<F &, T &> apply(F &&f) {
+    using R = std::invoke_result_t<F &, T &>;
+    if constexpr (std::is_void_v<R>) {
+      Run([&](T &value) { f(value); });
+    } else {
+      std::optional<R> result;
+      Run([&](T &value) { result.emplace(f(value)); });
+      return std::move(*result);
+    }
+  }
+
+ private:
+  // A published operation. It lives on the publishing thread's stack, which
+  // is fine because that thread waits until the operation has run.
+  struct Request {
+    void (*invoke_)(void *, T &);
+    void *operation_;
+    std::exception_ptr error_;
+  };
+
+  // One slot per thread, each on its own cache line so that waiting threads
+  // don't disturb each other.
+  struct alignas(64) Slot {
+    std::atomic<Request *> request_{nullptr};
+  };
+
+  template <typename G>
+  void Run(G &&operation) {
+    Request request{[](void *op, T &value) { (*static_cast<std::remove_reference_t<G> *>(op))(value); }, &operation,
+                    nullptr};
+    Slot &slot = slots_[ThreadSlots::Mine()];
+    slot.request_.store(&request, std::memory_order_release);
+
+    int spins = 0;
+    while (slot.request_.load(std::memory_order_acquire) != nullptr) {
+      if (!locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire)) {
+        // We are the combiner. Our own request is in the list, so it is done
+        // when Combine returns.
+        Combine();
+        locked_.store(false, std::memory_order_release);
+        break;
+      }
+      // Spin briefly, then give the combiner our CPU, in case there are
+      // more threads than cores.
+      if (++spins < 64) {
+        cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    if (request.error_) {
+      std::rethrow_exception(request.error_);
+    }
+  }
+
+  // Runs every published request. A couple of passes catch requests that
+  // were published while we were combining, so the lock changes hands less.
+  void Combine() {
+    for (int pass = 0; pass < kPasses; pass++) {
+      const size_t n = ThreadSlots::HighWater();
+      for (size_t i = 0; i < n; i++) {
+        Request *request = slots_[i].request_.load(std::memory_order_acquire);
+        if (request == nullptr) {
+          continue;
+        }
+        try {
+          request->invoke_(request->operation_, value_);
+        } catch (...) {
+          request->error_ = std::current_exception();
+        }
+        slots_[i].request_.store(nullptr, std::memory_order_release);
+      }
+    }
+  }
+
+  static constexpr int kPasses = 2;
+
+  alignas(64) std::atomic<bool> locked_{false};
+  Slot slots_[ThreadSlots::kMaxThreads];
+  alignas(64) T value_;
+};
+
+// The same interface, implemented with a std::mutex, for comparison.
+template <typename T>
+class mutex_guarded {
+ public:
+  template <typename... Args>
+  explicit mutex_guarded(Args &&...args) : value_(std::forward<Args>(args)...) {}
+
+  template <typename F>
+  std::invoke_result_t<F &, T &> apply(F &&f) {
+    std::scoped_lock lk(m_);
+    return f(value_);
+  }
+
+ private:
+  std::mutex m_;
+  T value_;
+};
+
+// The DLL from iterator.cpp, without the iterator.
+struct Node {
+  Node(int val) : next_(nullptr), prev_(nullptr), value_(val) {}
+
+  Node *next_;
+  Node *prev_;
+  int value_;
+};
+
+class DLL {
+ public:
+  DLL() : head_(nullptr), size_(0) {}
+
+  ~DLL() {
+    Node *current = head_;
+    while (current != nullptr) {
+      Node *next = current->next_;
+      delete current;
+      current = next;
+    }
+    head_ = nullptr;
+  }
+
+  void InsertAtHead(int val) {
+    Node *new_node = new Node(val);
+    new_node->next_ = head_;
+
+    if (head_ != nullptr) {
+      head_->prev_ = new_node;
+    }
+
+    head_ = new_node;
+    size_ += 1;
+  }
+
+  Node *head_{nullptr};
+  size_t size_;
+};
+
+// Runs total_ops operations spread over num_threads threads and returns
+// millions of operations per second. op(wrapper, thread, i) performs one.
+template <typename Op>
+double measure(int num_threads, int total_ops, Op op) {
+  const int ops = total_ops / num_threads;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < ops; i++) {
+        op(t, i);
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return static_cast<double>(ops) * num_threads / seconds / 1e6;
+}
+
+template <template <typename> class Wrapper>
+void benchmark(const char *name, int num_threads, int total_ops) {
+  Wrapper<long long> count(0);
+  double count_mops = measure(num_threads, total_ops, [&](int, int) { count.apply([](long long &c) { c += 1; }); });
+
+  Wrapper<DLL> dll;
+  double dll_mops = measure(num_threads, total_ops, [&](int, int i) { dll.apply([i](DLL &d) { d.InsertAtHead(i); }); });
+
+  // Pushes and pops alternate, so the queue stays small.
+  Wrapper<std::priority_queue<int>> queue;
+  double queue_mops = measure(num_threads, total_ops, [&](int t, int i) {
+    if (i % 2 == 0) {
+      queue.apply([=](std::priority_queue<int> &q) { q.push((i * 7919 + t) % 100003); });
+    } else {
+      queue.apply([](std::priority_queue<int> &q) {
+        if (!q.empty()) {
+          q.pop();
+        }
+      });
+    }
+  });
+
+  long long final_count = count.apply([](long long &c) { return c; });
+  size_t final_size = dll.apply([](DLL &d) { return d.size_; });
+  std::cout << "  " << name << "counter " << count_mops << ", DLL " << dll_mops << ", priority queue " << queue_mops
+            << " M ops/s" << (final_count == static_cast<long long>(final_size) ? "" : " (count mismatch!)") << "\n";
+}
+
+int main(int argc, char **argv) {
+  const int total_ops = argc > 1 ? std::stoi(argv[1]) : 1000000;
+  const int max_threads = argc > 2 ? std::stoi(argv[2]) : 64;
+
+  // mutex.cpp, with combining instead of a mutex: the increment is the
+  // operation, and whichever thread combines runs it for both.
+  combining<int> count(0);
+  std::thread t1([&] { count.apply([](int &c) { c += 1; }); });
+  std::thread t2([&] { count.apply([](int &c) { c += 1; }); });
+  t1.join();
+  t2.join();
+  std::cout << "Printing count: " << count.apply([](int &c) { return c; }) << std::endl;
+
+  // Exceptions thrown by an operation come back to the thread that asked
+  // for it, even if another thread ran it.
+  try {
+    count.apply([](int &) -> int { throw std::runtime_error("operation failed"); });
+  } catch (const std::runtime_error &e) {
+    std::cout << "Caught: " << e.what() << std::endl;
+  }
+
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n";
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    std::cout << threads << " threads:\n";
+    benchmark<mutex_guarded>("std::mutex: ", threads, total_ops);
+    benchmark<combining>("combining:  ", threads, total_ops);
+  }
+  return 0;
+}
@@ -0,0 +1,361 @@
+/**
+ * @file futex_sync.cpp
+ * @brief Tutorial code for a latch, a barrier and a one-shot event built
+ * directly on atomics and futexes.
+ */
+
+// condition_variable.cpp uses a mutex, a condition variable and the
+// predicate count == 2 so that one thread can wait for two increments. That
+// pattern has a name: a latch. A latch starts at a count, threads count it
+// down, and waiters wake up when it reaches zero. C++20 added std::latch and
+// std::barrier; this file shows how they work underneath, in C++17.
+
+// The idea is that the count itself is the only shared state. Counting down
+// is one atomic subtraction; waiting on a latch that already reached zero is
+// one atomic load. No mutex is involved. Only when a waiter really has to
+// sleep does it make a futex system call (see adaptive_mutex.cpp), which
+// sleeps only if the count still holds the value the waiter saw, so a
+// wakeup can never be missed. And the thread that counts down to zero only
+// makes the wake system call if someone is actually asleep.
+
+// Three primitives:
+//   - Latch: a single-use countdown, like std::latch.
+//   - Barrier: a reusable meeting point for a fixed number of threads, like
+//     std::barrier's arrive_and_wait().
+//   - Event: a one-shot flag that waiters wait for; a Latch with count 1.
+// Waiters spin for a short while before sleeping, because the signal often
+// arrives within a microsecond, much sooner than a sleep and wake would.
+
+// The benchmark runs the condition_variable.cpp case, two signalers and one
+// waiter, for 200,000 rounds with a fresh latch per round (pass a different
+// number of rounds as the first argument), and a three-thread barrier for
+// the same number of rounds, each against a mutex and condition variable
+// implementation.
+
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::condition_variable, for the comparison.
+#include <condition_variable>
+// Includes the header for uint32_t.
+#include <cstdint>
+// Includes std::deque, which holds one latch per round.
+#include <deque>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+// Includes _mm_pause.
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+// Includes FUTEX_WAIT_PRIVATE and FUTEX_WAKE_PRIVATE.
+#include <linux/futex.h>
+// Includes INT_MAX.
+#include <climits>
+// Includes SYS_futex.
+#include <sys/syscall.h>
+// Includes syscall().
+#include <unistd.h>
+#endif
+
+// Tells the CPU that we are in a spin loop.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Sleeps while *word == expected. Elsewhere than Linux, we fall back to
+// yielding the CPU, which is correct but not as efficient.
+inline void futex_wait(std::atomic<uint32_t> *word, uint32_t expected) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+  if (word->load(std::memory_order_relaxed) == expected) {
+    std::this_thread::yield();
+  }
+#endif
+}
+
+inline void futex_wake_all(std::atomic<uint32_t> *word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+// A word that threads wait on until it changes, shared by all three
+// primitives. Its low 31 bits hold the value; the high bit, kSleeping, is
+// set by a waiter before it calls futex_wait, so that a waker can skip the
+// system call when nobody sleeps. The flag lives in the same word as the
+// value on purpose: the waker learns whether to wake from the result of
+// the very operation that changes the value, and touches no other member
+// afterwards. Once a latch reaches zero or a barrier phase advances, a
+// woken thread may return and destroy the object at once, so reading a
+// separate sleeper count after the change would read freed memory.
+// futex_wake_all only uses the word's address, which is safe even then.
+class WaitWord {
+ public:
+  static constexpr uint32_t kSleeping = 1u << 31;
+  static constexpr uint32_t kValueMask = kSleeping - 1;
+
+  explicit WaitWord(uint32_t value) : word_(value) {}
+
+  uint32_t Load() const { return word_.load(std::memory_order_acquire) & kValueMask; }
+
+  // Returns once the value no longer equals `value`.
+  void WaitWhileEquals(uint32_t value) {
+    for (int i = 0; i < kSpins; i++) {
+      if (Load() != value) {
+        return;
+      }
+      cpu_relax();
+    }
+    uint32_t current = word_.load(std::memory_order_acquire);
+    while ((current & kValueMask) == value) {
+      // Sets the flag, unless the value changed in the meantime; futex_wait
+      // then sleeps only if neither the value nor the flag changed since.
+      if ((current & kSleeping) != 0 || word_.compare_exchange_weak(current, current | kSleeping)) {
+        futex_wait(&word_, value | kSleeping);
+        current = word_.load(std::memory_order_acquire);
+      }
+    }
+  }
+
+  // Subtracts n, and wakes the sleepers if the value reached zero.
+  void CountDown(uint32_t n) {
+    uint32_t old = word_.fetch_sub(n, std::memory_order_acq_rel);
+    if ((old & kValueMask) == n && (old & kSleeping) != 0) {
+      futex_wake_all(&word_);
+    }
+  }
+
+  // Adds one to the value, clears the flag, and wakes the sleepers.
+  void Advance() {
+    uint32_t old = word_.load(std::memory_order_relaxed);
+    while (!word_.compare_exchange_weak(old, (old + 1) & kValueMask, std::memory_order_acq_rel)) {
+    }
+    if ((old & kSleeping) != 0) {
+      futex_wake_all(&word_);
+    }
+  }
+
+ private:
+  static constexpr int kSpins = 128;
+
+  std::atomic<uint32_t> word_;
+};
+
+// The count must fit in the 31 bits of a WaitWord's value.
+class Latch {
+ public:
+  explicit Latch(uint32_t count) : count_(count) {}
+  Latch(const Latch &) = delete;
+  Latch &operator=(const Latch &) = delete;
+
+  void count_down(uint32_t n = 1) { count_.CountDown(n); }
+
+  bool try_wait() const { return count_.Load() == 0; }
+
+  void wait() {
+    uint32_t count;
+    while ((count = count_.Load()) != 0) {
+      count_.WaitWhileEquals(count);
+    }
+  }
+
+ private:
+  WaitWord count_;
+};
+
+class Event {
+ public:
+  Event() = default;
+  Event(const Event &) = delete;
+  Event &operator=(const Event &) = delete;
+
+  void set() { latch_.count_down(); }
+  bool is_set() const { return latch_.try_wait(); }
+  void wait() { latch_.wait(); }
+
+ private:
+  Latch latch_{1};
+};
+
+// The barrier counts arrivals in arrived_ and numbers its rounds in phase_.
+// Everyone but the last thread to arrive waits for phase_ to change; the
+// last one resets the count for the next round and then advances the phase,
+// so no thread can arrive for the next round before the count is reset.
+class Barrier {
+ public:
+  explicit Barrier(uint32_t count) : count_(count) {}
+  Barrier(const Barrier &) = delete;
+  Barrier &operator=(const Barrier &) = delete;
+
+  void arrive_and_wait() {
+    uint32_t phase = phase_.Load();
+    if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+      arrived_.store(0, std::memory_order_relaxed);
+      phase_.Advance();
+    } else {
+      phase_.WaitWhileEquals(phase);
+    }
+  }
+
+ private:
+  const uint32_t count_;
+  std::atomic<uint32_t> arrived_{0};
+  WaitWord phase_{0};
+};
+
+// The condition_variable.cpp way, for comparison.
+class CvLatch {
+ public:
+  explicit CvLatch(uint32_t count) : count_(count) {}
+
+  void count_down() {
+    std::scoped_lock slk(m_);
+    count_ -= 1;
+    if (count_ == 0) {
+      cv_.notify_all();
+    }
+  }
+
+  void wait() {
+    std::unique_lock lk(m_);
+    cv_.wait(lk, [this] { return count_ == 0; });
+  }
+
+ private:
+  std::mutex m_;
+  std::condition_variable cv_;
+  uint32_t count_;
+};
+
+class CvBarrier {
+ public:
+  explicit CvBarrier(uint32_t count) : count_(count) {}
+
+  void arrive_and_wait() {
+    std::unique_lock lk(m_);
+    uint32_t phase = phase_;
+    if (++arrived_ == count_) {
+      arrived_ = 0;
+      phase_ += 1;
+      cv_.notify_all();
+    } else {
+      cv_.wait(lk, [&] { return phase_ != phase; });
+    }
+  }
+
+ private:
+  std::mutex m_;
+  std::condition_variable cv_;
+  const uint32_t count_;
+  uint32_t arrived_{0};
+  uint32_t phase_{0};
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Two signalers count down the latch of each round, and the waiter waits
+// for every round in order. Returns nanoseconds per round.
+template <typename L>
+double latch_rounds(int rounds) {
+  std::deque<L> latches;
+  for (int r = 0; r < rounds; r++) {
+    latches.emplace_back(2);
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto signaler = [&] {
+    for (L &latch : latches) {
+      latch.count_down();
+    }
+  };
+  std::thread t1(signaler);
+  std::thread t2(signaler);
+  std::thread t3([&] {
+    for (L &latch : latches) {
+      latch.wait();
+    }
+  });
+  t1.join();
+  t2.join();
+  t3.join();
+  return seconds_since(start) * 1e9 / rounds;
+}
+
+// Three threads meet at the barrier every round. Returns nanoseconds per
+// round.
+template <typename B>
+double barrier_rounds(int rounds) {
+  B barrier(3);
+  auto start = std::chrono::steady_clock::now();
+  auto worker = [&] {
+    for (int r = 0; r < rounds; r++) {
+      barrier.arrive_and_wait();
+    }
+  };
+  std::thread t1(worker);
+  std::thread t2(worker);
+  std::thread t3(worker);
+  t1.join();
+  t2.join();
+  t3.join();
+  return seconds_since(start) * 1e9 / rounds;
+}
+
+int main(int argc, char **argv) {
+  const int rounds = argc > 1 ? std::stoi(argv[1]) : 200000;
+
+  // condition_variable.cpp, with a latch: no mutex, no predicate.
+  int count = 0;
+  std::atomic<int> atomic_count{0};
+  Latch latch(2);
+  auto add_count_and_notify = [&] {
+    atomic_count.fetch_add(1);
+    latch.count_down();
+  };
+  std::thread t3([&] {
+    latch.wait();
+    count = atomic_count.load();
+    std::cout << "Printing count: " << count << std::endl;
+  });
+  std::thread t1(add_count_and_notify);
+  std::thread t2(add_count_and_notify);
+  t1.join();
+  t2.join();
+  t3.join();
+
+  // A one-shot event.
+  Event ready;
+  std::thread waiter([&] {
+    ready.wait();
+    std::cout << "Event received" << std::endl;
+  });
+  ready.set();
+  waiter.join();
+
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n"
+            << rounds << " rounds of two signalers and one waiter:\n"
+            << "  mutex + condition variable: " << latch_rounds<CvLatch>(rounds) << " ns per round\n"
+            << "  futex latch:                " << latch_rounds<Latch>(rounds) << " ns per round\n"
+            << rounds << " rounds of a three-thread barrier:\n"
+            << "  mutex + condition variable: " << barrier_rounds<CvBarrier>(rounds) << " ns per round\n"
+            << "  futex barrier:              " << barrier_rounds<Barrier>(rounds) << " ns per round" << std::endl;
+  return 0;
+}
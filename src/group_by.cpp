@@ -0,0 +1,428 @@
+/**
+ * @file group_by.cpp
+ * @brief Tutorial code for hash aggregation: computing sum, count, min and
+ * max per key over many (key, value) rows, the way a database does it.
+ */
+
+// unordered_maps.cpp updates its map one key at a time: map["bacon"] = 5;
+// map["spam"] = 15;. Aggregating a big table of (string, int) rows by key
+// the same way, with map[key].sum += value for every row, works, but leaves
+// most of the machine idle: each row allocates a std::string for the lookup,
+// and once the map outgrows the caches, each row waits for a cache miss
+// before the next one can start. Database engines speed this up in three
+// ways:
+//   - Batches. Rows are processed 256 at a time, one step at a time: first
+//     hash all 256 keys, then prefetch all 256 slots, then update all 256
+//     groups. Each loop is short and simple, and the cache misses of
+//     different rows overlap (see batched_lookup.cpp).
+//   - Partitioned pre-aggregation. Each thread aggregates its share of the
+//     rows into its own tables, with no locks. The tables are partitioned by
+//     the top bits of the hash into 64 small tables instead of one big one.
+//   - Merge. Afterwards, each partition is merged separately: partition 5 of
+//     every thread goes into the final table for partition 5. Different
+//     partitions never share a key, so threads can merge different
+//     partitions in parallel, again without locks.
+// In fixed memory mode, each of a thread's partition tables holds at most a
+// fixed number of groups. When one fills up, the thread merges it straight
+// into the final table for its partition, under that partition's mutex, and
+// the table starts empty. So besides the result itself, each thread uses a
+// fixed partitions * 2 * max_local_groups_ slots of 64 bytes (4 MB for the
+// 64 partitions and 512 groups of the benchmark), however many groups there
+// are, and nothing is written to disk. Few groups are then aggregated almost
+// entirely in the thread's own tables; many groups cost an extra merge,
+// with a lock, per flushed group.
+
+// GroupTable is an open addressing hash table of groups. The pre-aggregation
+// tables point at the keys of the input rows; the final tables copy keys
+// into an Arena, a list of big blocks, so the result outlives the input.
+
+// The benchmark aggregates 10,000,000 rows (pass a different number as the
+// first argument) with 10 to 10,000,000 distinct keys (pass a different
+// maximum as the second argument, e.g. 100000000 on a machine with enough
+// memory), with std::unordered_map and with group_by in its variants.
+
+// Includes std::max and std::min.
+#include <algorithm>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for int64_t and uint64_t.
+#include <cstdint>
+// Includes std::memcpy.
+#include <cstring>
+// Includes std::hash.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::numeric_limits.
+#include <limits>
+// Includes std::unique_ptr.
+#include <memory>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::mt19937_64.
+#include <random>
+// Includes std::invalid_argument.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::string_view.
+#include <string_view>
+// Includes the thread library header.
+#include <thread>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes the header for std::vector.
+#include <vector>
+
+// Asks the CPU to start loading the cache line holding p, without waiting
+// for it.
+inline void prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(p, 1);
+#else
+  (void)p;
+#endif
+}
+
+struct Aggregates {
+  int64_t sum_ = 0;
+  int64_t count_ = 0;
+  int64_t min_ = std::numeric_limits<int64_t>::max();
+  int64_t max_ = std::numeric_limits<int64_t>::min();
+
+  void Add(int64_t value) {
+    sum_ += value;
+    count_++;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void Merge(const Aggregates &other) {
+    sum_ += other.sum_;
+    count_ += other.count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+};
+
+// Copies strings into large blocks, which never move, so the copies stay
+// valid until the Arena is destroyed.
+class Arena {
+ public:
+  std::string_view Copy(std::string_view s) {
+    if (s.size() > left_) {
+      size_t size = std::max(kBlockSize, s.size());
+      blocks_.emplace_back(new char[size]);
+      next_ = blocks_.back().get();
+      left_ = size;
+    }
+    std::memcpy(next_, s.data(), s.size());
+    std::string_view copy(next_, s.size());
+    next_ += s.size();
+    left_ -= s.size();
+    return copy;
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char *next_ = nullptr;
+  size_t left_ = 0;
+};
+
+// An open addressing hash table from keys to Aggregates, with linear
+// probing. With max_groups == 0 it grows as needed; otherwise it has room
+// for max_groups groups and the caller empties it when full() says so.
+class GroupTable {
+ public:
+  GroupTable(bool own_keys, size_t max_groups) : own_keys_(own_keys), max_groups_(max_groups) {
+    size_t capacity = 16;
+    while (capacity < 2 * max_groups) {
+      capacity *= 2;
+    }
+    slots_.resize(capacity);
+  }
+
+  void Prefetch(uint64_t hash) const { prefetch(&slots_[hash & (slots_.size() - 1)]); }
+
+  Aggregates &FindOrInsert(std::string_view key, uint64_t hash) {
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Slot &slot = slots_[i];
+      if (!slot.used_) {
+        if (max_groups_ == 0 && (size_ + 1) * 2 > slots_.size()) {
+          Grow();
+          return FindOrInsert(key, hash);
+        }
+        slot.used_ = true;
+        slot.hash_ = hash;
+        slot.key_ = own_keys_ ? arena_.Copy(key) : key;
+        size_++;
+        return slot.aggregates_;
+      }
+      if (slot.hash_ == hash && slot.key_ == key) {
+        return slot.aggregates_;
+      }
+    }
+  }
+
+  bool full() const { return max_groups_ != 0 && size_ >= max_groups_; }
+  size_t size() const { return size_; }
+
+  // Calls f(key, hash, aggregates) for every group.
+  template <typename F>
+  void for_each(F &&f) const {
+    for (const Slot &slot : slots_) {
+      if (slot.used_) {
+        f(slot.key_, slot.hash_, slot.aggregates_);
+      }
+    }
+  }
+
+  void clear() {
+    std::fill(slots_.begin(), slots_.end(), Slot());
+    size_ = 0;
+  }
+
+ private:
+  // 64 bytes, one cache line.
+  struct Slot {
+    uint64_t hash_ = 0;
+    std::string_view key_;
+    Aggregates aggregates_;
+    bool used_ = false;
+  };
+
+  void Grow() {
+    std::vector<Slot> old(slots_.size() * 2);
+    old.swap(slots_);
+    const size_t mask = slots_.size() - 1;
+    for (const Slot &slot : old) {
+      if (slot.used_) {
+        size_t i = slot.hash_ & mask;
+        while (slots_[i].used_) {
+          i = (i + 1) & mask;
+        }
+        slots_[i] = slot;
+      }
+    }
+  }
+
+  bool own_keys_;
+  size_t max_groups_;
+  std::vector<Slot> slots_;
+  size_t size_ = 0;
+  Arena arena_;
+};
+
+struct GroupByOptions {
+  int threads_ = 1;
+  // 2^partition_bits_ partitions.
+  int partition_bits_ = 6;
+  // Groups per partition table during pre-aggregation, or 0 for no limit.
+  size_t max_local_groups_ = 0;
+};
+
+// The groups, one table per partition.
+class GroupByResult {
+ public:
+  size_t size() const {
+    size_t size = 0;
+    for (const GroupTable &table : partitions_) {
+      size += table.size();
+    }
+    return size;
+  }
+
+  // Calls f(key, aggregates) for every group.
+  template <typename F>
+  void for_each(F &&f) const {
+    for (const GroupTable &table : partitions_) {
+      table.for_each([&f](std::string_view key, uint64_t, const Aggregates &aggregates) { f(key, aggregates); });
+    }
+  }
+
+ private:
+  friend GroupByResult group_by(const std::vector<std::string_view> &keys, const std::vector<int64_t> &values,
+                                const GroupByOptions &options);
+
+  std::vector<GroupTable> partitions_;
+};
+
+GroupByResult group_by(const std::vector<std::string_view> &keys, const std::vector<int64_t> &values,
+                       const GroupByOptions &options) {
+  if (keys.size() != values.size()) {
+    throw std::invalid_argument("group_by needs one value per key");
+  }
+  if (options.threads_ < 1 || options.partition_bits_ < 1 || options.partition_bits_ > 16) {
+    throw std::invalid_argument("group_by needs at least one thread and 1 to 16 partition bits");
+  }
+  const size_t partitions = size_t{1} << options.partition_bits_;
+  const int partition_shift = 64 - options.partition_bits_;
+  const size_t threads = static_cast<size_t>(options.threads_);
+
+  struct ThreadState {
+    std::vector<GroupTable> tables_;
+  };
+  std::vector<ThreadState> states(threads);
+
+  // The final tables. In fixed memory mode, threads flush full tables into
+  // them during phase 1, so each partition has a mutex.
+  GroupByResult result;
+  for (size_t p = 0; p < partitions; p++) {
+    result.partitions_.emplace_back(true, 0);
+  }
+  std::vector<std::mutex> partition_mutexes(partitions);
+  auto merge_into_result = [&](size_t p, const GroupTable &table) {
+    GroupTable &target = result.partitions_[p];
+    table.for_each([&](std::string_view key, uint64_t hash, const Aggregates &aggregates) {
+      target.FindOrInsert(key, hash).Merge(aggregates);
+    });
+  };
+
+  // Phase 1: each thread pre-aggregates a contiguous share of the rows.
+  auto pre_aggregate = [&](size_t t) {
+    ThreadState &state = states[t];
+    for (size_t p = 0; p < partitions; p++) {
+      state.tables_.emplace_back(false, options.max_local_groups_);
+    }
+    const size_t begin = keys.size() * t / threads;
+    const size_t end = keys.size() * (t + 1) / threads;
+    constexpr size_t kBatch = 256;
+    uint64_t hashes[kBatch];
+    for (size_t base = begin; base < end; base += kBatch) {
+      const size_t n = std::min(kBatch, end - base);
+      for (size_t i = 0; i < n; i++) {
+        hashes[i] = std::hash<std::string_view>{}(keys[base + i]);
+      }
+      for (size_t i = 0; i < n; i++) {
+        state.tables_[hashes[i] >> partition_shift].Prefetch(hashes[i]);
+      }
+      for (size_t i = 0; i < n; i++) {
+        size_t p = hashes[i] >> partition_shift;
+        GroupTable &table = state.tables_[p];
+        table.FindOrInsert(keys[base + i], hashes[i]).Add(values[base + i]);
+        if (table.full()) {
+          std::scoped_lock lk(partition_mutexes[p]);
+          merge_into_result(p, table);
+          table.clear();
+        }
+      }
+    }
+  };
+
+  // Phase 2: each thread merges what is left in every thread's tables for
+  // every threads-th partition. Phase 1 is over, so no locks are needed.
+  auto merge = [&](size_t t) {
+    for (size_t p = t; p < partitions; p += threads) {
+      for (const ThreadState &state : states) {
+        merge_into_result(p, state.tables_[p]);
+      }
+    }
+  };
+
+  // The calling thread does the work of thread 0 in both phases.
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; t++) {
+    workers.emplace_back(pre_aggregate, t);
+  }
+  pre_aggregate(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  for (size_t t = 1; t < threads; t++) {
+    workers.emplace_back(merge, t);
+  }
+  merge(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  return result;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Combines all groups into one number, to check that two ways of
+// aggregating agree. Adding makes the order of the groups irrelevant.
+uint64_t checksum(std::string_view key, const Aggregates &aggregates) {
+  uint64_t h = std::hash<std::string_view>{}(key);
+  return h * static_cast<uint64_t>(aggregates.sum_) + static_cast<uint64_t>(aggregates.count_) * 3 +
+         static_cast<uint64_t>(aggregates.min_) * 5 + static_cast<uint64_t>(aggregates.max_) * 7;
+}
+
+int main(int argc, char **argv) {
+  const size_t rows = argc > 1 ? std::stoull(argv[1]) : 10000000;
+  const size_t max_groups = argc > 2 ? std::stoull(argv[2]) : 10000000;
+
+  // The updates from unordered_maps.cpp, as rows to aggregate.
+  std::vector<std::string_view> demo_keys = {"bacon", "spam", "eggs", "spam", "bacon", "spam"};
+  std::vector<int64_t> demo_values = {5, 15, 2, 1, 3, 4};
+  GroupByResult demo = group_by(demo_keys, demo_values, GroupByOptions());
+  demo.for_each([](std::string_view key, const Aggregates &aggregates) {
+    std::cout << key << ": sum " << aggregates.sum_ << ", count " << aggregates.count_ << ", min " << aggregates.min_
+              << ", max " << aggregates.max_ << "\n";
+  });
+
+  const int hardware_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  std::cout << rows << " rows, " << hardware_threads << " hardware threads; million rows per second:\n";
+  std::mt19937_64 rng(42);
+  for (size_t groups = 10; groups <= max_groups; groups *= 10) {
+    // The distinct keys, stored back to back in one string, and the rows.
+    std::string pool;
+    std::vector<size_t> offsets;
+    for (size_t g = 0; g < groups; g++) {
+      offsets.push_back(pool.size());
+      pool += "group-" + std::to_string(g);
+    }
+    offsets.push_back(pool.size());
+    std::vector<std::string_view> keys(rows);
+    std::vector<int64_t> values(rows);
+    for (size_t i = 0; i < rows; i++) {
+      size_t g = rng() % groups;
+      keys[i] = std::string_view(pool.data() + offsets[g], offsets[g + 1] - offsets[g]);
+      values[i] = static_cast<int64_t>(rng() % 1000);
+    }
+
+    uint64_t expected = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+      std::unordered_map<std::string, Aggregates> map;
+      for (size_t i = 0; i < rows; i++) {
+        map[std::string(keys[i])].Add(values[i]);
+      }
+      double seconds = seconds_since(start);
+      for (const auto &[key, aggregates] : map) {
+        expected += checksum(key, aggregates);
+      }
+      std::cout << "  " << groups << " groups: std::unordered_map " << rows / seconds / 1e6;
+    }
+
+    bool all_match = true;
+    auto run = [&](const char *name, const GroupByOptions &options) {
+      auto start = std::chrono::steady_clock::now();
+      GroupByResult result = group_by(keys, values, options);
+      double seconds = seconds_since(start);
+      uint64_t sum = 0;
+      result.for_each([&](std::string_view key, const Aggregates &aggregates) { sum += checksum(key, aggregates); });
+      all_match = all_match && sum == expected;
+      std::cout << ", " << name << " " << rows / seconds / 1e6;
+    };
+    GroupByOptions options;
+    run("group_by", options);
+    options.max_local_groups_ = 512;
+    run("fixed memory", options);
+    if (hardware_threads > 1) {
+      options.max_local_groups_ = 0;
+      options.threads_ = hardware_threads;
+      run("all threads", options);
+      options.max_local_groups_ = 512;
+      run("all threads, fixed memory", options);
+    }
+    std::cout << (all_match ? "" : " (RESULTS DIFFER)") << std::endl;
+  }
+  return 0;
+}
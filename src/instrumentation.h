@@ -0,0 +1,338 @@
+/**
+ * @file instrumentation.h
+ * @brief Header-only instrumentation for counting copies, moves and heap
+ * allocations, so we can check that a piece of code is copy- and
+ * allocation-free.
+ */
+
+// move_constructors.cpp prints a line from its move constructor, and
+// move_semantics.cpp explains in comments that move_add_three_and_print steals
+// a buffer while add_three_and_print does not. Printing and comments don't
+// scale: what we really want is to count these events and check the counts.
+
+// This header can be included into any of the bootcamp executables. It gives
+// you four tools:
+//   1. CountingAllocator<T>, an allocator for STL containers that counts the
+//      allocations and bytes requested through it.
+//   2. Tracked<T>, a wrapper around a value of type T that counts every copy
+//      and move made of it.
+//   3. INSTRUMENT_SCOPE(name), an RAII scope that snapshots the counters on
+//      entry and records the difference on exit, attributed to the call site.
+//   4. A report of every call site, printed to stderr when the program exits.
+// Optionally, if you #define INSTRUMENT_GLOBAL_NEW before including this header
+// in exactly one .cpp file of a program, every call to the global operator new
+// is counted too (this catches allocations made by std::string and friends).
+
+#pragma once
+
+// Includes std::atomic, so the counters can be updated from several threads.
+#include <atomic>
+// Includes std::size_t and std::max_align_t.
+#include <cstddef>
+// Includes std::malloc, std::aligned_alloc and std::free for the optional
+// global operator new.
+#include <cstdlib>
+// Includes std::cerr, where the report is printed.
+#include <iostream>
+// Includes std::map, which keeps the report sorted by call site.
+#include <map>
+// Includes std::mutex, which protects the report.
+#include <mutex>
+// Includes std::bad_alloc and std::align_val_t.
+#include <new>
+// Includes the C++ string library.
+#include <string>
+// Includes the utility header for std::move and std::forward.
+#include <utility>
+
+namespace instrumentation {
+
+// A plain snapshot of all the counters. Subtracting two snapshots gives the
+// events that happened in between.
+struct Counts {
+  size_t copies_{0};
+  size_t moves_{0};
+  size_t allocations_{0};
+  size_t deallocations_{0};
+  size_t bytes_allocated_{0};
+
+  Counts operator-(const Counts &other) const {
+    return {copies_ - other.copies_, moves_ - other.moves_, allocations_ - other.allocations_,
+            deallocations_ - other.deallocations_, bytes_allocated_ - other.bytes_allocated_};
+  }
+
+  Counts &operator+=(const Counts &other) {
+    copies_ += other.copies_;
+    moves_ += other.moves_;
+    allocations_ += other.allocations_;
+    deallocations_ += other.deallocations_;
+    bytes_allocated_ += other.bytes_allocated_;
+    return *this;
+  }
+
+  // True when nothing was copied or allocated. Moves are allowed; they are
+  // what we want hot paths to do.
+  bool CopyAndAllocationFree() const { return copies_ == 0 && allocations_ == 0; }
+};
+
+// The process-wide counters, for the total at the end of the report. They
+// are relaxed atomics: we only need each increment to be counted exactly
+// once, not to be ordered with other memory operations, so the cost is a
+// single atomic add.
+struct GlobalCounters {
+  std::atomic<size_t> copies_{0};
+  std::atomic<size_t> moves_{0};
+  std::atomic<size_t> allocations_{0};
+  std::atomic<size_t> deallocations_{0};
+  std::atomic<size_t> bytes_allocated_{0};
+
+  Counts Snapshot() const {
+    return {copies_.load(std::memory_order_relaxed), moves_.load(std::memory_order_relaxed),
+            allocations_.load(std::memory_order_relaxed), deallocations_.load(std::memory_order_relaxed),
+            bytes_allocated_.load(std::memory_order_relaxed)};
+  }
+};
+
+// C++17 inline variables give us exactly one instance of the counters per
+// program, no matter how many files include this header.
+inline GlobalCounters counters;
+
+// The calling thread's counters, which is what a Scope measures: with
+// process-wide counters, a scope would also count whatever other threads
+// copied or allocated while it was open. Only the owning thread touches
+// them, so they are plain integers.
+inline thread_local Counts thread_counts;
+
+inline void RecordCopy() {
+  thread_counts.copies_ += 1;
+  counters.copies_.fetch_add(1, std::memory_order_relaxed);
+}
+inline void RecordMove() {
+  thread_counts.moves_ += 1;
+  counters.moves_.fetch_add(1, std::memory_order_relaxed);
+}
+inline void RecordAllocation(size_t bytes) {
+  thread_counts.allocations_ += 1;
+  thread_counts.bytes_allocated_ += bytes;
+  counters.allocations_.fetch_add(1, std::memory_order_relaxed);
+  counters.bytes_allocated_.fetch_add(bytes, std::memory_order_relaxed);
+}
+inline void RecordDeallocation() {
+  thread_counts.deallocations_ += 1;
+  counters.deallocations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+// The per-call-site report. Each INSTRUMENT_SCOPE adds its deltas here when
+// it exits, and the destructor prints everything when the program ends,
+// followed by the process-wide total of all threads, inside scopes or not.
+class Report {
+ public:
+  ~Report() { Print(std::cerr); }
+
+  void Add(const std::string &site, const Counts &delta) {
+    std::scoped_lock lk(m_);
+    Entry &entry = entries_[site];
+    entry.calls_ += 1;
+    entry.total_ += delta;
+  }
+
+  void Print(std::ostream &out) {
+    std::scoped_lock lk(m_);
+    if (entries_.empty()) {
+      return;
+    }
+    out << "==== instrumentation report ====\n";
+    for (const auto &[site, entry] : entries_) {
+      out << site << ": calls=" << entry.calls_;
+      PrintCounts(out, entry.total_);
+    }
+    out << "process total:";
+    PrintCounts(out, counters.Snapshot());
+  }
+
+ private:
+  struct Entry {
+    size_t calls_{0};
+    Counts total_;
+  };
+
+  static void PrintCounts(std::ostream &out, const Counts &counts) {
+    out << " copies=" << counts.copies_ << " moves=" << counts.moves_ << " allocations=" << counts.allocations_
+        << " deallocations=" << counts.deallocations_ << " bytes=" << counts.bytes_allocated_ << "\n";
+  }
+
+  std::mutex m_;
+  std::map<std::string, Entry> entries_;
+};
+
+inline Report report;
+
+// The RAII scope. Construction takes a snapshot of the calling thread's
+// counters, destruction records the difference in the report, so a scope
+// must end on the thread that opened it. Delta() lets code check the counts
+// so far, e.g. to assert that a hot path did not allocate.
+class Scope {
+ public:
+  explicit Scope(std::string site) : site_(std::move(site)), start_(thread_counts) {}
+  ~Scope() { report.Add(site_, Delta()); }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+  Counts Delta() const { return thread_counts - start_; }
+
+ private:
+  std::string site_;
+  Counts start_;
+};
+
+// An STL-compatible allocator that counts through to the global counters.
+// Use it as the second template argument of a container, e.g.
+// std::vector<int, CountingAllocator<int>>.
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U> &) {}
+
+  // We go straight to malloc rather than through operator new, so that the
+  // allocation isn't counted twice when INSTRUMENT_GLOBAL_NEW is also on.
+  T *allocate(size_t n) {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "CountingAllocator does not support over-aligned types");
+    RecordAllocation(n * sizeof(T));
+    if (void *p = std::malloc(n * sizeof(T))) {
+      return static_cast<T *>(p);
+    }
+    throw std::bad_alloc();
+  }
+
+  void deallocate(T *p, size_t) {
+    RecordDeallocation();
+    std::free(p);
+  }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U> &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U> &) const {
+    return false;
+  }
+};
+
+// Tracked<T> wraps a value and counts every copy and move of it. Because it
+// forwards its constructor arguments, it can be dropped in for a member, e.g.
+// Tracked<std::vector<std::string>> nicknames_ in Person.
+template <typename T>
+class Tracked {
+ public:
+  template <typename... Args>
+  Tracked(Args &&...args) : value_(std::forward<Args>(args)...) {}
+
+  Tracked(const Tracked &other) : value_(other.value_) { RecordCopy(); }
+  Tracked(Tracked &other) : value_(other.value_) { RecordCopy(); }
+  Tracked(Tracked &&other) : value_(std::move(other.value_)) { RecordMove(); }
+
+  Tracked &operator=(const Tracked &other) {
+    value_ = other.value_;
+    RecordCopy();
+    return *this;
+  }
+  Tracked &operator=(Tracked &&other) {
+    value_ = std::move(other.value_);
+    RecordMove();
+    return *this;
+  }
+
+  T &Get() { return value_; }
+  const T &Get() const { return value_; }
+  T *operator->() { return &value_; }
+  const T *operator->() const { return &value_; }
+
+ private:
+  T value_;
+};
+
+}  // namespace instrumentation
+
+// These macros turn __FILE__ and __LINE__ into a "file:line" string, so
+// each INSTRUMENT_SCOPE is reported under its own call site.
+#define INSTRUMENT_STRINGIFY_IMPL(x) #x
+#define INSTRUMENT_STRINGIFY(x) INSTRUMENT_STRINGIFY_IMPL(x)
+#define INSTRUMENT_CONCAT_IMPL(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_IMPL(a, b)
+
+// Expands to a "name (file:line)" string for the current call site.
+#define INSTRUMENT_SITE(name) (std::string(name) + " (" __FILE__ ":" INSTRUMENT_STRINGIFY(__LINE__) ")")
+
+// Declares an instrumentation scope named after the current call site that
+// lasts until the end of the enclosing block. If you need to look at the
+// scope's Delta(), declare it yourself instead:
+//   instrumentation::Scope scope(INSTRUMENT_SITE("my hot path"));
+#define INSTRUMENT_SCOPE(name) \
+  ::instrumentation::Scope INSTRUMENT_CONCAT(instrument_scope_, __LINE__)(INSTRUMENT_SITE(name))
+
+// Optional: count every global heap allocation. Replacement operator new and
+// delete may only be defined once per program, hence the opt-in macro. The
+// array and nothrow forms call these by default, and the std::align_val_t
+// forms cover over-aligned types (alignas greater than 16).
+// They are kept out of line: once GCC inlines them, it sees memory from
+// malloc reach operator delete (or memory from operator new reach free) and
+// warns with -Wmismatched-new-delete.
+#ifdef INSTRUMENT_GLOBAL_NEW
+#if defined(__GNUC__) || defined(__clang__)
+#define INSTRUMENT_NOINLINE __attribute__((noinline))
+#else
+#define INSTRUMENT_NOINLINE
+#endif
+
+INSTRUMENT_NOINLINE void *operator new(size_t size) {
+  ::instrumentation::RecordAllocation(size);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+INSTRUMENT_NOINLINE void operator delete(void *p) noexcept {
+  if (p != nullptr) {
+    ::instrumentation::RecordDeallocation();
+  }
+  std::free(p);
+}
+
+INSTRUMENT_NOINLINE void operator delete(void *p, size_t) noexcept {
+  if (p != nullptr) {
+    ::instrumentation::RecordDeallocation();
+  }
+  std::free(p);
+}
+
+INSTRUMENT_NOINLINE void *operator new(size_t size, std::align_val_t alignment) {
+  ::instrumentation::RecordAllocation(size);
+  // aligned_alloc wants a size that is a non-zero multiple of the alignment.
+  size_t align = static_cast<size_t>(alignment);
+  size_t rounded = size == 0 ? align : (size + align - 1) / align * align;
+  if (void *p = std::aligned_alloc(align, rounded)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+INSTRUMENT_NOINLINE void operator delete(void *p, std::align_val_t) noexcept {
+  if (p != nullptr) {
+    ::instrumentation::RecordDeallocation();
+  }
+  std::free(p);
+}
+
+INSTRUMENT_NOINLINE void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  if (p != nullptr) {
+    ::instrumentation::RecordDeallocation();
+  }
+  std::free(p);
+}
+#endif
@@ -0,0 +1,440 @@
+/**
+ * @file interval_set.cpp
+ * @brief Tutorial code for an interval set: a set of integers stored as
+ * sorted, disjoint runs, so whole ranges are inserted and erased at once.
+ */
+
+// sets.cpp fills int_set with 1 through 5 and 6 through 10, and later
+// erases everything from 9 on with int_set.erase(int_set.find(9),
+// int_set.end()). std::set<int> stores each integer in its own tree node,
+// about 40 bytes apiece, so a set holding the range 0 to 10,000,000 takes
+// 10,000,000 nodes, and erasing a range visits and frees every node in it.
+
+// When the integers come in long runs, it is cheaper to store the runs. An
+// IntervalSet keeps a sorted vector of disjoint half-open runs [lo, hi),
+// with a gap of at least one integer between neighbours (touching runs are
+// always merged). The set {1, 2, 3, 5, 6, 7, 8} is two runs, [1, 4) and
+// [5, 9), no matter how it was built.
+//   - contains(x) is a binary search for the last run starting at or before
+//     x, then one comparison against its hi.
+//   - insert(lo, hi) binary searches for the runs that overlap or touch
+//     [lo, hi), and replaces them with one run that covers all of them.
+//   - erase(lo, hi) binary searches for the runs that overlap [lo, hi),
+//     and replaces them with what is left of the first and the last: zero,
+//     one or two runs.
+// The searches are O(log r) for r runs. Adding or removing runs shifts the
+// ones after them, like std::vector::insert, but that moves 2 * sizeof(T)
+// bytes per run with one memmove, not one node per integer. For the
+// workloads this is for, r is small next to the number of integers, and the
+// runs of a large set still fit in cache. (With millions of tiny runs a
+// B-tree of runs, or std::map<T, T> from lo to hi, avoids the shifting.)
+
+// Iteration still yields individual integers in order, like std::set's
+// iterator, so the loops from sets.cpp work unchanged. Code that can use
+// whole runs calls runs() instead and handles a run in one step. As with
+// any flat container, inserting or erasing invalidates iterators.
+
+// The largest value of T can't be stored, since it would need a hi one
+// past it.
+
+// The benchmark builds a set of about 2,000,000 integers (pass a different
+// number as the first argument) in runs of 1 to 2000 with short gaps, then
+// compares std::set<int> and IntervalSet<int> on building it one integer at
+// a time, memory, point lookups, iterating over every integer, and erasing
+// ranges.
+
+// Includes std::lower_bound and std::upper_bound.
+#include <algorithm>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::ifstream, for reading this process's memory usage.
+#include <fstream>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::forward_iterator_tag.
+#include <iterator>
+// Includes std::numeric_limits.
+#include <limits>
+// Includes std::mt19937_64.
+#include <random>
+// Includes the set container library header, for the comparison.
+#include <set>
+// Includes std::invalid_argument and std::out_of_range.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::is_integral and std::make_unsigned.
+#include <type_traits>
+// Includes the header for std::vector.
+#include <vector>
+
+template <typename T>
+class IntervalSet {
+  static_assert(std::is_integral_v<T>, "IntervalSet holds integers");
+
+ public:
+  // The integers in [lo_, hi_).
+  struct Run {
+    T lo_;
+    T hi_;
+  };
+
+  // Walks the integers in order, one run after another.
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    const_iterator() = default;
+
+    const T &operator*() const { return value_; }
+    const T *operator->() const { return &value_; }
+
+    const_iterator &operator++() {
+      if (++value_ == (*runs_)[run_].hi_) {
+        run_++;
+        value_ = run_ < runs_->size() ? (*runs_)[run_].lo_ : T();
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator old = *this;
+      ++*this;
+      return old;
+    }
+
+    bool operator==(const const_iterator &other) const { return run_ == other.run_ && value_ == other.value_; }
+    bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+   private:
+    friend class IntervalSet;
+    const_iterator(const std::vector<Run> *runs, size_t run, T value) : runs_(runs), run_(run), value_(value) {}
+
+    const std::vector<Run> *runs_ = nullptr;
+    size_t run_ = 0;
+    T value_ = T();
+  };
+  using iterator = const_iterator;
+
+  // Returns true if value wasn't in the set yet, like std::set's
+  // insert(value).second.
+  bool insert(T value) { return insert(value, Next(value)) != 0; }
+
+  // Adds the integers in [lo, hi). Returns how many weren't in the set yet.
+  size_t insert(T lo, T hi) {
+    CheckRange(lo, hi);
+    if (lo == hi) {
+      return 0;
+    }
+    // Runs [first, last) overlap or touch [lo, hi).
+    auto first = std::lower_bound(runs_.begin(), runs_.end(), lo, [](const Run &run, T x) { return run.hi_ < x; });
+    auto last = std::upper_bound(first, runs_.end(), hi, [](T x, const Run &run) { return x < run.lo_; });
+    if (first == last) {
+      runs_.insert(first, Run{lo, hi});
+      size_ += Length(lo, hi);
+      return Length(lo, hi);
+    }
+    size_t covered = 0;
+    for (auto it = first; it != last; ++it) {
+      covered += Length(it->lo_, it->hi_);
+    }
+    first->lo_ = std::min(lo, first->lo_);
+    first->hi_ = std::max(hi, (last - 1)->hi_);
+    runs_.erase(first + 1, last);
+    size_t added = Length(first->lo_, first->hi_) - covered;
+    size_ += added;
+    return added;
+  }
+
+  // Returns how many integers were erased, 0 or 1, like std::set's
+  // erase(value).
+  size_t erase(T value) { return erase(value, Next(value)); }
+
+  // Erases the integers in [lo, hi). Returns how many were in the set.
+  size_t erase(T lo, T hi) {
+    CheckRange(lo, hi);
+    // Runs [first, last) overlap [lo, hi).
+    auto first = std::upper_bound(runs_.begin(), runs_.end(), lo, [](T x, const Run &run) { return x < run.hi_; });
+    auto last = std::lower_bound(first, runs_.end(), hi, [](const Run &run, T x) { return run.lo_ < x; });
+    if (lo == hi || first == last) {
+      return 0;
+    }
+    // What is left of the first and the last overlapping runs.
+    Run pieces[2];
+    size_t count = 0;
+    if (first->lo_ < lo) {
+      pieces[count++] = Run{first->lo_, lo};
+    }
+    if ((last - 1)->hi_ > hi) {
+      pieces[count++] = Run{hi, (last - 1)->hi_};
+    }
+    size_t removed = 0;
+    for (auto it = first; it != last; ++it) {
+      removed += Length(it->lo_, it->hi_);
+    }
+    for (size_t i = 0; i < count; i++) {
+      removed -= Length(pieces[i].lo_, pieces[i].hi_);
+    }
+    if (first + 1 == last && count == 2) {
+      // Splitting one run in two.
+      *first = pieces[0];
+      runs_.insert(last, pieces[1]);
+    } else {
+      std::copy(pieces, pieces + count, first);
+      runs_.erase(first + count, last);
+    }
+    size_ -= removed;
+    return removed;
+  }
+
+  // Erases [first, last) and returns the iterator after the erased
+  // integers, like std::set's erase(first, last).
+  const_iterator erase(const_iterator first, const_iterator last) {
+    if (first == last) {
+      return first;
+    }
+    if (last == end()) {
+      erase(*first, runs_.back().hi_);
+      return end();
+    }
+    T hi = *last;
+    erase(*first, hi);
+    return lower_bound(hi);
+  }
+
+  bool contains(T value) const { return FindRun(value) != runs_.size(); }
+
+  size_t count(T value) const { return contains(value) ? 1 : 0; }
+
+  // Returns the iterator at value, or end() if it isn't in the set.
+  const_iterator find(T value) const {
+    size_t run = FindRun(value);
+    return run == runs_.size() ? end() : const_iterator(&runs_, run, value);
+  }
+
+  // Returns the iterator at the first integer >= value.
+  const_iterator lower_bound(T value) const {
+    auto it = std::upper_bound(runs_.begin(), runs_.end(), value, [](T x, const Run &run) { return x < run.hi_; });
+    if (it == runs_.end()) {
+      return end();
+    }
+    return const_iterator(&runs_, it - runs_.begin(), std::max(value, it->lo_));
+  }
+
+  const_iterator begin() const { return runs_.empty() ? end() : const_iterator(&runs_, 0, runs_[0].lo_); }
+  const_iterator end() const { return const_iterator(&runs_, runs_.size(), T()); }
+
+  // The runs, sorted, disjoint and not touching.
+  const std::vector<Run> &runs() const { return runs_; }
+
+  // The number of integers in the set.
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  void clear() {
+    runs_.clear();
+    size_ = 0;
+  }
+
+ private:
+  using Unsigned = std::make_unsigned_t<T>;
+
+  // hi - lo, without overflowing when T is signed and the range is wide.
+  // Types narrower than int are promoted before the subtraction, so the
+  // difference is cast back to Unsigned to wrap at the width of T.
+  static size_t Length(T lo, T hi) {
+    return static_cast<size_t>(static_cast<Unsigned>(static_cast<Unsigned>(hi) - static_cast<Unsigned>(lo)));
+  }
+
+  static T Next(T value) {
+    if (value == std::numeric_limits<T>::max()) {
+      throw std::out_of_range("IntervalSet can't hold the largest value of its type");
+    }
+    return value + 1;
+  }
+
+  static void CheckRange(T lo, T hi) {
+    if (hi < lo) {
+      throw std::invalid_argument("IntervalSet range has hi < lo");
+    }
+  }
+
+  // Returns the index of the run holding value, or runs_.size().
+  size_t FindRun(T value) const {
+    auto it = std::upper_bound(runs_.begin(), runs_.end(), value, [](T x, const Run &run) { return x < run.lo_; });
+    if (it == runs_.begin() || (it - 1)->hi_ <= value) {
+      return runs_.size();
+    }
+    return (it - 1) - runs_.begin();
+  }
+
+  std::vector<Run> runs_;
+  size_t size_ = 0;
+};
+
+long long resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  long long pages_virtual = 0;
+  long long pages_resident = 0;
+  statm >> pages_virtual >> pages_resident;
+  return pages_resident * 4096;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  const int n = argc > 1 ? std::stoi(argv[1]) : 2000000;
+
+  // sets.cpp, on an IntervalSet.
+  IntervalSet<int> int_set;
+  for (int i = 1; i <= 5; ++i) {
+    int_set.insert(i);
+  }
+  // Or all at once: int_set.insert(6, 11).
+  for (int i = 6; i <= 10; ++i) {
+    int_set.insert(i);
+  }
+  std::cout << "Runs after inserting 1 through 10: " << int_set.runs().size() << "\n";
+  if (int_set.find(2) != int_set.end()) {
+    std::cout << "Element 2 is in int_set.\n";
+  }
+  if (int_set.count(11) == 0) {
+    std::cout << "Element 11 is not in the set.\n";
+  }
+  int_set.erase(4);
+  int_set.erase(*int_set.begin());
+  int_set.erase(int_set.find(9), int_set.end());
+  std::cout << "Printing the elements with a for-each loop:\n";
+  for (const int &elem : int_set) {
+    std::cout << elem << " ";
+  }
+  std::cout << "\nPrinting the runs:\n";
+  for (const IntervalSet<int>::Run &run : int_set.runs()) {
+    std::cout << "[" << run.lo_ << ", " << run.hi_ << ") ";
+  }
+  std::cout << "\n";
+
+  // Runs of 1 to 2000 integers, with gaps of 1 to 100 between them.
+  std::mt19937_64 rng(42);
+  std::vector<IntervalSet<int>::Run> data;
+  int total = 0;
+  for (int next = 0; total < n;) {
+    int length = std::min(static_cast<int>(rng() % 2000) + 1, n - total);
+    data.push_back({next, next + length});
+    total += length;
+    next += length + static_cast<int>(rng() % 100) + 1;
+  }
+  const int span = data.back().hi_;
+  std::vector<int> probes(1000000);
+  for (int &probe : probes) {
+    probe = static_cast<int>(rng() % span);
+  }
+  std::vector<int> erase_starts(1000);
+  for (int &start : erase_starts) {
+    start = static_cast<int>(rng() % span);
+  }
+  const int erase_length = 1000;
+
+  std::cout << total << " integers in " << data.size() << " runs:\n";
+
+  long long before = resident_bytes();
+  auto start = std::chrono::steady_clock::now();
+  std::set<int> std_set;
+  for (const auto &run : data) {
+    for (int i = run.lo_; i < run.hi_; i++) {
+      std_set.insert(i);
+    }
+  }
+  double std_build = seconds_since(start);
+  long long std_bytes = resident_bytes() - before;
+
+  start = std::chrono::steady_clock::now();
+  long long std_hits = 0;
+  for (int probe : probes) {
+    std_hits += std_set.count(probe);
+  }
+  double std_lookup = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  long long std_sum = 0;
+  for (const int &elem : std_set) {
+    std_sum += elem;
+  }
+  double std_iterate = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (int lo : erase_starts) {
+    std_set.erase(std_set.lower_bound(lo), std_set.lower_bound(lo + erase_length));
+  }
+  double std_erase = seconds_since(start);
+  size_t std_size = std_set.size();
+  std_set.clear();
+
+  start = std::chrono::steady_clock::now();
+  IntervalSet<int> interval_set;
+  for (const auto &run : data) {
+    for (int i = run.lo_; i < run.hi_; i++) {
+      interval_set.insert(i);
+    }
+  }
+  double interval_build = seconds_since(start);
+  // Too small to show up in the resident size, so count the vector instead.
+  size_t interval_bytes = interval_set.runs().capacity() * sizeof(IntervalSet<int>::Run);
+
+  start = std::chrono::steady_clock::now();
+  IntervalSet<int> by_runs;
+  for (const auto &run : data) {
+    by_runs.insert(run.lo_, run.hi_);
+  }
+  double runs_build = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  long long interval_hits = 0;
+  for (int probe : probes) {
+    interval_hits += interval_set.count(probe);
+  }
+  double interval_lookup = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  long long interval_sum = 0;
+  for (const int &elem : interval_set) {
+    interval_sum += elem;
+  }
+  double interval_iterate = seconds_since(start);
+
+  // The same sum, a run at a time: lo + (lo + 1) + ... + (hi - 1).
+  start = std::chrono::steady_clock::now();
+  long long runs_sum = 0;
+  for (const auto &run : interval_set.runs()) {
+    runs_sum += (static_cast<long long>(run.lo_) + run.hi_ - 1) * (run.hi_ - run.lo_) / 2;
+  }
+  double runs_iterate = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (int lo : erase_starts) {
+    interval_set.erase(lo, lo + erase_length);
+  }
+  double interval_erase = seconds_since(start);
+
+  std::cout << "  build one integer at a time: std::set " << std_build << " s, IntervalSet " << interval_build
+            << " s (whole runs: " << runs_build << " s)\n";
+  std::cout << "  memory: std::set " << static_cast<double>(std_bytes) / total << " bytes per integer, IntervalSet "
+            << static_cast<double>(interval_bytes) / total << " (" << by_runs.runs().size() << " runs of "
+            << sizeof(IntervalSet<int>::Run) << " bytes)\n";
+  std::cout << "  " << probes.size() << " lookups: std::set " << std_lookup << " s, IntervalSet " << interval_lookup
+            << " s\n";
+  std::cout << "  iterate: std::set " << std_iterate << " s, IntervalSet " << interval_iterate << " s (by runs "
+            << runs_iterate << " s)\n";
+  std::cout << "  erase " << erase_starts.size() << " ranges of " << erase_length << ": std::set " << std_erase
+            << " s, IntervalSet " << interval_erase << " s\n";
+  bool same = std_hits == interval_hits && std_sum == interval_sum && std_sum == runs_sum &&
+              std_size == interval_set.size() && by_runs.size() == static_cast<size_t>(total);
+  std::cout << "  results " << (same ? "match" : "DIFFER") << "\n";
+  return 0;
+}
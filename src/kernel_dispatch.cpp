@@ -0,0 +1,382 @@
+/**
+ * @file kernel_dispatch.cpp
+ * @brief Tutorial code for turning runtime parameters into compile-time
+ * template parameters, with a table of specialized kernel instantiations.
+ */
+
+// templated_functions.cpp has add3<bool T>, which takes a bool as a template
+// parameter but still writes `if (T)` as if it were a runtime value, and
+// templated_classes.cpp has Bar<int T>, which only prints its parameter. The
+// real power of non-type template parameters shows up in hot loops: if a
+// parameter is known at compile time, the compiler can delete the branches
+// that depend on it, unroll loops by it, and vectorize around it.
+
+// The catch is that our parameters usually arrive at runtime: the element
+// type of a column, a flag from a query, a tuning knob. This file shows the
+// standard trick to bridge the gap:
+//   1. Write the kernel once as a template over all of its parameters, using
+//      `if constexpr` wherever it would otherwise branch on them.
+//   2. Instantiate the kernel for every combination of parameter values we
+//      support, and store pointers to the instantiations in a table.
+//   3. At runtime, turn the parameter values into a table index *once*, and
+//      call the selected function pointer in the hot loop.
+// The DispatchTable class below does steps 2 and 3 for any kernel template.
+
+// The demo kernel is a filtered sum: add up all elements (optionally only the
+// ones greater than a threshold). Its parameters are the element type, the
+// SIMD width (how many lanes are processed per step), the unroll factor (how
+// many independent steps are in flight), and the filter flag. The benchmark
+// compares the specialized kernels with a generic loop that checks all of
+// these at runtime for every element. Pass a different element count as the
+// first argument (default 16,000,000).
+
+// Includes std::array, which holds the dispatch table.
+#include <array>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::floor, std::isnan and std::nextafter.
+#include <cmath>
+// Includes the header for int32_t and int64_t.
+#include <cstdint>
+// Includes std::memcpy.
+#include <cstring>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::numeric_limits.
+#include <limits>
+// Includes std::mt19937, used to generate the benchmark data.
+#include <random>
+// Includes std::invalid_argument, thrown for unsupported parameter values.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::integral_constant and std::conditional_t.
+#include <type_traits>
+// Includes std::index_sequence.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// A compile-time list of types. Each dimension of a dispatch table is one of
+// these lists.
+template <typename... Ts>
+struct TypeList {
+  static constexpr size_t kSize = sizeof...(Ts);
+};
+
+// A dimension of values, e.g. Values<1, 2, 4, 8>. Each value becomes its own
+// type (std::integral_constant), so types and values can be mixed freely as
+// kernel parameters. Kernels read the value back as Param::value.
+template <auto... Vs>
+using Values = TypeList<std::integral_constant<decltype(Vs), Vs>...>;
+
+// At<I, List>::type is the I-th type of List.
+template <size_t I, typename List>
+struct At;
+
+template <typename T, typename... Ts>
+struct At<0, TypeList<T, Ts...>> {
+  using type = T;
+};
+
+template <size_t I, typename T, typename... Ts>
+struct At<I, TypeList<T, Ts...>> : At<I - 1, TypeList<Ts...>> {};
+
+// Returns the position of the runtime value v in a Values<...> dimension, or
+// throws if the value is not one we instantiated the kernel for.
+template <typename... Constants, typename V>
+size_t index_of_value(TypeList<Constants...>, V v) {
+  size_t index = 0;
+  size_t found = sizeof...(Constants);
+  ((found = (found == sizeof...(Constants) && Constants::value == v) ? index : found, index++), ...);
+  if (found == sizeof...(Constants)) {
+    throw std::invalid_argument("no kernel instantiated for parameter value " + std::to_string(v));
+  }
+  return found;
+}
+
+// The dispatch table. Kernel is a class template with one template parameter
+// per dimension and a static Run function of type Signature. The table holds
+// &Kernel<...>::Run for every combination of the dimensions' entries, laid out
+// like a multi-dimensional array in row-major order. All of it is computed at
+// compile time.
+template <template <typename...> class Kernel, typename Signature, typename... Dims>
+class DispatchTable {
+ public:
+  static constexpr size_t kDims = sizeof...(Dims);
+  static constexpr size_t kSize = (Dims::kSize * ...);
+
+  // Select takes one index per dimension and returns the matching kernel.
+  // Call it once, outside the hot loop.
+  static Signature *Select(const std::array<size_t, kDims> &indices) {
+    constexpr std::array<size_t, kDims> sizes = {Dims::kSize...};
+    size_t flat = 0;
+    for (size_t d = 0; d < kDims; d++) {
+      flat = flat * sizes[d] + indices[d];
+    }
+    return kTable[flat];
+  }
+
+ private:
+  // The index into dimension D of the table entry at position Flat.
+  template <size_t Flat, size_t D>
+  static constexpr size_t Digit() {
+    constexpr size_t sizes[] = {Dims::kSize...};
+    size_t stride = 1;
+    for (size_t k = D + 1; k < kDims; k++) {
+      stride *= sizes[k];
+    }
+    return (Flat / stride) % sizes[D];
+  }
+
+  // The table entry at position Flat: instantiate Kernel with the matching
+  // entry of every dimension. Dims and D are expanded side by side.
+  template <size_t Flat, size_t... D>
+  static constexpr Signature *Entry(std::index_sequence<D...>) {
+    return &Kernel<typename At<Digit<Flat, D>(), Dims>::type...>::Run;
+  }
+
+  template <size_t... Flat>
+  static constexpr std::array<Signature *, kSize> Build(std::index_sequence<Flat...>) {
+    return {Entry<Flat>(std::make_index_sequence<kDims>{})...};
+  }
+
+  static constexpr std::array<Signature *, kSize> kTable = Build(std::make_index_sequence<kSize>{});
+};
+
+// The runtime description of an element type. The order matches
+// ElementTypes below, so the enum value is the index into that dimension.
+enum class ElementType { kInt32, kInt64, kFloat, kDouble };
+using ElementTypes = TypeList<int32_t, int64_t, float, double>;
+const char *element_type_name(ElementType type) {
+  const char *names[] = {"int32", "int64", "float", "double"};
+  return names[static_cast<int>(type)];
+}
+
+// The dimensions we instantiate the filtered sum for.
+using Widths = Values<1, 4, 8, 16>;
+using Unrolls = Values<1, 2, 4>;
+using Filters = Values<false, true>;
+
+// Every kernel instantiation has this signature, so they all fit in one table.
+// The data is passed as void * because the element type is a template
+// parameter of the kernel, not of the caller.
+using FilteredSumFn = double(const void *data, size_t n, double threshold);
+
+// Returns x if keep is true and 0 otherwise, without a branch: the comparison
+// result is widened into an all-ones or all-zeros bit mask that is ANDed with
+// the bits of x. Writing `keep ? x : 0` looks equivalent, but compilers are
+// free to (and for floating point types often do) turn it back into a branch,
+// which mispredicts half the time on random data.
+template <typename T>
+T keep_if(T x, bool keep) {
+  if constexpr (std::is_integral_v<T>) {
+    return x & -static_cast<T>(keep);
+  } else {
+    using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    Bits bits;
+    std::memcpy(&bits, &x, sizeof(x));
+    bits &= -static_cast<Bits>(keep);
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+  }
+}
+
+// Converts the filter threshold to T, so that the kernel can compare
+// elements in their own type. For an element x of T, x > *t must hold
+// exactly when static_cast<double>(x) > threshold, the comparison
+// generic_filtered_sum makes, so *t is the largest T that is <= threshold:
+// rounded down, not toward zero (for integers, -0.5 must become -1, not 0)
+// and not to nearest (0.1 as a float is slightly above 0.1). Returns false
+// if every element passes the filter because threshold is below every T.
+template <typename T>
+bool threshold_as(double threshold, T *t) {
+  if constexpr (std::is_integral_v<T>) {
+    double floor = std::floor(threshold);
+    if (std::isnan(threshold) || floor >= static_cast<double>(std::numeric_limits<T>::max())) {
+      // Nothing passes x > max, just as nothing passes x > NaN.
+      *t = std::numeric_limits<T>::max();
+      return true;
+    }
+    if (floor < static_cast<double>(std::numeric_limits<T>::min())) {
+      return false;
+    }
+    *t = static_cast<T>(floor);
+  } else {
+    *t = static_cast<T>(threshold);
+    if (static_cast<double>(*t) > threshold) {
+      *t = std::nextafter(*t, -std::numeric_limits<T>::infinity());
+    }
+  }
+  return true;
+}
+
+// The kernel. Compare this with add3<bool T>: every parameter is used with
+// `if constexpr` or as a loop bound, so each instantiation contains exactly
+// one straight-line loop and no checks of its parameters.
+template <typename T, typename Width, typename Unroll, typename Filter>
+struct FilteredSum {
+  static double Run(const void *data, size_t n, double threshold) {
+    const T *in = static_cast<const T *>(data);
+    constexpr size_t kStep = Width::value * Unroll::value;
+    // Integers are summed as int64_t so they can't overflow; floating point
+    // values are summed as double.
+    using Acc = std::conditional_t<std::is_integral_v<T>, int64_t, double>;
+    T t{};
+    if (Filter::value && !threshold_as(threshold, &t)) {
+      return FilteredSum<T, Width, Unroll, std::false_type>::Run(data, n, threshold);
+    }
+
+    // kStep independent accumulators. The inner loop has a compile-time trip
+    // count, so the compiler fully unrolls it and maps groups of Width lanes
+    // onto SIMD registers. The filter goes through keep_if, so it vectorizes
+    // too and never mispredicts.
+    Acc acc[kStep] = {};
+    size_t i = 0;
+    for (; i + kStep <= n; i += kStep) {
+      for (size_t k = 0; k < kStep; k++) {
+        T x = in[i + k];
+        if constexpr (Filter::value) {
+          acc[k] += keep_if(x, x > t);
+        } else {
+          acc[k] += x;
+        }
+      }
+    }
+    Acc total = 0;
+    for (size_t k = 0; k < kStep; k++) {
+      total += acc[k];
+    }
+    for (; i < n; i++) {
+      if (!Filter::value || in[i] > t) {
+        total += in[i];
+      }
+    }
+    return static_cast<double>(total);
+  }
+};
+
+using FilteredSumTable = DispatchTable<FilteredSum, FilteredSumFn, ElementTypes, Widths, Unrolls, Filters>;
+
+// Turns the runtime parameters into a kernel. This is the one place where the
+// runtime values are looked at.
+FilteredSumFn *select_filtered_sum(ElementType type, int width, int unroll, bool filter) {
+  return FilteredSumTable::Select({static_cast<size_t>(type), index_of_value(Widths{}, width),
+                                   index_of_value(Unrolls{}, unroll), index_of_value(Filters{}, filter)});
+}
+
+// The generic, branchy version: the element type and the filter flag are
+// checked for every single element.
+double generic_filtered_sum(ElementType type, const void *data, size_t n, bool filter, double threshold) {
+  double sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    double x = 0;
+    switch (type) {
+      case ElementType::kInt32:
+        x = static_cast<const int32_t *>(data)[i];
+        break;
+      case ElementType::kInt64:
+        x = static_cast<double>(static_cast<const int64_t *>(data)[i]);
+        break;
+      case ElementType::kFloat:
+        x = static_cast<const float *>(data)[i];
+        break;
+      case ElementType::kDouble:
+        x = static_cast<const double *>(data)[i];
+        break;
+    }
+    if (filter) {
+      if (x > threshold) {
+        sum += x;
+      }
+    } else {
+      sum += x;
+    }
+  }
+  return sum;
+}
+
+// Fills a raw buffer with n values between 0 and 99 of the given type.
+std::vector<char> make_data(ElementType type, size_t n) {
+  const size_t sizes[] = {sizeof(int32_t), sizeof(int64_t), sizeof(float), sizeof(double)};
+  const size_t elem_size = sizes[static_cast<int>(type)];
+  std::vector<char> buffer(n * elem_size);
+  std::mt19937 gen(445);
+  std::uniform_int_distribution<int> dist(0, 99);
+  for (size_t i = 0; i < n; i++) {
+    int v = dist(gen);
+    char *dst = buffer.data() + i * elem_size;
+    switch (type) {
+      case ElementType::kInt32: {
+        int32_t x = v;
+        std::memcpy(dst, &x, sizeof(x));
+        break;
+      }
+      case ElementType::kInt64: {
+        int64_t x = v;
+        std::memcpy(dst, &x, sizeof(x));
+        break;
+      }
+      case ElementType::kFloat: {
+        float x = static_cast<float>(v);
+        std::memcpy(dst, &x, sizeof(x));
+        break;
+      }
+      case ElementType::kDouble: {
+        double x = v;
+        std::memcpy(dst, &x, sizeof(x));
+        break;
+      }
+    }
+  }
+  return buffer;
+}
+
+// Runs fn reps times and returns the average time per run in milliseconds.
+template <typename Fn>
+double time_ms(int reps, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    fn();
+  }
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 16000000;
+  const double threshold = 50;
+  const int reps = 5;
+
+  std::cout << "The dispatch table holds " << FilteredSumTable::kSize << " kernel instantiations.\n";
+
+  for (ElementType type : {ElementType::kInt32, ElementType::kInt64, ElementType::kFloat, ElementType::kDouble}) {
+    std::vector<char> data = make_data(type, n);
+    std::cout << element_type_name(type) << " x " << n << ", filter (x > " << threshold << "):\n";
+
+    double expected = 0;
+    double generic_ms = time_ms(reps, [&] { expected = generic_filtered_sum(type, data.data(), n, true, threshold); });
+    std::cout << "  generic branchy loop:        " << generic_ms << " ms\n";
+
+    // Try a few points of the table. In a real system, we would pick the
+    // best one once (e.g. from a calibration run) and keep using it.
+    for (int width : {1, 8, 16}) {
+      for (int unroll : {1, 4}) {
+        FilteredSumFn *kernel = select_filtered_sum(type, width, unroll, true);
+        double result = 0;
+        double ms = time_ms(reps, [&] { result = kernel(data.data(), n, threshold); });
+        std::cout << "  specialized width " << width << (width < 10 ? " " : "") << " unroll " << unroll << ": "
+                  << ms << " ms (" << generic_ms / ms << "x)" << (result == expected ? "" : " MISMATCH") << "\n";
+      }
+    }
+  }
+
+  // Asking for a combination we didn't instantiate is an error, reported
+  // when the kernel is selected rather than in the hot loop.
+  try {
+    select_filtered_sum(ElementType::kInt32, 3, 1, false);
+  } catch (const std::invalid_argument &e) {
+    std::cout << "Selecting width 3: " << e.what() << std::endl;
+  }
+
+  return 0;
+}
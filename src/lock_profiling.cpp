@@ -0,0 +1,173 @@
+/**
+ * @file lock_profiling.cpp
+ * @brief Tutorial code for finding lock contention with lock_profiler.h.
+ */
+
+// This program runs scaled-up versions of the scenarios in mutex.cpp,
+// scoped_lock.cpp, rwlock.cpp and condition_variable.cpp, with the standard
+// primitives swapped for the profiled ones from lock_profiler.h. The swap is
+// one line per lock: std::mutex m; becomes ProfiledMutex m("name");, and the
+// code that locks it (m.lock(), std::scoped_lock, std::shared_lock,
+// std::unique_lock, cv.wait) stays exactly the same.
+
+// When the program exits, the JSON report is printed to stderr. Run it as
+//   LOCK_PROFILE_JSON=locks.json ./lock_profiling
+// to write the report to a file instead, or with LOCK_PROFILE=0 to turn
+// profiling off. The last part of the program measures what profiling costs
+// on an uncontended lock. Pass a different number of operations per thread
+// as the first argument (default 100,000).
+
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes the shared mutex library header.
+#include <shared_mutex>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes the header for std::vector.
+#include <vector>
+
+// Includes the profiled locks.
+#include "lock_profiler.h"
+
+using lock_profiler::ProfiledConditionVariable;
+using lock_profiler::ProfiledMutex;
+using lock_profiler::ProfiledSharedMutex;
+
+// The globals from the four demos, now with names.
+int count = 0;
+ProfiledMutex m("mutex.cpp m");
+ProfiledMutex scoped_m("scoped_lock.cpp m");
+ProfiledSharedMutex shared_m("rwlock.cpp m");
+ProfiledMutex cv_m("condition_variable.cpp m");
+ProfiledConditionVariable cv("condition_variable.cpp cv");
+
+// mutex.cpp: explicit lock() and unlock().
+void add_count(int ops) {
+  for (int i = 0; i < ops; i++) {
+    m.lock();
+    count += 1;
+    m.unlock();
+  }
+}
+
+// scoped_lock.cpp: the same with RAII.
+void scoped_add_count(int ops) {
+  for (int i = 0; i < ops; i++) {
+    std::scoped_lock slk(scoped_m);
+    count += 1;
+  }
+}
+
+// rwlock.cpp: readers take a std::shared_lock, writers a std::unique_lock.
+void read_value(int ops, long long *sum) {
+  for (int i = 0; i < ops; i++) {
+    std::shared_lock lk(shared_m);
+    *sum += count;
+  }
+}
+
+void write_value(int ops) {
+  for (int i = 0; i < ops; i++) {
+    std::unique_lock lk(shared_m);
+    count += 3;
+  }
+}
+
+// condition_variable.cpp: two threads increment the counter and the waiter
+// wakes up when it reaches the target.
+int cv_count = 0;
+
+void add_count_and_notify(int ops, int target) {
+  for (int i = 0; i < ops; i++) {
+    std::scoped_lock slk(cv_m);
+    cv_count += 1;
+    if (cv_count == target) {
+      cv.notify_one();
+    }
+  }
+}
+
+void waiter_thread(int target) {
+  std::unique_lock lk(cv_m);
+  cv.wait(lk, [&] { return cv_count == target; });
+  std::cout << "Printing cv_count: " << cv_count << std::endl;
+}
+
+// Average nanoseconds per uncontended lock()/unlock() pair.
+template <typename Mutex>
+double lock_unlock_ns(Mutex &mutex, int ops) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ops; i++) {
+    mutex.lock();
+    count += 1;
+    mutex.unlock();
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ops;
+}
+
+int main(int argc, char **argv) {
+  const int ops = argc > 1 ? std::stoi(argv[1]) : 100000;
+
+  {
+    std::thread t1(add_count, ops);
+    std::thread t2(add_count, ops);
+    t1.join();
+    t2.join();
+    std::cout << "Printing count after mutex.cpp: " << count << std::endl;
+  }
+
+  {
+    std::thread t1(scoped_add_count, ops);
+    std::thread t2(scoped_add_count, ops);
+    t1.join();
+    t2.join();
+    std::cout << "Printing count after scoped_lock.cpp: " << count << std::endl;
+  }
+
+  {
+    // Like rwlock.cpp: 24 threads, every third one a writer.
+    std::vector<std::thread> threads;
+    std::vector<long long> sums(24);
+    for (int t = 0; t < 24; t++) {
+      if (t % 3 == 1) {
+        threads.emplace_back(write_value, ops / 10);
+      } else {
+        threads.emplace_back(read_value, ops / 10, &sums[t]);
+      }
+    }
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    std::cout << "Printing count after rwlock.cpp: " << count << std::endl;
+  }
+
+  {
+    std::thread t3(waiter_thread, 2 * ops);
+    std::thread t1(add_count_and_notify, ops, 2 * ops);
+    std::thread t2(add_count_and_notify, ops, 2 * ops);
+    t1.join();
+    t2.join();
+    t3.join();
+  }
+
+  // The cost of profiling on the fast path.
+  std::mutex plain;
+  ProfiledMutex profiled("benchmark");
+  double plain_ns = lock_unlock_ns(plain, ops * 10);
+  double enabled_ns = lock_unlock_ns(profiled, ops * 10);
+  lock_profiler::SetEnabled(false);
+  double disabled_ns = lock_unlock_ns(profiled, ops * 10);
+  lock_profiler::SetEnabled(true);
+  std::cout << "Uncontended lock()/unlock():\n"
+            << "  std::mutex:                     " << plain_ns << " ns\n"
+            << "  ProfiledMutex, profiling on:    " << enabled_ns << " ns\n"
+            << "  ProfiledMutex, profiling off:   " << disabled_ns << " ns\n"
+            << "The lock profile is printed to stderr (or LOCK_PROFILE_JSON) at exit." << std::endl;
+  return 0;
+}
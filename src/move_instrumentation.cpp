@@ -0,0 +1,166 @@
+/**
+ * @file move_instrumentation.cpp
+ * @brief Tutorial code for counting copies, moves and allocations in the
+ * move semantics demos with instrumentation.h.
+ */
+
+// In move_semantics.cpp and move_constructors.cpp, we claimed that moving is
+// cheaper than copying because a move steals the buffer of the moved-from
+// object instead of allocating a new one. In this file, we prove it. We use
+// the counters from instrumentation.h to count exactly how many copies, moves
+// and heap allocations each of the operations from those files performs.
+
+// Because we #define INSTRUMENT_GLOBAL_NEW below, every call to operator new
+// in this program is counted, including the ones std::vector and std::string
+// make internally. When the program exits, a report of every
+// INSTRUMENT_SCOPE is printed to stderr.
+
+// Includes the header for uint32_t.
+#include <cstdint>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the C++ string library.
+#include <string>
+// Includes the utility header for std::move.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// Count every global heap allocation in this program. This must be defined in
+// exactly one file per executable, before including instrumentation.h.
+#define INSTRUMENT_GLOBAL_NEW
+// Includes the instrumentation layer.
+#include "instrumentation.h"
+
+using instrumentation::Counts;
+using instrumentation::CountingAllocator;
+using instrumentation::Tracked;
+
+// A vector of ints whose allocations are counted through CountingAllocator.
+using CountedVector = std::vector<int, CountingAllocator<int>>;
+
+// The two functions from move_semantics.cpp, with the printing removed so the
+// counts only reflect the vector operations. move_add_three_and_print steals
+// the buffer of vec, add_three_and_print works on it in place.
+int move_add_three(CountedVector &&vec) {
+  CountedVector vec1 = std::move(vec);
+  vec1.push_back(3);
+  return vec1.back();
+}
+
+int add_three(CountedVector &&vec) {
+  vec.push_back(3);
+  return vec.back();
+}
+
+// For comparison, a version that takes its argument by value. Passing an
+// lvalue to it copies the whole vector.
+int copy_add_three(CountedVector vec) {
+  vec.push_back(3);
+  return vec.back();
+}
+
+// The Person class from move_constructors.cpp, with nicknames_ wrapped in
+// Tracked so every copy and move of it is counted. Tracked counts moves, so
+// the print statements of the original are no longer needed.
+class Person {
+public:
+  Person() : age_(0), nicknames_(), valid_(true) {}
+
+  Person(uint32_t age, std::vector<std::string> &&nicknames)
+      : age_(age), nicknames_(std::move(nicknames)), valid_(true) {}
+
+  Person(Person &&person)
+      : age_(person.age_), nicknames_(std::move(person.nicknames_)),
+        valid_(true) {
+    person.valid_ = false;
+  }
+
+  Person &operator=(Person &&other) {
+    age_ = other.age_;
+    nicknames_ = std::move(other.nicknames_);
+    valid_ = true;
+    other.valid_ = false;
+    return *this;
+  }
+
+  Person(const Person &) = delete;
+  Person &operator=(const Person &) = delete;
+
+  const std::string &GetNicknameAtI(size_t i) const { return nicknames_->at(i); }
+
+private:
+  uint32_t age_;
+  Tracked<std::vector<std::string>> nicknames_;
+  bool valid_;
+};
+
+// Prints one line of counts.
+void print_counts(const char *what, const Counts &delta) {
+  std::cout << what << ": copies=" << delta.copies_ << " moves=" << delta.moves_
+            << " allocations=" << delta.allocations_ << " bytes=" << delta.bytes_allocated_ << "\n";
+}
+
+int main() {
+  // First, the functions from move_semantics.cpp. We reserve enough room so
+  // that push_back(3) never reallocates; that way any allocation we see comes
+  // from the function's parameter passing alone.
+  CountedVector int_array;
+  int_array.reserve(8);
+  int_array.assign({1, 2, 3, 4});
+  {
+    instrumentation::Scope scope(INSTRUMENT_SITE("move_add_three"));
+    move_add_three(std::move(int_array));
+    print_counts("move_add_three(std::move(v))", scope.Delta());
+  }
+
+  CountedVector int_array2;
+  int_array2.reserve(8);
+  int_array2.assign({1, 2, 3, 4});
+  {
+    instrumentation::Scope scope(INSTRUMENT_SITE("add_three"));
+    add_three(std::move(int_array2));
+    print_counts("add_three(std::move(v))     ", scope.Delta());
+  }
+
+  // Passing an lvalue by value copies the vector, which allocates.
+  {
+    instrumentation::Scope scope(INSTRUMENT_SITE("copy_add_three"));
+    copy_add_three(int_array2);
+    print_counts("copy_add_three(v)           ", scope.Delta());
+  }
+
+  // Now the Person class. Moving andy around as in move_constructors.cpp
+  // moves the nicknames vector twice and never copies or allocates.
+  Person andy(15445, {"andy", "pavlo"});
+  {
+    instrumentation::Scope scope(INSTRUMENT_SITE("Person moves"));
+    Person andy1;
+    andy1 = std::move(andy);
+    Person andy2(std::move(andy1));
+    Counts delta = scope.Delta();
+    print_counts("Person move assign + move construct", delta);
+
+    // This is how we "prove" a hot path is copy- and allocation-free: check
+    // the delta, and complain loudly if it isn't.
+    std::cout << "Person moves are copy- and allocation-free: "
+              << (delta.CopyAndAllocationFree() ? "yes" : "NO") << "\n";
+  }
+
+  // The same check in a loop. The scope is entered 1000 times; the report at
+  // exit aggregates all of them under one call site.
+  std::vector<Person> people;
+  people.reserve(1000);
+  for (uint32_t i = 0; i < 1000; i++) {
+    people.emplace_back(i, std::vector<std::string>{"andy"});
+  }
+  for (size_t i = 0; i + 1 < people.size(); i++) {
+    INSTRUMENT_SCOPE("swap adjacent people");
+    Person tmp(std::move(people[i]));
+    people[i] = std::move(people[i + 1]);
+    people[i + 1] = std::move(tmp);
+  }
+  std::cout << "See stderr for the per-call-site report." << std::endl;
+
+  return 0;
+}
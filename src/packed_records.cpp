@@ -0,0 +1,359 @@
+/**
+ * @file packed_records.cpp
+ * @brief Tutorial code for storing collections of multi-field records without
+ * padding, either as packed rows or as columns.
+ */
+
+// Foo2<T, U> in templated_classes.cpp and Abcdefghijklmnopqrstuvwxyz<T, U> in
+// auto.cpp store two members, and the compiler lays them out in declaration
+// order, inserting padding so each member is aligned. For Foo2<int, double>
+// that means: 4 bytes of int, 4 bytes of padding, 8 bytes of double, so a
+// std::vector<Foo2<int, double>> spends 4 of every 16 bytes (25%) on nothing.
+// Reordering the members doesn't help on its own: {double, int} is 12 bytes
+// of data, but the struct is still padded to 16 so the next array element's
+// double stays aligned.
+
+// This file shows a generic container, PackedRecords<Layout, Ts...>, for
+// records with any number of fields. It supports three layouts:
+//   - kPadded: the baseline. Rows are stored like the struct the compiler
+//     would generate, fields in declaration order with padding.
+//   - kPacked: rows are stored back to back with no padding at all. Fields
+//     are reordered at compile time by decreasing alignment, so most fields
+//     still land on aligned addresses, and the rest are read with memcpy
+//     (which compiles to a plain unaligned load on x86 and ARM64).
+//   - kColumnar: one array per field ("structure of arrays"). No padding,
+//     and a scan over one field reads only that field's bytes.
+// PackedRecordsOf<Layout, Foo2<int, double>> picks the field types straight
+// out of any record template, so Foo2 and Abcdefghijklmnopqrstuvwxyz work
+// the same way.
+
+// The benchmark stores N records (default 10,000,000; pass e.g. 100000000 as
+// the first argument) in each layout and reports the memory footprint and the
+// throughput of scanning one field and of scanning all fields.
+
+// Includes std::array, used for the compile-time field order and offsets.
+#include <array>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for int16_t.
+#include <cstdint>
+// Includes std::memcpy.
+#include <cstring>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the C++ string library.
+#include <string>
+// Includes std::tuple, which describes a record's fields.
+#include <tuple>
+// Includes std::is_trivially_copyable_v.
+#include <type_traits>
+// Includes std::index_sequence.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// Foo2 from templated_classes.cpp, with getters so the benchmark can read it.
+template<typename T, typename U>
+class Foo2 {
+  public:
+    Foo2(T var1, U var2)
+      : var1_(var1)
+      , var2_(var2) {}
+    T GetVar1() const { return var1_; }
+    U GetVar2() const { return var2_; }
+  private:
+    T var1_;
+    U var2_;
+};
+
+// Abcdefghijklmnopqrstuvwxyz from auto.cpp.
+template <typename T, typename U> class Abcdefghijklmnopqrstuvwxyz {
+public:
+  Abcdefghijklmnopqrstuvwxyz(T instance1, U instance2)
+      : instance1_(instance1), instance2_(instance2) {}
+
+private:
+  T instance1_;
+  U instance2_;
+};
+
+enum class Layout { kPadded, kPacked, kColumnar };
+
+// Compile-time layout computations for the fields Ts...
+template <typename... Ts>
+struct FieldLayout {
+  static constexpr size_t kFields = sizeof...(Ts);
+  static constexpr std::array<size_t, kFields> kSizes = {sizeof(Ts)...};
+  static constexpr std::array<size_t, kFields> kAligns = {alignof(Ts)...};
+
+  // The order in which packed rows store the fields: by decreasing
+  // alignment, ties kept in declaration order. A constexpr insertion sort;
+  // it runs inside the compiler, never at runtime.
+  static constexpr std::array<size_t, kFields> PackedOrder() {
+    std::array<size_t, kFields> order{};
+    for (size_t i = 0; i < kFields; i++) {
+      order[i] = i;
+    }
+    for (size_t i = 1; i < kFields; i++) {
+      for (size_t j = i; j > 0 && kAligns[order[j - 1]] < kAligns[order[j]]; j--) {
+        size_t tmp = order[j];
+        order[j] = order[j - 1];
+        order[j - 1] = tmp;
+      }
+    }
+    return order;
+  }
+
+  // Byte offset of every field (indexed by declaration order) within a
+  // packed row, and the size of a packed row.
+  static constexpr std::array<size_t, kFields> PackedOffsets() {
+    constexpr std::array<size_t, kFields> order = PackedOrder();
+    std::array<size_t, kFields> offsets{};
+    size_t offset = 0;
+    for (size_t i = 0; i < kFields; i++) {
+      offsets[order[i]] = offset;
+      offset += kSizes[order[i]];
+    }
+    return offsets;
+  }
+
+  static constexpr size_t kPackedRowSize = (sizeof(Ts) + ...);
+
+  // Byte offset of every field within a padded row: the C struct layout
+  // rules, applied by hand. Each field goes at the next offset that is a
+  // multiple of its alignment, in declaration order.
+  static constexpr std::array<size_t, kFields> PaddedOffsets() {
+    std::array<size_t, kFields> offsets{};
+    size_t offset = 0;
+    for (size_t i = 0; i < kFields; i++) {
+      offset = (offset + kAligns[i] - 1) / kAligns[i] * kAligns[i];
+      offsets[i] = offset;
+      offset += kSizes[i];
+    }
+    return offsets;
+  }
+
+  // The struct's size is then rounded up to its largest alignment, so the
+  // next row in an array is aligned too.
+  static constexpr size_t PaddedRowSize() {
+    size_t align = 1;
+    for (size_t a : kAligns) {
+      align = a > align ? a : align;
+    }
+    size_t end = PaddedOffsets()[kFields - 1] + kSizes[kFields - 1];
+    return (end + align - 1) / align * align;
+  }
+};
+
+// The container. Fields must be trivially copyable (ints, floats, plain
+// structs), because packed rows are assembled from raw bytes.
+template <Layout L, typename... Ts>
+class PackedRecords {
+  static_assert(sizeof...(Ts) >= 2, "PackedRecords needs at least two fields");
+  static_assert((std::is_trivially_copyable_v<Ts> && ...), "PackedRecords fields must be trivially copyable");
+
+  using Fields = FieldLayout<Ts...>;
+  using Row = std::tuple<Ts...>;
+  template <size_t I>
+  using FieldType = std::tuple_element_t<I, Row>;
+
+ public:
+  static constexpr size_t kRowBytes = L == Layout::kPadded ? Fields::PaddedRowSize() : Fields::kPackedRowSize;
+
+  void reserve(size_t n) {
+    if constexpr (L == Layout::kColumnar) {
+      ReserveColumns(n, std::index_sequence_for<Ts...>{});
+    } else {
+      rows_.reserve(n * kRowBytes);
+    }
+  }
+
+  void push_back(const Ts &...values) {
+    if constexpr (L == Layout::kColumnar) {
+      std::apply([&](auto &...columns) { (columns.push_back(values), ...); }, columns_);
+    } else {
+      rows_.resize(rows_.size() + kRowBytes);
+      size_ += 1;
+      SetAll(size_ - 1, std::index_sequence_for<Ts...>{}, values...);
+      return;
+    }
+    size_ += 1;
+  }
+
+  // Appends a Foo2 or any record whose fields can be read with a getter
+  // function; see the demo in main.
+  template <typename Record, typename... Getters>
+  void push_back_record(const Record &record, Getters... getters) {
+    push_back((record.*getters)()...);
+  }
+
+  size_t size() const { return size_; }
+
+  // Bytes of record storage in use (not counting spare vector capacity).
+  size_t bytes() const { return size_ * kRowBytes; }
+
+  template <size_t I>
+  FieldType<I> Get(size_t row) const {
+    if constexpr (L == Layout::kColumnar) {
+      return std::get<I>(columns_)[row];
+    } else {
+      FieldType<I> value;
+      std::memcpy(&value, rows_.data() + row * kRowBytes + Offset<I>(), sizeof(value));
+      return value;
+    }
+  }
+
+  template <size_t I>
+  void Set(size_t row, const FieldType<I> &value) {
+    if constexpr (L == Layout::kColumnar) {
+      std::get<I>(columns_)[row] = value;
+    } else {
+      std::memcpy(rows_.data() + row * kRowBytes + Offset<I>(), &value, sizeof(value));
+    }
+  }
+
+  // Calls f on field I of every record. For the columnar layout this is a
+  // tight loop over one contiguous array.
+  template <size_t I, typename F>
+  void ForEach(F f) const {
+    if constexpr (L == Layout::kColumnar) {
+      for (const FieldType<I> &value : std::get<I>(columns_)) {
+        f(value);
+      }
+    } else {
+      const char *p = rows_.data() + Offset<I>();
+      for (size_t row = 0; row < size_; row++, p += kRowBytes) {
+        FieldType<I> value;
+        std::memcpy(&value, p, sizeof(value));
+        f(value);
+      }
+    }
+  }
+
+ private:
+  // The byte offset of field I in a row, for the padded and packed layouts.
+  template <size_t I>
+  static constexpr size_t Offset() {
+    if constexpr (L == Layout::kPacked) {
+      return Fields::PackedOffsets()[I];
+    } else {
+      return Fields::PaddedOffsets()[I];
+    }
+  }
+
+  template <size_t... I>
+  void SetAll(size_t row, std::index_sequence<I...>, const Ts &...values) {
+    (Set<I>(row, values), ...);
+  }
+
+  template <size_t... I>
+  void ReserveColumns(size_t n, std::index_sequence<I...>) {
+    (std::get<I>(columns_).reserve(n), ...);
+  }
+
+  // Only one of these is used, depending on the layout. For padded and
+  // packed rows, a byte vector with rows of kRowBytes each; for columns, one
+  // vector per field.
+  std::vector<char> rows_;
+  std::tuple<std::vector<Ts>...> columns_;
+  size_t size_{0};
+};
+
+// PackedRecordsOf<L, Foo2<int, double>> is PackedRecords<L, int, double>.
+// This works for any class template whose template arguments are its field
+// types, like Foo2 and Abcdefghijklmnopqrstuvwxyz.
+template <Layout L, typename Record>
+struct PackedRecordsOfImpl;
+
+template <Layout L, template <typename...> class Record, typename... Ts>
+struct PackedRecordsOfImpl<L, Record<Ts...>> {
+  using type = PackedRecords<L, Ts...>;
+};
+
+template <Layout L, typename Record>
+using PackedRecordsOf = typename PackedRecordsOfImpl<L, Record>::type;
+
+// The compile-time work, checked at compile time.
+static_assert(PackedRecordsOf<Layout::kPadded, Foo2<int, double>>::kRowBytes == 16);
+static_assert(PackedRecordsOf<Layout::kPacked, Foo2<int, double>>::kRowBytes == 12);
+static_assert(PackedRecords<Layout::kPadded, char, double, int16_t>::kRowBytes == 24);
+// The padded layout matches what the compiler generates for a flat struct.
+struct IntCharCharInt {
+  int a;
+  char b;
+  char c;
+  int d;
+};
+static_assert(PackedRecords<Layout::kPadded, int, char, char, int>::kRowBytes == sizeof(IntCharCharInt));
+static_assert(PackedRecords<Layout::kPacked, char, double, int16_t>::kRowBytes == 11);
+static_assert(FieldLayout<char, double, int16_t>::PackedOrder()[0] == 1);
+
+const char *layout_name(Layout layout) {
+  const char *names[] = {"padded", "packed", "columnar"};
+  return names[static_cast<int>(layout)];
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Fills n Foo2<int, double>-shaped records and scans them.
+template <Layout L>
+void benchmark(size_t n) {
+  PackedRecordsOf<L, Foo2<int, double>> records;
+  records.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    records.push_back(static_cast<int>(i % 1000), static_cast<double>(i % 97) * 0.5);
+  }
+
+  const int reps = 5;
+  long long int_sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    records.template ForEach<0>([&](int x) { int_sum += x; });
+  }
+  double int_scan = seconds_since(start) / reps;
+
+  double all_sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    records.template ForEach<0>([&](int x) { all_sum += x; });
+    records.template ForEach<1>([&](double x) { all_sum += x; });
+  }
+  double all_scan = seconds_since(start) / reps;
+
+  std::cout << "  " << layout_name(L) << ":\t" << records.bytes() / (1 << 20) << " MB ("
+            << decltype(records)::kRowBytes << " B/record), scan int field "
+            << static_cast<double>(n) / int_scan / 1e6 << " M records/s, scan both fields "
+            << static_cast<double>(n) / all_scan / 1e6 << " M records/s (checksums " << int_sum / reps << ", "
+            << all_sum / reps << ")\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 10000000;
+
+  // First, the sizes the compiler picks for plain structs.
+  std::cout << "sizeof(Foo2<int, double>) = " << sizeof(Foo2<int, double>) << "\n";
+  std::cout << "sizeof(Abcdefghijklmnopqrstuvwxyz<char, double>) = "
+            << sizeof(Abcdefghijklmnopqrstuvwxyz<char, double>) << "\n";
+
+  // A small example. We store a few Foo2 objects in packed rows and read
+  // their fields back. Note that Get<1>() is the double, even though packed
+  // rows store it first.
+  PackedRecordsOf<Layout::kPacked, Foo2<int, double>> packed;
+  for (int i = 0; i < 3; i++) {
+    Foo2<int, double> c(i, i + 0.5);
+    packed.push_back_record(c, &Foo2<int, double>::GetVar1, &Foo2<int, double>::GetVar2);
+  }
+  for (size_t row = 0; row < packed.size(); row++) {
+    std::cout << "Row " << row << ": " << packed.Get<0>(row) << " and " << packed.Get<1>(row) << "\n";
+  }
+  std::cout << packed.size() << " packed Foo2<int, double> records use " << packed.bytes() << " bytes instead of "
+            << packed.size() * sizeof(Foo2<int, double>) << ".\n\n";
+
+  std::cout << n << " Foo2<int, double> records:\n";
+  benchmark<Layout::kPadded>(n);
+  benchmark<Layout::kPacked>(n);
+  benchmark<Layout::kColumnar>(n);
+  return 0;
+}
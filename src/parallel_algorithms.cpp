@@ -0,0 +1,464 @@
+/**
+ * @file parallel_algorithms.cpp
+ * @brief Tutorial code for chunked parallel algorithms (for_each, reduce,
+ * transform, merge sort and sample sort) running on a small thread pool.
+ */
+
+// vectors.cpp, sets.cpp and auto.cpp walk their containers with range-based
+// for loops, e.g. `for (Point &item : point_vector) item.SetY(445);`. That
+// uses one core. In this file we write parallel versions of the common
+// algorithms that work over any pair of random-access iterators, so they work
+// on std::vector, on plain arrays, and on "flat" sorted-vector sets.
+
+// All algorithms share three ideas:
+//   1. A ThreadPool with a fixed number of worker threads. Creating a
+//      std::thread costs tens of microseconds, so we create them once (like
+//      in mutex.cpp) and reuse them for every algorithm.
+//   2. Chunking. The input range is cut into chunks of `grain` elements. The
+//      threads grab chunks from a shared atomic counter until none are left,
+//      so a thread that finishes early simply takes more chunks (dynamic load
+//      balancing). The grain size heuristic below aims for several chunks per
+//      thread, but never chunks so small that scheduling costs dominate.
+//   3. The calling thread works too, instead of sleeping while it waits.
+
+// The benchmark runs every algorithm with 1, 2, 4, ..., 64 threads. Pass a
+// different element count as the first argument (default 10,000,000), and a
+// different maximum thread count as the second.
+
+// Includes std::sort, std::merge and friends.
+#include <algorithm>
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::sqrt, used as the per-element work in the benchmark.
+#include <cmath>
+// Includes the condition variable library header.
+#include <condition_variable>
+// Includes std::function, which holds the pool's tasks.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::iterator_traits and std::distance.
+#include <iterator>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::accumulate.
+#include <numeric>
+// Includes std::optional, for the partial results of parallel_reduce.
+#include <optional>
+// Includes std::queue, the pool's task queue.
+#include <queue>
+// Includes std::mt19937, used to generate the benchmark data.
+#include <random>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes the header for std::vector.
+#include <vector>
+
+// A fixed-size pool of worker threads. The only way to use it is ParallelFor,
+// which runs body(begin, end) over [0, n) in chunks of grain indices, and
+// returns once every chunk is done.
+class ThreadPool {
+ public:
+  // A pool of size threads, counting the calling thread. ThreadPool(1) has no
+  // workers and runs everything inline.
+  explicit ThreadPool(size_t threads) : threads_(threads == 0 ? 1 : threads) {
+    for (size_t i = 1; i < threads_; i++) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::scoped_lock lk(m_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t Size() const { return threads_; }
+
+  template <typename Body>
+  void ParallelFor(size_t n, size_t grain, Body body) {
+    if (grain == 0) {
+      grain = 1;
+    }
+    const size_t chunks = (n + grain - 1) / grain;
+    if (chunks <= 1 || threads_ == 1) {
+      if (n > 0) {
+        body(size_t{0}, n);
+      }
+      return;
+    }
+
+    // The shared state of this call: the next chunk to hand out, and how
+    // many helper tasks are still running. It lives on our stack, which is
+    // fine because we don't return until every helper is done with it.
+    std::atomic<size_t> next_chunk{0};
+    size_t helpers = std::min(threads_ - 1, chunks - 1);
+    size_t helpers_running = helpers;
+    std::mutex done_m;
+    std::condition_variable done_cv;
+
+    auto run_chunks = [&] {
+      for (size_t c = next_chunk.fetch_add(1); c < chunks; c = next_chunk.fetch_add(1)) {
+        size_t begin = c * grain;
+        body(begin, std::min(n, begin + grain));
+      }
+    };
+
+    {
+      std::scoped_lock lk(m_);
+      for (size_t i = 0; i < helpers; i++) {
+        tasks_.push([&] {
+          run_chunks();
+          std::scoped_lock done_lk(done_m);
+          if (--helpers_running == 0) {
+            done_cv.notify_one();
+          }
+        });
+      }
+    }
+    cv_.notify_all();
+
+    run_chunks();
+    std::unique_lock lk(done_m);
+    done_cv.wait(lk, [&] { return helpers_running == 0; });
+  }
+
+ private:
+  void WorkerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lk(m_);
+        cv_.wait(lk, [this] { return stopping_ || !tasks_.empty(); });
+        if (stopping_ && tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop();
+      }
+      task();
+    }
+  }
+
+  size_t threads_;
+  std::vector<std::thread> workers_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::queue<std::function<void()>> tasks_;
+  bool stopping_{false};
+};
+
+// The grain size heuristic. We want about 8 chunks per thread, so a slow
+// thread can be balanced out by the others, but at least min_grain elements
+// per chunk, so that grabbing a chunk (one atomic increment) stays cheap
+// compared to the work in it.
+inline size_t grain_size(size_t n, size_t threads, size_t min_grain = 4096) {
+  size_t target = n / (threads * 8);
+  return std::max(target, min_grain);
+}
+
+// Applies f to every element of [first, last), in parallel.
+template <typename RandomIt, typename F>
+void parallel_for_each(ThreadPool &pool, RandomIt first, RandomIt last, F f) {
+  size_t n = static_cast<size_t>(std::distance(first, last));
+  pool.ParallelFor(n, grain_size(n, pool.Size()), [&](size_t begin, size_t end) {
+    for (RandomIt it = first + begin; it != first + end; ++it) {
+      f(*it);
+    }
+  });
+}
+
+// Writes f(x) for every x in [first, last) to the range starting at out.
+template <typename RandomIt, typename OutIt, typename F>
+void parallel_transform(ThreadPool &pool, RandomIt first, RandomIt last, OutIt out, F f) {
+  size_t n = static_cast<size_t>(std::distance(first, last));
+  pool.ParallelFor(n, grain_size(n, pool.Size()), [&](size_t begin, size_t end) {
+    std::transform(first + begin, first + end, out + begin, f);
+  });
+}
+
+// Combines init and all elements of [first, last) with op. Like
+// std::reduce, op must be associative and accept both elements and partial
+// results: chunks are folded concurrently, each into its own slot so threads
+// never contend on a shared accumulator, and the partial results are then
+// combined in chunk order. The slots are std::optional because ParallelFor
+// may run the whole range as one call (on a single thread, or when it is
+// small), which fills only the first slot; empty slots are skipped rather
+// than folded in as T{}, which would be wrong for any op but addition.
+template <typename RandomIt, typename T, typename Op>
+T parallel_reduce(ThreadPool &pool, RandomIt first, RandomIt last, T init, Op op) {
+  size_t n = static_cast<size_t>(std::distance(first, last));
+  size_t grain = grain_size(n, pool.Size());
+  size_t chunks = (n + grain - 1) / grain;
+  std::vector<std::optional<T>> partials(chunks);
+  pool.ParallelFor(n, grain, [&](size_t begin, size_t end) {
+    T acc = first[begin];
+    for (size_t i = begin + 1; i < end; i++) {
+      acc = op(acc, first[i]);
+    }
+    partials[begin / grain] = acc;
+  });
+  T result = init;
+  for (const std::optional<T> &partial : partials) {
+    if (partial) {
+      result = op(result, *partial);
+    }
+  }
+  return result;
+}
+
+// Parallel merge sort, bottom up. First every chunk is sorted independently
+// with std::sort. Then sorted runs are merged pairwise, in rounds, until one
+// run is left; all merges of a round run in parallel. Each round ping-pongs
+// between the input and a scratch buffer.
+template <typename RandomIt, typename Compare = std::less<>>
+void parallel_merge_sort(ThreadPool &pool, RandomIt first, RandomIt last, Compare comp = Compare()) {
+  using T = typename std::iterator_traits<RandomIt>::value_type;
+  size_t n = static_cast<size_t>(std::distance(first, last));
+  size_t run = grain_size(n, pool.Size(), 1 << 14);
+  size_t runs = (n + run - 1) / run;
+  pool.ParallelFor(runs, 1, [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; r++) {
+      std::sort(first + r * run, first + std::min(n, (r + 1) * run), comp);
+    }
+  });
+
+  std::vector<T> scratch(n);
+  bool in_scratch = false;
+  for (; run < n; run *= 2) {
+    size_t pairs = (n + 2 * run - 1) / (2 * run);
+    pool.ParallelFor(pairs, 1, [&](size_t begin, size_t end) {
+      for (size_t p = begin; p < end; p++) {
+        size_t lo = p * 2 * run;
+        size_t mid = std::min(n, lo + run);
+        size_t hi = std::min(n, lo + 2 * run);
+        if (in_scratch) {
+          std::merge(std::make_move_iterator(scratch.begin() + lo), std::make_move_iterator(scratch.begin() + mid),
+                     std::make_move_iterator(scratch.begin() + mid), std::make_move_iterator(scratch.begin() + hi),
+                     first + lo, comp);
+        } else {
+          std::merge(std::make_move_iterator(first + lo), std::make_move_iterator(first + mid),
+                     std::make_move_iterator(first + mid), std::make_move_iterator(first + hi), scratch.begin() + lo,
+                     comp);
+        }
+      }
+    });
+    in_scratch = !in_scratch;
+  }
+  if (in_scratch) {
+    parallel_transform(pool, scratch.begin(), scratch.end(), first, [](T &x) { return std::move(x); });
+  }
+}
+
+// Parallel sample sort. Merge sort's last rounds have only a few merges, so
+// most threads sit idle. Sample sort splits the work differently:
+//   1. Pick splitters from a random sample, dividing the value range into
+//      one bucket per chunk of work.
+//   2. In parallel, every chunk counts how many of its elements fall into
+//      each bucket.
+//   3. A prefix sum over the counts tells every chunk where to write its
+//      elements for each bucket; in parallel, they scatter into a buffer.
+//   4. In parallel, sort each bucket. Buckets are already in order, so the
+//      buffer is now sorted.
+template <typename RandomIt, typename Compare = std::less<>>
+void parallel_sample_sort(ThreadPool &pool, RandomIt first, RandomIt last, Compare comp = Compare()) {
+  using T = typename std::iterator_traits<RandomIt>::value_type;
+  size_t n = static_cast<size_t>(std::distance(first, last));
+  size_t buckets = pool.Size() * 4;
+  if (n < buckets * 1024) {
+    parallel_merge_sort(pool, first, last, comp);
+    return;
+  }
+
+  // Step 1: oversample to get evenly sized buckets.
+  const size_t oversample = 32;
+  std::mt19937 gen(445);
+  std::uniform_int_distribution<size_t> pick(0, n - 1);
+  std::vector<T> sample(buckets * oversample);
+  for (T &s : sample) {
+    s = first[pick(gen)];
+  }
+  std::sort(sample.begin(), sample.end(), comp);
+  std::vector<T> splitters;
+  for (size_t b = 1; b < buckets; b++) {
+    splitters.push_back(sample[b * oversample]);
+  }
+  auto bucket_of = [&](const T &x) {
+    return static_cast<size_t>(std::upper_bound(splitters.begin(), splitters.end(), x, comp) - splitters.begin());
+  };
+
+  // Step 2: per-chunk bucket counts. We use one chunk per bucket.
+  size_t grain = (n + buckets - 1) / buckets;
+  size_t chunks = (n + grain - 1) / grain;
+  std::vector<size_t> counts(chunks * buckets, 0);
+  pool.ParallelFor(n, grain, [&](size_t begin, size_t end) {
+    size_t *my_counts = &counts[(begin / grain) * buckets];
+    for (size_t i = begin; i < end; i++) {
+      my_counts[bucket_of(first[i])]++;
+    }
+  });
+
+  // Step 3: exclusive prefix sum in bucket-major order, then scatter.
+  std::vector<size_t> offsets(chunks * buckets);
+  std::vector<size_t> bucket_start(buckets + 1);
+  size_t running = 0;
+  for (size_t b = 0; b < buckets; b++) {
+    bucket_start[b] = running;
+    for (size_t c = 0; c < chunks; c++) {
+      offsets[c * buckets + b] = running;
+      running += counts[c * buckets + b];
+    }
+  }
+  bucket_start[buckets] = n;
+  std::vector<T> buffer(n);
+  pool.ParallelFor(n, grain, [&](size_t begin, size_t end) {
+    size_t *my_offsets = &offsets[(begin / grain) * buckets];
+    for (size_t i = begin; i < end; i++) {
+      buffer[my_offsets[bucket_of(first[i])]++] = std::move(first[i]);
+    }
+  });
+
+  // Step 4: sort each bucket, moving it back into place.
+  pool.ParallelFor(buckets, 1, [&](size_t begin, size_t end) {
+    for (size_t b = begin; b < end; b++) {
+      std::sort(buffer.begin() + bucket_start[b], buffer.begin() + bucket_start[b + 1], comp);
+      std::move(buffer.begin() + bucket_start[b], buffer.begin() + bucket_start[b + 1], first + bucket_start[b]);
+    }
+  });
+}
+
+// A flat set: the elements of a std::set, but kept in one sorted std::vector
+// instead of a tree of nodes. Its iterators are random access, so all of the
+// algorithms above work on it directly. Building one is a parallel sort plus
+// removing duplicates.
+template <typename T>
+class FlatSet {
+ public:
+  FlatSet(ThreadPool &pool, std::vector<T> values) : values_(std::move(values)) {
+    parallel_sample_sort(pool, values_.begin(), values_.end());
+    values_.erase(std::unique(values_.begin(), values_.end()), values_.end());
+  }
+
+  bool Contains(const T &x) const { return std::binary_search(values_.begin(), values_.end(), x); }
+  size_t Size() const { return values_.size(); }
+
+  typename std::vector<T>::const_iterator begin() const { return values_.begin(); }
+  typename std::vector<T>::const_iterator end() const { return values_.end(); }
+
+ private:
+  std::vector<T> values_;
+};
+
+// The Point class from vectors.cpp, without the print statements in its
+// constructors.
+class Point {
+public:
+  Point() : x_(0), y_(0) {}
+  Point(int x, int y) : x_(x), y_(y) {}
+
+  inline int GetX() const { return x_; }
+  inline int GetY() const { return y_; }
+  inline void SetX(int x) { x_ = x; }
+  inline void SetY(int y) { y_ = y; }
+
+private:
+  int x_;
+  int y_;
+};
+
+// Runs fn once and returns the elapsed time in milliseconds.
+template <typename Fn>
+double time_ms(Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 10000000;
+  const size_t max_threads = argc > 2 ? std::stoull(argv[2]) : 64;
+
+  {
+    // A product on a single-thread pool: ParallelFor runs the whole range in
+    // one call, and the reduce must not fold in empty chunks as 0.
+    ThreadPool pool(1);
+    std::vector<long long> ones(10000, 1);
+    long long product = parallel_reduce(pool, ones.begin(), ones.end(), 1LL, std::multiplies<>());
+    std::cout << "Product of 10000 ones on 1 thread: " << product << (product == 1 ? "" : " (WRONG)") << "\n";
+  }
+
+  // The vectors.cpp loop, in parallel.
+  {
+    ThreadPool pool(4);
+    std::vector<Point> point_vector(100000, Point(35, 36));
+    parallel_for_each(pool, point_vector.begin(), point_vector.end(), [](Point &item) { item.SetY(445); });
+
+    // To sum a member of each element, transform first, then reduce.
+    std::vector<long long> ys(point_vector.size());
+    parallel_transform(pool, point_vector.begin(), point_vector.end(), ys.begin(),
+                       [](const Point &p) { return static_cast<long long>(p.GetY()); });
+    std::cout << "Sum of y values after SetY(445) on 100000 points: "
+              << parallel_reduce(pool, ys.begin(), ys.end(), 0LL, std::plus<>()) << "\n";
+
+    // A flat set built from a vector with duplicates, like sets.cpp's int_set.
+    std::vector<int> with_duplicates = {5, 1, 9, 3, 5, 7, 1, 10, 2, 8, 4, 6};
+    FlatSet<int> int_set(pool, with_duplicates);
+    std::cout << "Flat set:";
+    for (int x : int_set) {
+      std::cout << " " << x;
+    }
+    std::cout << "\nContains 9: " << (int_set.Contains(9) ? "yes" : "no") << "\n\n";
+  }
+
+  std::mt19937 gen(15445);
+  std::uniform_int_distribution<int> dist(0, 1 << 30);
+  std::vector<int> input(n);
+  for (int &x : input) {
+    x = dist(gen);
+  }
+  std::vector<int> expected = input;
+  double std_sort_ms = time_ms([&] { std::sort(expected.begin(), expected.end()); });
+  std::cout << "std::sort of " << n << " ints: " << std_sort_ms << " ms (hardware threads: "
+            << std::thread::hardware_concurrency() << ")\n";
+  std::cout << "threads  for_each  transform  reduce  merge_sort  sample_sort  (ms)\n";
+
+  std::vector<double> out(n);
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    ThreadPool pool(threads);
+
+    std::vector<double> values(input.begin(), input.end());
+    double for_each_ms = time_ms([&] {
+      parallel_for_each(pool, values.begin(), values.end(), [](double &x) { x = std::sqrt(x) * 1.5 + 1.0; });
+    });
+    double transform_ms = time_ms([&] {
+      parallel_transform(pool, values.begin(), values.end(), out.begin(), [](double x) { return std::sqrt(x); });
+    });
+    long long sum = 0;
+    double reduce_ms = time_ms([&] {
+      sum = parallel_reduce(pool, input.begin(), input.end(), 0LL, [](long long a, long long b) { return a + b; });
+    });
+
+    std::vector<int> merge_sorted = input;
+    double merge_ms = time_ms([&] { parallel_merge_sort(pool, merge_sorted.begin(), merge_sorted.end()); });
+    std::vector<int> sample_sorted = input;
+    double sample_ms = time_ms([&] { parallel_sample_sort(pool, sample_sorted.begin(), sample_sorted.end()); });
+
+    bool ok = merge_sorted == expected && sample_sorted == expected &&
+              sum == std::accumulate(input.begin(), input.end(), 0LL);
+    std::cout << threads << "\t " << for_each_ms << "\t   " << transform_ms << "\t      " << reduce_ms << "\t     "
+              << merge_ms << "\t\t" << sample_ms << (ok ? "" : "  WRONG RESULT") << "\n";
+  }
+  return 0;
+}
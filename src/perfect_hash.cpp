@@ -0,0 +1,340 @@
+/**
+ * @file perfect_hash.cpp
+ * @brief Tutorial code for a hash table of string keys that is built at
+ * compile time, with a perfect hash function that has no collisions.
+ */
+
+// auto.cpp builds a map with map.insert({{"andy", 445}, {"jignesh", 645}}).
+// The keys are written in the source code, so they are known at compile
+// time, and the map never changes afterwards. Still, the program allocates a
+// node per key at startup, and every lookup hashes the key, picks a bucket,
+// and walks a chain that may hold several keys.
+
+// For a fixed set of keys, we can do better: find a hash function that maps
+// every key to a different slot. Then a lookup hashes the key, reads one
+// slot, and compares one key. If the key at that slot is different, the key
+// isn't in the table. No chains, no probing, no loops.
+
+// Such a perfect hash function is found by search. We use "hash, displace
+// and compress" (CHD, Belazzougui et al., 2009), simplified:
+//   1. Hash every key once with a 64-bit hash h.
+//   2. Split the keys into small buckets by the high bits of h, about 4 keys
+//      per bucket.
+//   3. For each bucket, largest first, try seeds 1, 2, 3, ... until the
+//      slots mix(h + seed) of all its keys are distinct and still free, and
+//      remember the seed.
+// A lookup computes h, reads the seed of its bucket, and checks the slot
+// mix(h + seed). Large buckets go first, while the table is still empty and
+// they are easy to place. With at least 1.5 times as many slots as
+// keys (rounded up to a power of two), the search ends after a few tries
+// per bucket.
+
+// All of this is constexpr, so the compiler runs the search, and the table
+// is a constant in the executable: no startup cost, no heap. A duplicate
+// key, or a key set for which no seeds can be found, is a compile error.
+
+// The benchmark classifies words as C++ keywords (a lexer's job): half of
+// the lookups are keywords and half are ordinary identifiers. It compares
+// the perfect hash table with std::unordered_map and with binary search in a
+// sorted array, for 10,000,000 lookups (pass a different number as the first
+// argument).
+
+// Includes std::lower_bound.
+#include <algorithm>
+// Includes std::array.
+#include <array>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint32_t and uint64_t.
+#include <cstdint>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::mt19937_64.
+#include <random>
+// Includes std::logic_error and std::invalid_argument.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::string_view.
+#include <string_view>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes the header for std::vector.
+#include <vector>
+
+// FNV-1a, a simple hash that is easy to evaluate at compile time.
+constexpr uint64_t hash_string(std::string_view key) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (char c : key) {
+    h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Spreads the bits of h + seed over the whole word, so that each seed gives
+// the keys an unrelated set of slots.
+constexpr uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+constexpr size_t next_power_of_two(size_t n) {
+  size_t p = 1;
+  while (p < n) {
+    p *= 2;
+  }
+  return p;
+}
+
+template <typename V>
+struct Entry {
+  std::string_view key;
+  V value;
+};
+
+template <typename V, size_t N>
+class PerfectHashMap {
+ public:
+  // About 4 keys per bucket, and at least 1.5 slots per key.
+  static constexpr size_t kBuckets = next_power_of_two((N + 3) / 4);
+  static constexpr size_t kSlots = next_power_of_two(N + N / 2 + 1);
+
+  constexpr explicit PerfectHashMap(const Entry<V> (&entries)[N]) {
+    uint64_t hashes[N > 0 ? N : 1]{};
+    size_t bucket_sizes[kBuckets]{};
+    for (size_t i = 0; i < N; i++) {
+      hashes[i] = hash_string(entries[i].key);
+      bucket_sizes[Bucket(hashes[i])]++;
+      for (size_t j = 0; j < i; j++) {
+        if (entries[j].key == entries[i].key) {
+          throw std::invalid_argument("duplicate key in perfect hash map");
+        }
+      }
+    }
+
+    // Order the buckets from largest to smallest (insertion sort; the
+    // compiler does this, so simple is best).
+    size_t order[kBuckets]{};
+    for (size_t b = 0; b < kBuckets; b++) {
+      size_t i = b;
+      while (i > 0 && bucket_sizes[order[i - 1]] < bucket_sizes[b]) {
+        order[i] = order[i - 1];
+        i--;
+      }
+      order[i] = b;
+    }
+
+    for (size_t b : order) {
+      if (bucket_sizes[b] == 0) {
+        break;
+      }
+      size_t members[N > 0 ? N : 1]{};
+      size_t count = 0;
+      for (size_t i = 0; i < N; i++) {
+        if (Bucket(hashes[i]) == b) {
+          members[count++] = i;
+        }
+      }
+      seeds_[b] = FindSeed(hashes, members, count);
+      for (size_t m = 0; m < count; m++) {
+        Slot &slot = slots_[SlotIndex(hashes[members[m]], seeds_[b])];
+        slot.key_ = entries[members[m]].key;
+        slot.value_ = entries[members[m]].value;
+        slot.occupied_ = true;
+      }
+    }
+  }
+
+  // Returns the value for key, or nullptr. One hash, one slot, one compare.
+  constexpr const V *find(std::string_view key) const {
+    uint64_t h = hash_string(key);
+    const Slot &slot = slots_[SlotIndex(h, seeds_[Bucket(h)])];
+    return slot.occupied_ && slot.key_ == key ? &slot.value_ : nullptr;
+  }
+
+  constexpr bool contains(std::string_view key) const { return find(key) != nullptr; }
+  constexpr size_t size() const { return N; }
+
+ private:
+  struct Slot {
+    std::string_view key_;
+    V value_{};
+    bool occupied_ = false;
+  };
+
+  static constexpr size_t Bucket(uint64_t h) { return static_cast<size_t>(h >> 40) & (kBuckets - 1); }
+  static constexpr size_t SlotIndex(uint64_t h, uint32_t seed) {
+    return static_cast<size_t>(mix(h + seed)) & (kSlots - 1);
+  }
+
+  // Returns the first seed that puts every key of the bucket into a free
+  // slot of its own.
+  constexpr uint32_t FindSeed(const uint64_t *hashes, const size_t *members, size_t count) const {
+    for (uint32_t seed = 1; seed < kMaxSeed; seed++) {
+      bool ok = true;
+      for (size_t m = 0; m < count && ok; m++) {
+        size_t slot = SlotIndex(hashes[members[m]], seed);
+        ok = !slots_[slot].occupied_;
+        for (size_t other = 0; other < m && ok; other++) {
+          ok = SlotIndex(hashes[members[other]], seed) != slot;
+        }
+      }
+      if (ok) {
+        return seed;
+      }
+    }
+    throw std::logic_error("no perfect hash seed found");
+  }
+
+  static constexpr uint32_t kMaxSeed = 100000;
+
+  std::array<uint32_t, kBuckets> seeds_{};
+  std::array<Slot, kSlots> slots_{};
+};
+
+// Builds a PerfectHashMap from a list of {key, value} pairs, deducing the
+// number of keys: make_perfect_hash_map<int>({{"andy", 445}, ...}).
+template <typename V, size_t N>
+constexpr PerfectHashMap<V, N> make_perfect_hash_map(const Entry<V> (&entries)[N]) {
+  return PerfectHashMap<V, N>(entries);
+}
+
+// The sorted array for the comparison, also sorted at compile time.
+template <typename V, size_t N>
+constexpr std::array<Entry<V>, N> make_sorted_table(const Entry<V> (&entries)[N]) {
+  std::array<Entry<V>, N> table{};
+  for (size_t i = 0; i < N; i++) {
+    size_t j = i;
+    while (j > 0 && entries[i].key < table[j - 1].key) {
+      table[j] = table[j - 1];
+      j--;
+    }
+    table[j] = entries[i];
+  }
+  return table;
+}
+
+// The C++ keywords, numbered.
+constexpr Entry<int> kKeywordList[] = {
+    {"alignas", 0},       {"alignof", 1},        {"and", 2},          {"and_eq", 3},         {"asm", 4},
+    {"auto", 5},          {"bitand", 6},         {"bitor", 7},        {"bool", 8},           {"break", 9},
+    {"case", 10},         {"catch", 11},         {"char", 12},        {"char8_t", 13},       {"char16_t", 14},
+    {"char32_t", 15},     {"class", 16},         {"compl", 17},       {"concept", 18},       {"const", 19},
+    {"consteval", 20},    {"constexpr", 21},     {"constinit", 22},   {"const_cast", 23},    {"continue", 24},
+    {"co_await", 25},     {"co_return", 26},     {"co_yield", 27},    {"decltype", 28},      {"default", 29},
+    {"delete", 30},       {"do", 31},            {"double", 32},      {"dynamic_cast", 33},  {"else", 34},
+    {"enum", 35},         {"explicit", 36},      {"export", 37},      {"extern", 38},        {"false", 39},
+    {"float", 40},        {"for", 41},           {"friend", 42},      {"goto", 43},          {"if", 44},
+    {"inline", 45},       {"int", 46},           {"long", 47},        {"mutable", 48},       {"namespace", 49},
+    {"new", 50},          {"noexcept", 51},      {"not", 52},         {"not_eq", 53},        {"nullptr", 54},
+    {"operator", 55},     {"or", 56},            {"or_eq", 57},       {"private", 58},       {"protected", 59},
+    {"public", 60},       {"register", 61},      {"reinterpret_cast", 62}, {"requires", 63}, {"return", 64},
+    {"short", 65},        {"signed", 66},        {"sizeof", 67},      {"static", 68},        {"static_assert", 69},
+    {"static_cast", 70},  {"struct", 71},        {"switch", 72},      {"template", 73},      {"this", 74},
+    {"thread_local", 75}, {"throw", 76},         {"true", 77},        {"try", 78},           {"typedef", 79},
+    {"typeid", 80},       {"typename", 81},      {"union", 82},       {"unsigned", 83},      {"using", 84},
+    {"virtual", 85},      {"void", 86},          {"volatile", 87},    {"wchar_t", 88},       {"while", 89},
+    {"xor", 90},          {"xor_eq", 91},
+};
+
+constexpr auto kKeywords = make_perfect_hash_map(kKeywordList);
+constexpr auto kSortedKeywords = make_sorted_table(kKeywordList);
+
+// The table is usable in constant expressions too.
+static_assert(*kKeywords.find("constexpr") == 21, "constexpr is keyword 21");
+static_assert(!kKeywords.contains("jignesh"), "jignesh is not a keyword");
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns nanoseconds per lookup. The sum of the values found goes into
+// *checksum so that the compiler can't skip the lookups.
+template <typename Find>
+double lookup_ns(const std::vector<std::string> &words, size_t lookups, Find find, long *checksum) {
+  auto start = std::chrono::steady_clock::now();
+  long sum = 0;
+  for (size_t i = 0; i < lookups; i++) {
+    sum += find(words[i % words.size()]);
+  }
+  double ns = seconds_since(start) * 1e9 / static_cast<double>(lookups);
+  *checksum += sum;
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  const size_t lookups = argc > 1 ? std::stoull(argv[1]) : 10000000;
+
+  // The map from auto.cpp, built by the compiler.
+  constexpr auto map = make_perfect_hash_map<int>({{"andy", 445}, {"jignesh", 645}});
+  static_assert(*map.find("jignesh") == 645, "the lookup runs at compile time too");
+  for (std::string_view key : {"andy", "jignesh", "eggs"}) {
+    const int *value = map.find(key);
+    if (value != nullptr) {
+      std::cout << "(" << key << "," << *value << ") ";
+    } else {
+      std::cout << "(" << key << " not found) ";
+    }
+  }
+  std::cout << std::endl;
+
+  // The std::unordered_map has to be built at runtime.
+  auto start = std::chrono::steady_clock::now();
+  std::unordered_map<std::string, int> unordered;
+  for (const Entry<int> &entry : kKeywordList) {
+    unordered.insert({std::string(entry.key), entry.value});
+  }
+  double build_us = seconds_since(start) * 1e6;
+
+  // The words to look up: half keywords, half identifiers that aren't.
+  const char *identifiers[] = {"map",   "count", "value", "result", "it",     "key",  "index", "size",
+                               "data",  "begin", "end",   "vec",    "andy",   "i",    "j",     "node",
+                               "left",  "right", "next",  "prev",   "buffer", "self", "other", "jignesh"};
+  std::mt19937_64 rng(42);
+  std::vector<std::string> words;
+  for (int i = 0; i < 4096; i++) {
+    if (rng() % 2 == 0) {
+      words.emplace_back(kKeywordList[rng() % kKeywords.size()].key);
+    } else {
+      words.emplace_back(identifiers[rng() % (sizeof(identifiers) / sizeof(identifiers[0]))]);
+    }
+  }
+
+  long checksum = 0;
+  double perfect_ns = lookup_ns(
+      words, lookups,
+      [](const std::string &word) {
+        const int *value = kKeywords.find(word);
+        return value != nullptr ? *value : -1;
+      },
+      &checksum);
+  double unordered_ns = lookup_ns(
+      words, lookups,
+      [&](const std::string &word) {
+        auto it = unordered.find(word);
+        return it != unordered.end() ? it->second : -1;
+      },
+      &checksum);
+  double sorted_ns = lookup_ns(
+      words, lookups,
+      [](const std::string &word) {
+        std::string_view key = word;
+        auto it = std::lower_bound(kSortedKeywords.begin(), kSortedKeywords.end(), key,
+                                   [](const Entry<int> &entry, std::string_view k) { return entry.key < k; });
+        return it != kSortedKeywords.end() && it->key == key ? it->value : -1;
+      },
+      &checksum);
+
+  std::cout << kKeywords.size() << " keywords, " << kKeywords.kSlots << " slots, " << kKeywords.kBuckets
+            << " seeds; " << lookups << " lookups, half of them misses:\n"
+            << "  perfect hash table: " << perfect_ns << " ns per lookup, built by the compiler\n"
+            << "  std::unordered_map: " << unordered_ns << " ns per lookup, built in " << build_us
+            << " us at startup\n"
+            << "  sorted array:       " << sorted_ns << " ns per lookup\n"
+            << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,485 @@
+/**
+ * @file persistent_map.cpp
+ * @brief Tutorial code for a persistent hash map, where copying the map is
+ * O(1) and every change makes a new version that shares most of its memory
+ * with the old one.
+ */
+
+// auto.cpp shows that auto copy_int_values = int_values; copies the whole
+// vector. Copying a std::unordered_map is the same: every node is allocated
+// and copied again. A common reason to copy a map is to give a reader a
+// snapshot that won't change under it while writers go on; with a big map,
+// that copy costs milliseconds and doubles the memory, even if the writers
+// then change only a few keys.
+
+// A persistent map never changes once built. "Changing" it returns a new
+// map, which shares everything but the changed path with the old one. The
+// old map is still valid and unchanged, so a snapshot is just a copy of the
+// root pointer. We use a hash array mapped trie (HAMT, Bagwell, 2001), in
+// the compact CHAMP layout (Steindorfer and Vinju, 2015):
+//   - The key's hash is cut into 5-bit pieces. The root uses the first
+//     piece to pick one of 32 positions, the node below it the second
+//     piece, and so on. Since there are at most 32 positions per level, a
+//     map of n keys has about log32(n) levels: 4 levels for a million keys.
+//   - A node only stores the positions that are used. datamap_ has a bit
+//     for each position that holds a key directly, nodemap_ for each
+//     position that holds a child node, and the entries and children are
+//     packed in arrays in position order. The index of a position in its
+//     array is the number of set bits below it, one popcount instruction.
+//   - Inserting or erasing a key copies the nodes on the path from the root
+//     to it (about 4 small nodes) and shares all the others with the old
+//     version, through std::shared_ptr. Nodes nobody uses any more are
+//     freed by the reference counts.
+//   - Two keys whose 64-bit hashes are equal end up in a collision node at
+//     the bottom, which keeps a plain list.
+
+// Building a big map one persistent insert at a time copies a path per key,
+// most of which is garbage right away. A Transient is a mutable builder that
+// owns the nodes it creates (each node records its owner), and changes
+// those in place instead of copying them. transient() starts one from a
+// map, and persistent() hands out the result as a normal map; from then on,
+// the transient copies again before changing anything the map can see.
+
+// The benchmark (1,000,000 keys by default; pass a different number as the
+// first argument) compares building, memory per entry, lookups, taking a
+// snapshot, and keeping 10 versions that each differ by 1,000 updates, with
+// std::unordered_map<int, int> copies. Lookups are slower than in
+// std::unordered_map: each of the 4 levels is a dependent load of a node and
+// then of its packed array. That is the price of sharing.
+
+// Includes std::atomic, for the owner ids of transients.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint32_t and uint64_t.
+#include <cstdint>
+// Includes std::ifstream, to read /proc/self/statm.
+#include <fstream>
+// Includes std::hash.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::shared_ptr and std::make_shared.
+#include <memory>
+// Includes std::mt19937_64.
+#include <random>
+// Includes the C++ string library.
+#include <string>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes std::pair and std::move.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+template <typename K, typename V, typename Hash = std::hash<K>>
+class PersistentMap {
+  struct Node;
+  using NodePtr = std::shared_ptr<Node>;
+
+ public:
+  class Transient;
+
+  PersistentMap() = default;
+
+  const V *find(const K &key) const { return root_ ? Find(root_.get(), HashOf(key), key) : nullptr; }
+
+  // Returns a new map with key set to value. This map doesn't change.
+  PersistentMap insert(const K &key, const V &value) const {
+    bool added = false;
+    NodePtr root = Insert(root_ ? root_ : std::make_shared<Node>(), HashOf(key), 0, key, value, 0, &added);
+    return PersistentMap(std::move(root), size_ + added);
+  }
+
+  // Returns a new map without key. This map doesn't change.
+  PersistentMap erase(const K &key) const {
+    bool removed = false;
+    NodePtr root = root_ ? Erase(root_, HashOf(key), 0, key, 0, &removed) : root_;
+    return removed ? PersistentMap(std::move(root), size_ - 1) : *this;
+  }
+
+  size_t size() const { return size_; }
+
+  // Calls f(key, value) for every key, in no particular order.
+  template <typename F>
+  void for_each(F &&f) const {
+    if (root_) {
+      Visit(root_.get(), f);
+    }
+  }
+
+  Transient transient() const { return Transient(*this); }
+
+  // A mutable builder. Changes made through it are invisible to every map,
+  // including the one it started from, until persistent() is called.
+  class Transient {
+   public:
+    explicit Transient(const PersistentMap &map)
+        : root_(map.root_ ? map.root_ : std::make_shared<Node>()), size_(map.size_), owner_(NextOwner()) {}
+
+    // Move-only: a copy would share the owner id, and each copy would then
+    // change in place the nodes the other one still points to.
+    Transient(const Transient &) = delete;
+    Transient &operator=(const Transient &) = delete;
+    Transient(Transient &&) = default;
+    Transient &operator=(Transient &&) = default;
+
+    const V *find(const K &key) const { return Find(root_.get(), HashOf(key), key); }
+
+    void insert(const K &key, const V &value) {
+      bool added = false;
+      root_ = Insert(root_, HashOf(key), 0, key, value, owner_, &added);
+      size_ += added;
+    }
+
+    bool erase(const K &key) {
+      bool removed = false;
+      root_ = Erase(root_, HashOf(key), 0, key, owner_, &removed);
+      size_ -= removed;
+      return removed;
+    }
+
+    size_t size() const { return size_; }
+
+    // Returns the current contents as a map. The transient takes a new
+    // owner id, so that it never changes the nodes the map now shares.
+    PersistentMap persistent() {
+      owner_ = NextOwner();
+      return PersistentMap(root_, size_);
+    }
+
+   private:
+    NodePtr root_;
+    size_t size_;
+    uint64_t owner_;
+  };
+
+ private:
+  // owner_ is the id of the Transient that may change the node in place,
+  // or 0 if no one may.
+  struct Node {
+    uint32_t datamap_ = 0;
+    uint32_t nodemap_ = 0;
+    uint64_t owner_ = 0;
+    std::vector<std::pair<K, V>> entries_;
+    std::vector<NodePtr> children_;
+  };
+
+  // From this shift on, the hash is used up, and nodes are collision lists.
+  static constexpr int kHashBits = 64;
+
+  PersistentMap(NodePtr root, size_t size) : root_(std::move(root)), size_(size) {}
+
+  static uint64_t NextOwner() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1);
+  }
+
+  static uint64_t HashOf(const K &key) { return mix(Hash{}(key)); }
+  static uint32_t Bit(uint64_t hash, int shift) { return uint32_t{1} << ((hash >> shift) & 31); }
+  // The index of the position `bit` in the packed array for `map`.
+  static size_t Index(uint32_t map, uint32_t bit) { return static_cast<size_t>(__builtin_popcount(map & (bit - 1))); }
+
+  // Returns the node itself if the owner may change it, and otherwise a
+  // copy that the owner may change.
+  static NodePtr Editable(const NodePtr &node, uint64_t owner) {
+    if (owner != 0 && node->owner_ == owner) {
+      return node;
+    }
+    NodePtr copy = std::make_shared<Node>(*node);
+    copy->owner_ = owner;
+    return copy;
+  }
+
+  static const V *Find(const Node *node, uint64_t hash, const K &key) {
+    for (int shift = 0;; shift += 5) {
+      if (shift >= kHashBits) {
+        for (const auto &entry : node->entries_) {
+          if (entry.first == key) {
+            return &entry.second;
+          }
+        }
+        return nullptr;
+      }
+      uint32_t bit = Bit(hash, shift);
+      if (node->datamap_ & bit) {
+        const auto &entry = node->entries_[Index(node->datamap_, bit)];
+        return entry.first == key ? &entry.second : nullptr;
+      }
+      if (!(node->nodemap_ & bit)) {
+        return nullptr;
+      }
+      node = node->children_[Index(node->nodemap_, bit)].get();
+    }
+  }
+
+  // Makes a subtree holding two entries whose hashes agree below shift.
+  static NodePtr MakePair(const std::pair<K, V> &a, uint64_t hash_a, const std::pair<K, V> &b, uint64_t hash_b,
+                          int shift, uint64_t owner) {
+    NodePtr node = std::make_shared<Node>();
+    node->owner_ = owner;
+    if (shift >= kHashBits) {
+      node->entries_ = {a, b};
+      return node;
+    }
+    uint32_t bit_a = Bit(hash_a, shift);
+    uint32_t bit_b = Bit(hash_b, shift);
+    if (bit_a == bit_b) {
+      node->nodemap_ = bit_a;
+      node->children_.push_back(MakePair(a, hash_a, b, hash_b, shift + 5, owner));
+    } else {
+      node->datamap_ = bit_a | bit_b;
+      node->entries_ = bit_a < bit_b ? std::vector<std::pair<K, V>>{a, b} : std::vector<std::pair<K, V>>{b, a};
+    }
+    return node;
+  }
+
+  static NodePtr Insert(const NodePtr &node, uint64_t hash, int shift, const K &key, const V &value, uint64_t owner,
+                        bool *added) {
+    if (shift >= kHashBits) {
+      NodePtr edit = Editable(node, owner);
+      for (auto &entry : edit->entries_) {
+        if (entry.first == key) {
+          entry.second = value;
+          return edit;
+        }
+      }
+      edit->entries_.emplace_back(key, value);
+      *added = true;
+      return edit;
+    }
+    uint32_t bit = Bit(hash, shift);
+    if (node->datamap_ & bit) {
+      size_t i = Index(node->datamap_, bit);
+      if (node->entries_[i].first == key) {
+        NodePtr edit = Editable(node, owner);
+        edit->entries_[i].second = value;
+        return edit;
+      }
+      // Another key already has this position: move both into a new child.
+      NodePtr child =
+          MakePair(node->entries_[i], HashOf(node->entries_[i].first), {key, value}, hash, shift + 5, owner);
+      NodePtr edit = Editable(node, owner);
+      edit->entries_.erase(edit->entries_.begin() + i);
+      edit->datamap_ &= ~bit;
+      edit->children_.insert(edit->children_.begin() + Index(edit->nodemap_, bit), std::move(child));
+      edit->nodemap_ |= bit;
+      *added = true;
+      return edit;
+    }
+    if (node->nodemap_ & bit) {
+      size_t i = Index(node->nodemap_, bit);
+      NodePtr child = Insert(node->children_[i], hash, shift + 5, key, value, owner, added);
+      if (child == node->children_[i]) {
+        // The child was changed in place, so this node was too.
+        return node;
+      }
+      NodePtr edit = Editable(node, owner);
+      edit->children_[i] = std::move(child);
+      return edit;
+    }
+    NodePtr edit = Editable(node, owner);
+    edit->entries_.insert(edit->entries_.begin() + Index(edit->datamap_, bit), {key, value});
+    edit->datamap_ |= bit;
+    *added = true;
+    return edit;
+  }
+
+  static NodePtr Erase(const NodePtr &node, uint64_t hash, int shift, const K &key, uint64_t owner, bool *removed) {
+    if (shift >= kHashBits) {
+      for (size_t i = 0; i < node->entries_.size(); i++) {
+        if (node->entries_[i].first == key) {
+          NodePtr edit = Editable(node, owner);
+          edit->entries_.erase(edit->entries_.begin() + i);
+          *removed = true;
+          return edit;
+        }
+      }
+      return node;
+    }
+    uint32_t bit = Bit(hash, shift);
+    if (node->datamap_ & bit) {
+      size_t i = Index(node->datamap_, bit);
+      if (!(node->entries_[i].first == key)) {
+        return node;
+      }
+      NodePtr edit = Editable(node, owner);
+      edit->entries_.erase(edit->entries_.begin() + i);
+      edit->datamap_ &= ~bit;
+      *removed = true;
+      return edit;
+    }
+    if (!(node->nodemap_ & bit)) {
+      return node;
+    }
+    size_t i = Index(node->nodemap_, bit);
+    NodePtr child = Erase(node->children_[i], hash, shift + 5, key, owner, removed);
+    if (!*removed) {
+      return node;
+    }
+    NodePtr edit = Editable(node, owner);
+    if (child->children_.empty() && child->entries_.size() == 1) {
+      // A child with a single key is replaced by the key itself, so that
+      // every map with the same keys has the same shape.
+      edit->children_.erase(edit->children_.begin() + i);
+      edit->nodemap_ &= ~bit;
+      edit->entries_.insert(edit->entries_.begin() + Index(edit->datamap_, bit), child->entries_[0]);
+      edit->datamap_ |= bit;
+    } else {
+      edit->children_[i] = std::move(child);
+    }
+    return edit;
+  }
+
+  template <typename F>
+  static void Visit(const Node *node, F &f) {
+    for (const auto &entry : node->entries_) {
+      f(entry.first, entry.second);
+    }
+    for (const NodePtr &child : node->children_) {
+      Visit(child.get(), f);
+    }
+  }
+
+  NodePtr root_;
+  size_t size_ = 0;
+};
+
+// Resident memory of the process, from /proc/self/statm, or 0 where /proc
+// isn't available.
+long long resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  long long pages_virtual = 0;
+  long long pages_resident = 0;
+  statm >> pages_virtual >> pages_resident;
+  return pages_resident * 4096;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  const int n = argc > 1 ? std::stoi(argv[1]) : 1000000;
+
+  // The map from auto.cpp, with a snapshot that later changes don't touch.
+  PersistentMap<std::string, int> map = PersistentMap<std::string, int>().insert("andy", 445).insert("jignesh", 645);
+  auto snapshot = map;
+  map = map.insert("andy", 1).erase("jignesh");
+  auto print = [](const char *name, const PersistentMap<std::string, int> &m) {
+    std::cout << name << ":";
+    m.for_each([](const std::string &key, int value) { std::cout << " (" << key << "," << value << ")"; });
+    std::cout << std::endl;
+  };
+  print("Snapshot", snapshot);
+  print("Current", map);
+
+  std::mt19937_64 rng(42);
+  std::vector<int> keys(n);
+  for (int i = 0; i < n; i++) {
+    keys[i] = static_cast<int>(rng() >> 33);
+  }
+
+  // Building, and memory per entry.
+  long long before = resident_bytes();
+  auto start = std::chrono::steady_clock::now();
+  std::unordered_map<int, int> unordered;
+  for (int i = 0; i < n; i++) {
+    unordered[keys[i]] = i;
+  }
+  double unordered_build_ms = seconds_since(start) * 1e3;
+  long long unordered_bytes = resident_bytes() - before;
+
+  before = resident_bytes();
+  start = std::chrono::steady_clock::now();
+  PersistentMap<int, int>::Transient builder = PersistentMap<int, int>().transient();
+  for (int i = 0; i < n; i++) {
+    builder.insert(keys[i], i);
+  }
+  PersistentMap<int, int> persistent = builder.persistent();
+  double transient_build_ms = seconds_since(start) * 1e3;
+  long long persistent_bytes = resident_bytes() - before;
+
+  start = std::chrono::steady_clock::now();
+  PersistentMap<int, int> one_by_one;
+  for (int i = 0; i < n; i++) {
+    one_by_one = one_by_one.insert(keys[i], i);
+  }
+  double persistent_build_ms = seconds_since(start) * 1e3;
+
+  std::cout << persistent.size() << " keys (" << unordered.size() << " in std::unordered_map):\n"
+            << "  build: std::unordered_map " << unordered_build_ms << " ms, persistent map with a transient "
+            << transient_build_ms << " ms, one persistent insert at a time " << persistent_build_ms << " ms\n"
+            << "  memory: std::unordered_map " << static_cast<double>(unordered_bytes) / n
+            << " bytes per entry, persistent map " << static_cast<double>(persistent_bytes) / n
+            << " bytes per entry\n";
+
+  // Lookups.
+  long sum = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    sum += unordered.find(keys[rng() % n])->second;
+  }
+  double unordered_find_ns = seconds_since(start) * 1e9 / n;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    sum += *persistent.find(keys[rng() % n]);
+  }
+  double persistent_find_ns = seconds_since(start) * 1e9 / n;
+  std::cout << "  lookup: std::unordered_map " << unordered_find_ns << " ns, persistent map " << persistent_find_ns
+            << " ns\n";
+
+  // One snapshot.
+  start = std::chrono::steady_clock::now();
+  std::unordered_map<int, int> unordered_snapshot = unordered;
+  double unordered_snapshot_us = seconds_since(start) * 1e6;
+  start = std::chrono::steady_clock::now();
+  PersistentMap<int, int> persistent_snapshot = persistent;
+  double persistent_snapshot_us = seconds_since(start) * 1e6;
+  std::cout << "  snapshot: copying std::unordered_map " << unordered_snapshot_us << " us, persistent map "
+            << persistent_snapshot_us << " us\n";
+  unordered_snapshot.clear();
+
+  // Ten versions, each 1,000 updates after the one before.
+  const int versions = 10;
+  const int updates = 1000;
+  before = resident_bytes();
+  start = std::chrono::steady_clock::now();
+  std::vector<std::unordered_map<int, int>> unordered_versions{unordered};
+  for (int v = 1; v < versions; v++) {
+    unordered_versions.push_back(unordered_versions.back());
+    for (int u = 0; u < updates; u++) {
+      unordered_versions.back()[keys[rng() % n]] = v;
+    }
+  }
+  double unordered_versions_ms = seconds_since(start) * 1e3;
+  long long unordered_versions_bytes = resident_bytes() - before;
+
+  before = resident_bytes();
+  start = std::chrono::steady_clock::now();
+  std::vector<PersistentMap<int, int>> persistent_versions{persistent};
+  for (int v = 1; v < versions; v++) {
+    PersistentMap<int, int>::Transient next = persistent_versions.back().transient();
+    for (int u = 0; u < updates; u++) {
+      next.insert(keys[rng() % n], v);
+    }
+    persistent_versions.push_back(next.persistent());
+  }
+  double persistent_versions_ms = seconds_since(start) * 1e3;
+  long long persistent_versions_bytes = resident_bytes() - before;
+  std::cout << "  " << versions << " versions " << updates << " updates apart: std::unordered_map copies "
+            << unordered_versions_ms << " ms and " << unordered_versions_bytes / (1 << 20)
+            << " MB, persistent map " << persistent_versions_ms << " ms and " << persistent_versions_bytes / (1 << 20)
+            << " MB\n"
+            << "(checksum " << sum + *persistent_versions.back().find(keys[0]) << ")" << std::endl;
+  return 0;
+}
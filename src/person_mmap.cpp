@@ -0,0 +1,473 @@
+/**
+ * @file person_mmap.cpp
+ * @brief Tutorial code for zero-copy, memory-mapped persistence of the
+ * Person records from move_constructors.cpp.
+ */
+
+// In move_constructors.cpp, the Person class holds an age, a
+// std::vector<std::string> of nicknames and a validity flag. Loading a Person
+// from disk therefore means allocating one vector and one string per nickname
+// for every record, even if all we want to do is read the data once.
+
+// This file shows a different approach. We lay out Person records in a flat,
+// offset-based format on disk. Nothing in the file is a pointer; everything is
+// an offset relative to some base address. This means that we can mmap the
+// file and read the records in place through a small PersonView class, which
+// hands out std::string_view objects pointing directly into the mapped pages.
+// No deserialization step, and no heap allocation per record.
+
+// The on-disk layout looks like this:
+//   [FileHeader]
+//   [record 0][record 1] ... [record n - 1]   (variable length, 4-byte aligned)
+//   [index: n uint64_t offsets, one per record]
+// Each record is laid out as:
+//   [uint32_t age][uint32_t nickname count]
+//   [nickname count * NicknameEntry{offset from record start, length}]
+//   [nickname characters]
+// The index is written last, which lets PersonWriter stream records to disk
+// one at a time without knowing how many there will be.
+
+// This program writes N records (default 1,000,000; pass a different count as
+// the first argument, e.g. 50000000), then compares the time it takes to load
+// them through PersonView with the time it takes to construct Person objects.
+
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint32_t and uint64_t.
+#include <cstdint>
+// Includes std::memcpy.
+#include <cstring>
+// Includes std::ofstream and std::ifstream, used by the writer and the
+// baseline loader.
+#include <fstream>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::size.
+#include <iterator>
+// Includes std::runtime_error, thrown when a file cannot be written, mapped
+// or is corrupt, and std::out_of_range.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes std::string_view, the non-owning string type handed out by
+// PersonView.
+#include <string_view>
+// Includes the utility header for std::move.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// Includes the POSIX headers for open, fstat, mmap and munmap.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// This is the Person class from move_constructors.cpp, minus the print
+// statements in the move constructor and move assignment operator (printing
+// 50M times would dominate the benchmark). It is the "deserialize everything"
+// baseline that PersonView is compared against.
+class Person {
+public:
+  Person() : age_(0), nicknames_({}), valid_(true) {}
+
+  Person(uint32_t age, std::vector<std::string> &&nicknames)
+      : age_(age), nicknames_(std::move(nicknames)), valid_(true) {}
+
+  Person(Person &&person)
+      : age_(person.age_), nicknames_(std::move(person.nicknames_)),
+        valid_(true) {
+    person.valid_ = false;
+  }
+
+  Person &operator=(Person &&other) {
+    age_ = other.age_;
+    nicknames_ = std::move(other.nicknames_);
+    valid_ = true;
+    other.valid_ = false;
+    return *this;
+  }
+
+  Person(const Person &) = delete;
+  Person &operator=(const Person &) = delete;
+
+  uint32_t GetAge() const { return age_; }
+  size_t GetNicknameCount() const { return nicknames_.size(); }
+  const std::string &GetNicknameAtI(size_t i) const { return nicknames_[i]; }
+
+private:
+  uint32_t age_;
+  std::vector<std::string> nicknames_;
+  bool valid_;
+};
+
+// The file header. The magic number lets the reader reject files that were
+// not written by PersonWriter, and index_offset tells it where the per-record
+// offsets start.
+struct FileHeader {
+  uint64_t magic_;
+  uint64_t count_;
+  uint64_t index_offset_;
+};
+
+// Describes where one nickname lives, relative to the start of its record.
+struct NicknameEntry {
+  uint32_t offset_;
+  uint32_t length_;
+};
+
+constexpr uint64_t kPersonFileMagic = 0x314e4f5352455000ULL;  // "\0PERSON1"
+
+// Rounds n up to the next multiple of 4, so every record (and therefore every
+// uint32_t inside it) stays 4-byte aligned in the mapped file.
+inline uint64_t align4(uint64_t n) { return (n + 3) & ~uint64_t{3}; }
+
+// PersonView is a read-only window onto one record in the mapped file. It is
+// just a pointer, so it is trivially copyable and costs nothing to create.
+// Note that GetNicknameAtI returns a std::string_view, not a std::string&:
+// the characters are never copied out of the mapping.
+class PersonView {
+public:
+  // record points at the record; end is where the record area ends (the
+  // start of the index). Nothing is read past end, so a corrupt record
+  // throws instead of reading outside the file.
+  PersonView(const char *record, const char *end) : record_(record), size_(static_cast<size_t>(end - record)) {
+    if (size_ < 2 * sizeof(uint32_t)) {
+      throw std::runtime_error("PersonView: record is out of bounds");
+    }
+  }
+
+  uint32_t GetAge() const { return ReadU32(0); }
+  size_t GetNicknameCount() const { return ReadU32(sizeof(uint32_t)); }
+
+  std::string_view GetNicknameAtI(size_t i) const {
+    size_t entry_offset = 2 * sizeof(uint32_t) + i * sizeof(NicknameEntry);
+    if (entry_offset + sizeof(NicknameEntry) > size_) {
+      throw std::runtime_error("PersonView: nickname entry is out of bounds");
+    }
+    NicknameEntry entry;
+    std::memcpy(&entry, record_ + entry_offset, sizeof(entry));
+    // Both fields are 32 bits, so their sum can't overflow a size_t.
+    if (size_t{entry.offset_} + entry.length_ > size_) {
+      throw std::runtime_error("PersonView: nickname is out of bounds");
+    }
+    return std::string_view(record_ + entry.offset_, entry.length_);
+  }
+
+private:
+  // We use std::memcpy instead of a reinterpret_cast to read fields out of
+  // the raw bytes. The compiler turns this into a single load, and it avoids
+  // undefined behavior from type punning.
+  uint32_t ReadU32(size_t offset) const {
+    uint32_t value;
+    std::memcpy(&value, record_ + offset, sizeof(value));
+    return value;
+  }
+
+  const char *record_;
+  size_t size_;
+};
+
+// Checks a header against the size of the file it came from: the index must
+// start after the header and fit in the file. count_ is compared by
+// dividing, so a corrupt count can't overflow the check.
+bool ValidHeader(const FileHeader &header, size_t file_size) {
+  return header.magic_ == kPersonFileMagic && header.index_offset_ >= sizeof(FileHeader) &&
+         header.index_offset_ <= file_size &&
+         header.count_ <= (file_size - header.index_offset_) / sizeof(uint64_t);
+}
+
+// Returns a view of record i of a file image that starts at base, after
+// checking that the record starts between the header and the index.
+PersonView RecordAt(const char *base, const FileHeader &header, size_t i) {
+  uint64_t offset;
+  std::memcpy(&offset, base + header.index_offset_ + i * sizeof(uint64_t), sizeof(offset));
+  if (offset < sizeof(FileHeader) || offset > header.index_offset_) {
+    throw std::runtime_error("Person file: record offset is out of bounds");
+  }
+  return PersonView(base + offset, base + header.index_offset_);
+}
+
+// PersonWriter streams records to a file one at a time. Each Append call
+// writes a complete record, and only the 8-byte offset of the record is kept
+// in memory. Finish writes the index and patches the header at the front of
+// the file.
+class PersonWriter {
+public:
+  explicit PersonWriter(const std::string &path)
+      : out_(path, std::ios::binary | std::ios::trunc), offset_(sizeof(FileHeader)) {
+    if (!out_) {
+      throw std::runtime_error("PersonWriter: cannot open " + path);
+    }
+    // Reserve space for the header; it is filled in by Finish.
+    FileHeader placeholder{};
+    out_.write(reinterpret_cast<const char *>(&placeholder), sizeof(placeholder));
+  }
+
+  // Destructors must not throw, so a writer that is destroyed without an
+  // explicit Finish call does its best and swallows write errors.
+  ~PersonWriter() {
+    if (!finished_) {
+      try {
+        Finish();
+      } catch (const std::runtime_error &) {
+      }
+    }
+  }
+
+  PersonWriter(const PersonWriter &) = delete;
+  PersonWriter &operator=(const PersonWriter &) = delete;
+
+  // Appends one record. Accepting a range of string_views means the caller
+  // can write from a Person, a PersonView or string literals alike.
+  template <typename Nicknames>
+  void Append(uint32_t age, const Nicknames &nicknames) {
+    index_.push_back(offset_);
+
+    uint32_t count = static_cast<uint32_t>(std::size(nicknames));
+    uint32_t chars_offset = static_cast<uint32_t>(2 * sizeof(uint32_t) + count * sizeof(NicknameEntry));
+
+    // Build the record in a reusable scratch buffer, then write it in one go.
+    scratch_.clear();
+    AppendBytes(&age, sizeof(age));
+    AppendBytes(&count, sizeof(count));
+    uint32_t next = chars_offset;
+    for (const auto &nickname : nicknames) {
+      std::string_view sv(nickname);
+      NicknameEntry entry{next, static_cast<uint32_t>(sv.size())};
+      AppendBytes(&entry, sizeof(entry));
+      next += entry.length_;
+    }
+    for (const auto &nickname : nicknames) {
+      std::string_view sv(nickname);
+      AppendBytes(sv.data(), sv.size());
+    }
+    scratch_.resize(align4(scratch_.size()), '\0');
+
+    out_.write(scratch_.data(), static_cast<std::streamsize>(scratch_.size()));
+    offset_ += scratch_.size();
+  }
+
+  void Append(const Person &person) {
+    std::vector<std::string_view> nicknames;
+    for (size_t i = 0; i < person.GetNicknameCount(); i++) {
+      nicknames.push_back(person.GetNicknameAtI(i));
+    }
+    Append(person.GetAge(), nicknames);
+  }
+
+  // Writes the index and the header. After this, the file can be opened by
+  // PersonFile.
+  void Finish() {
+    finished_ = true;
+    out_.write(reinterpret_cast<const char *>(index_.data()),
+               static_cast<std::streamsize>(index_.size() * sizeof(uint64_t)));
+    FileHeader header{kPersonFileMagic, index_.size(), offset_};
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out_.close();
+    if (!out_) {
+      throw std::runtime_error("PersonWriter: write failed");
+    }
+  }
+
+private:
+  void AppendBytes(const void *src, size_t n) {
+    const char *bytes = static_cast<const char *>(src);
+    scratch_.insert(scratch_.end(), bytes, bytes + n);
+  }
+
+  std::ofstream out_;
+  uint64_t offset_;
+  std::vector<uint64_t> index_;
+  std::vector<char> scratch_;
+  bool finished_{false};
+};
+
+// PersonFile owns the mapping. Opening it is O(1) regardless of the number of
+// records: we validate the header, and the kernel pages in the rest of the
+// file lazily as records are touched. Like the Person class, it is move-only,
+// because two owners of the same mapping would both call munmap.
+class PersonFile {
+public:
+  explicit PersonFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("PersonFile: cannot open " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+      close(fd);
+      throw std::runtime_error("PersonFile: " + path + " is too small");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file, so we can close the
+    // descriptor right away.
+    close(fd);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("PersonFile: mmap failed for " + path);
+    }
+    base_ = static_cast<const char *>(addr);
+
+    std::memcpy(&header_, base_, sizeof(header_));
+    if (!ValidHeader(header_, size_)) {
+      munmap(const_cast<char *>(base_), size_);
+      throw std::runtime_error("PersonFile: " + path + " is not a Person file");
+    }
+  }
+
+  ~PersonFile() {
+    if (base_ != nullptr) {
+      munmap(const_cast<char *>(base_), size_);
+    }
+  }
+
+  PersonFile(PersonFile &&other) : base_(other.base_), size_(other.size_), header_(other.header_) {
+    other.base_ = nullptr;
+  }
+  PersonFile(const PersonFile &) = delete;
+  PersonFile &operator=(const PersonFile &) = delete;
+  PersonFile &operator=(PersonFile &&) = delete;
+
+  size_t Size() const { return header_.count_; }
+
+  // Random access to record i goes through the index at the end of the file.
+  PersonView operator[](size_t i) const {
+    if (i >= header_.count_) {
+      throw std::out_of_range("PersonFile: record index out of range");
+    }
+    return RecordAt(base_, header_, i);
+  }
+
+  // Tells the kernel we are about to read the whole file front to back, so it
+  // can read ahead aggressively.
+  void AdviseSequential() const { madvise(const_cast<char *>(base_), size_, MADV_SEQUENTIAL); }
+
+private:
+  const char *base_{nullptr};
+  size_t size_{0};
+  FileHeader header_{};
+};
+
+// The baseline: read the same file with plain reads and build a
+// std::vector<Person>, allocating a vector and strings for every record. This
+// is what "loading Person records from disk" costs today.
+std::vector<Person> load_persons(const std::string &path) {
+  // One read into a buffer of the file's size, rather than growing a vector
+  // one character at a time.
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) {
+    throw std::runtime_error("load_persons: cannot open " + path);
+  }
+  std::vector<char> bytes(static_cast<size_t>(in.tellg()));
+  in.seekg(0);
+  if (!in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()))) {
+    throw std::runtime_error("load_persons: cannot read " + path);
+  }
+  FileHeader header;
+  if (bytes.size() < sizeof(header)) {
+    throw std::runtime_error("load_persons: " + path + " is too small");
+  }
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (!ValidHeader(header, bytes.size())) {
+    throw std::runtime_error("load_persons: " + path + " is not a Person file");
+  }
+
+  std::vector<Person> persons;
+  persons.reserve(header.count_);
+  for (uint64_t i = 0; i < header.count_; i++) {
+    PersonView view = RecordAt(bytes.data(), header, i);
+    std::vector<std::string> nicknames;
+    nicknames.reserve(view.GetNicknameCount());
+    for (size_t j = 0; j < view.GetNicknameCount(); j++) {
+      nicknames.emplace_back(view.GetNicknameAtI(j));
+    }
+    persons.emplace_back(view.GetAge(), std::move(nicknames));
+  }
+  return persons;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  const uint64_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+  const std::string path = argc > 2 ? argv[2] : "persons.bin";
+
+  // First, a small example. We write andy from move_constructors.cpp to the
+  // file and read him back through a PersonView.
+  {
+    PersonWriter writer(path);
+    Person andy(15445, {"andy", "pavlo"});
+    writer.Append(andy);
+    writer.Finish();
+
+    PersonFile file(path);
+    PersonView view = file[0];
+    std::cout << "Read back age " << view.GetAge() << " with nicknames:";
+    for (size_t i = 0; i < view.GetNicknameCount(); i++) {
+      std::cout << " " << view.GetNicknameAtI(i);
+    }
+    std::cout << std::endl;
+  }
+
+  // Now the benchmark. The writer streams records straight to disk, so the
+  // only per-record memory it keeps is the 8-byte index entry.
+  std::cout << "Writing " << n << " Person records to " << path << "...\n";
+  auto start = std::chrono::steady_clock::now();
+  {
+    const std::string_view names[] = {"andy", "pavlo", "jignesh", "patel", "abigale", "kim", "bustub", "database"};
+    PersonWriter writer(path);
+    std::vector<std::string_view> nicknames;
+    for (uint64_t i = 0; i < n; i++) {
+      nicknames.clear();
+      for (uint64_t j = 0; j < 1 + i % 3; j++) {
+        nicknames.push_back(names[(i + j) % 8]);
+      }
+      writer.Append(static_cast<uint32_t>(i % 100), nicknames);
+    }
+    writer.Finish();
+  }
+  std::cout << "  write: " << seconds_since(start) << " s\n";
+
+  // Loading through PersonView: mmap the file and walk every record. We sum
+  // the ages and nickname lengths so the compiler can't skip the reads.
+  start = std::chrono::steady_clock::now();
+  uint64_t view_checksum = 0;
+  {
+    PersonFile file(path);
+    file.AdviseSequential();
+    for (size_t i = 0; i < file.Size(); i++) {
+      PersonView view = file[i];
+      view_checksum += view.GetAge();
+      for (size_t j = 0; j < view.GetNicknameCount(); j++) {
+        view_checksum += view.GetNicknameAtI(j).size();
+      }
+    }
+  }
+  double view_time = seconds_since(start);
+
+  // Loading into Person objects: same walk, but every record is materialized
+  // as a Person with its own vector and strings.
+  start = std::chrono::steady_clock::now();
+  uint64_t person_checksum = 0;
+  {
+    std::vector<Person> persons = load_persons(path);
+    for (const Person &person : persons) {
+      person_checksum += person.GetAge();
+      for (size_t j = 0; j < person.GetNicknameCount(); j++) {
+        person_checksum += person.GetNicknameAtI(j).size();
+      }
+    }
+  }
+  double person_time = seconds_since(start);
+
+  std::cout << "  load via mmap + PersonView: " << view_time << " s (checksum " << view_checksum << ")\n";
+  std::cout << "  load via Person objects:    " << person_time << " s (checksum " << person_checksum << ")\n";
+  std::cout << "  speedup: " << person_time / view_time << "x" << std::endl;
+
+  unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,806 @@
+/**
+ * @file radix_tree.cpp
+ * @brief Tutorial code for an adaptive radix tree: an ordered map from
+ * strings to values that supports prefix queries.
+ */
+
+// The keys in unordered_maps.cpp are strings like "jignesh", "garlic rice"
+// and "bacon". std::unordered_map keeps them in no particular order, so a
+// question like "which keys start with "gar"?" means looking at every key.
+// std::map keeps them sorted, but every step down its binary tree compares
+// whole strings and jumps to a node somewhere else in memory.
+
+// A radix tree (or trie) instead uses the key's bytes as the path: the root
+// picks a child by the first byte, that child picks by the second byte, and
+// so on. A lookup reads each byte of the key once and never compares whole
+// keys until the end, and all the keys that start with "gar" sit in one
+// subtree. Two ideas keep it small and fast (Leis et al., "The Adaptive
+// Radix Tree", 2013):
+//   - Adaptive nodes. A node picks one of four layouts by how many children
+//     it has: Node4 and Node16 keep up to 4 or 16 sorted key bytes next to
+//     their child pointers, Node48 keeps a 256-entry byte index into 48
+//     child pointers, and Node256 is a plain array of 256 children. Nodes
+//     grow and shrink between the layouts as children come and go. Node16
+//     compares the wanted byte against all 16 key bytes with one SSE2
+//     instruction.
+//   - Path compression. A chain of nodes with one child each is merged into
+//     the node below it, which keeps the skipped bytes in prefix_. A key
+//     that is the only one down a path is stored as a leaf right away,
+//     instead of one node per remaining byte.
+// A key can end at an inner node ("foo" when "foobar" is also there); such
+// a key is kept in the node's terminal_ leaf. Children are visited in byte
+// order after the terminal leaf, which is the same order std::map uses for
+// std::string keys.
+
+// The benchmark inserts 1,000,000 keys like "spam:12345" (pass a different
+// number as the first argument) into RadixTree, std::map and
+// std::unordered_map, then compares point lookups, ordered iteration, and
+// prefix queries against a full scan of the unordered map and a lower_bound
+// scan of std::map.
+
+// Includes std::min.
+#include <algorithm>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint8_t.
+#include <cstdint>
+// Includes std::memset.
+#include <cstring>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the map container library header, for the comparison.
+#include <map>
+// Includes std::mt19937_64.
+#include <random>
+// Includes the C++ string library.
+#include <string>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes the header for std::vector.
+#include <vector>
+
+#if defined(__SSE2__)
+// Includes _mm_cmpeq_epi8 and _mm_movemask_epi8.
+#include <emmintrin.h>
+#endif
+
+template <typename V>
+class RadixTree {
+ public:
+  RadixTree() = default;
+  RadixTree(const RadixTree &) = delete;
+  RadixTree &operator=(const RadixTree &) = delete;
+  ~RadixTree() { Free(root_); }
+
+  // Returns false, and overwrites the value, if the key was already there.
+  bool insert(const std::string &key, const V &value) {
+    bool inserted = Insert(root_, key, 0, value);
+    size_ += inserted;
+    return inserted;
+  }
+
+  const V *find(const std::string &key) const {
+    const Node *node = root_;
+    size_t depth = 0;
+    while (node != nullptr) {
+      if (node->type_ == Type::kLeaf) {
+        const Leaf *leaf = static_cast<const Leaf *>(node);
+        return leaf->key_ == key ? &leaf->value_ : nullptr;
+      }
+      const Inner *inner = static_cast<const Inner *>(node);
+      if (key.compare(depth, inner->prefix_.size(), inner->prefix_) != 0) {
+        return nullptr;
+      }
+      depth += inner->prefix_.size();
+      if (depth == key.size()) {
+        return inner->terminal_ != nullptr ? &inner->terminal_->value_ : nullptr;
+      }
+      Node *const *child = FindChild(inner, static_cast<uint8_t>(key[depth]));
+      if (child == nullptr) {
+        return nullptr;
+      }
+      node = *child;
+      depth++;
+    }
+    return nullptr;
+  }
+
+  bool erase(const std::string &key) {
+    bool erased = Erase(root_, key, 0);
+    size_ -= erased;
+    return erased;
+  }
+
+  size_t size() const { return size_; }
+
+  // Calls f(key, value) for every key, in sorted order.
+  template <typename F>
+  void for_each(F &&f) const {
+    if (root_ != nullptr) {
+      Visit(root_, f);
+    }
+  }
+
+  // Calls f(key, value) for every key that starts with prefix, in sorted
+  // order. Only the subtree below the prefix is visited.
+  template <typename F>
+  void for_each_with_prefix(const std::string &prefix, F &&f) const {
+    const Node *node = root_;
+    size_t depth = 0;
+    while (node != nullptr) {
+      if (node->type_ == Type::kLeaf) {
+        const Leaf *leaf = static_cast<const Leaf *>(node);
+        if (leaf->key_.compare(0, prefix.size(), prefix) == 0) {
+          f(leaf->key_, leaf->value_);
+        }
+        return;
+      }
+      const Inner *inner = static_cast<const Inner *>(node);
+      size_t n = std::min(prefix.size() - depth, inner->prefix_.size());
+      if (prefix.compare(depth, n, inner->prefix_, 0, n) != 0) {
+        return;
+      }
+      if (depth + inner->prefix_.size() >= prefix.size()) {
+        Visit(node, f);
+        return;
+      }
+      depth += inner->prefix_.size();
+      Node *const *child = FindChild(inner, static_cast<uint8_t>(prefix[depth]));
+      if (child == nullptr) {
+        return;
+      }
+      node = *child;
+      depth++;
+    }
+  }
+
+ private:
+  enum class Type : uint8_t { kLeaf, kNode4, kNode16, kNode48, kNode256 };
+
+  struct Node {
+    explicit Node(Type type) : type_(type) {}
+    Type type_;
+  };
+
+  struct Leaf : Node {
+    Leaf(const std::string &key, const V &value) : Node(Type::kLeaf), key_(key), value_(value) {}
+    std::string key_;
+    V value_;
+  };
+
+  struct Inner : Node {
+    using Node::Node;
+    uint16_t count_ = 0;
+    std::string prefix_;
+    Leaf *terminal_ = nullptr;
+  };
+
+  struct Node4 : Inner {
+    Node4() : Inner(Type::kNode4) {}
+    uint8_t keys_[4]{};
+    Node *children_[4]{};
+  };
+
+  struct Node16 : Inner {
+    Node16() : Inner(Type::kNode16) {}
+    uint8_t keys_[16]{};
+    Node *children_[16]{};
+  };
+
+  // index_[b] is 0 if there is no child for byte b, and otherwise one more
+  // than the child's position in children_.
+  struct Node48 : Inner {
+    Node48() : Inner(Type::kNode48) { std::memset(index_, 0, sizeof(index_)); }
+    uint8_t index_[256];
+    Node *children_[48]{};
+  };
+
+  struct Node256 : Inner {
+    Node256() : Inner(Type::kNode256) {}
+    Node *children_[256]{};
+  };
+
+  // Deletes one node as its real type; the node types have no virtual
+  // destructor, to keep them small.
+  static void Delete(Node *node) {
+    switch (node->type_) {
+      case Type::kLeaf:
+        delete static_cast<Leaf *>(node);
+        break;
+      case Type::kNode4:
+        delete static_cast<Node4 *>(node);
+        break;
+      case Type::kNode16:
+        delete static_cast<Node16 *>(node);
+        break;
+      case Type::kNode48:
+        delete static_cast<Node48 *>(node);
+        break;
+      case Type::kNode256:
+        delete static_cast<Node256 *>(node);
+        break;
+    }
+  }
+
+  // Deletes a whole subtree.
+  static void Free(Node *node) {
+    if (node == nullptr) {
+      return;
+    }
+    if (node->type_ != Type::kLeaf) {
+      Inner *inner = static_cast<Inner *>(node);
+      Free(inner->terminal_);
+      ForEachChild(inner, [](Node *child) { Free(child); });
+    }
+    Delete(node);
+  }
+
+  // Calls f(child) for every child of an inner node, in byte order.
+  template <typename F>
+  static void ForEachChild(const Inner *node, F &&f) {
+    switch (node->type_) {
+      case Type::kNode4: {
+        const Node4 *n = static_cast<const Node4 *>(node);
+        for (int i = 0; i < n->count_; i++) {
+          f(n->children_[i]);
+        }
+        break;
+      }
+      case Type::kNode16: {
+        const Node16 *n = static_cast<const Node16 *>(node);
+        for (int i = 0; i < n->count_; i++) {
+          f(n->children_[i]);
+        }
+        break;
+      }
+      case Type::kNode48: {
+        const Node48 *n = static_cast<const Node48 *>(node);
+        for (int b = 0; b < 256; b++) {
+          if (n->index_[b] != 0) {
+            f(n->children_[n->index_[b] - 1]);
+          }
+        }
+        break;
+      }
+      case Type::kNode256: {
+        const Node256 *n = static_cast<const Node256 *>(node);
+        for (int b = 0; b < 256; b++) {
+          if (n->children_[b] != nullptr) {
+            f(n->children_[b]);
+          }
+        }
+        break;
+      }
+      case Type::kLeaf:
+        break;
+    }
+  }
+
+  template <typename F>
+  static void Visit(const Node *node, F &f) {
+    if (node->type_ == Type::kLeaf) {
+      const Leaf *leaf = static_cast<const Leaf *>(node);
+      f(leaf->key_, leaf->value_);
+      return;
+    }
+    const Inner *inner = static_cast<const Inner *>(node);
+    if (inner->terminal_ != nullptr) {
+      f(inner->terminal_->key_, inner->terminal_->value_);
+    }
+    ForEachChild(inner, [&f](const Node *child) { Visit(child, f); });
+  }
+
+  static int Node16Index(const Node16 *node, uint8_t b) {
+#if defined(__SSE2__)
+    __m128i matches = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(b)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(node->keys_)));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(matches)) & ((1u << node->count_) - 1);
+    return mask != 0 ? __builtin_ctz(mask) : -1;
+#else
+    for (int i = 0; i < node->count_; i++) {
+      if (node->keys_[i] == b) {
+        return i;
+      }
+    }
+    return -1;
+#endif
+  }
+
+  // Returns the slot holding the child for byte b, or nullptr.
+  static Node *const *FindChild(const Inner *node, uint8_t b) {
+    switch (node->type_) {
+      case Type::kNode4: {
+        const Node4 *n = static_cast<const Node4 *>(node);
+        for (int i = 0; i < n->count_; i++) {
+          if (n->keys_[i] == b) {
+            return &n->children_[i];
+          }
+        }
+        return nullptr;
+      }
+      case Type::kNode16: {
+        const Node16 *n = static_cast<const Node16 *>(node);
+        int i = Node16Index(n, b);
+        return i >= 0 ? &n->children_[i] : nullptr;
+      }
+      case Type::kNode48: {
+        const Node48 *n = static_cast<const Node48 *>(node);
+        return n->index_[b] != 0 ? &n->children_[n->index_[b] - 1] : nullptr;
+      }
+      case Type::kNode256: {
+        const Node256 *n = static_cast<const Node256 *>(node);
+        return n->children_[b] != nullptr ? &n->children_[b] : nullptr;
+      }
+      case Type::kLeaf:
+        break;
+    }
+    return nullptr;
+  }
+
+  // Adds a child to a Node4 or Node16 that has room, keeping keys_ sorted.
+  template <typename N>
+  static void InsertSorted(N *node, uint8_t b, Node *child) {
+    int i = node->count_;
+    while (i > 0 && node->keys_[i - 1] > b) {
+      node->keys_[i] = node->keys_[i - 1];
+      node->children_[i] = node->children_[i - 1];
+      i--;
+    }
+    node->keys_[i] = b;
+    node->children_[i] = child;
+    node->count_++;
+  }
+
+  // Closes the gap left by the child for byte b in a Node4 or Node16. The
+  // caller updates count_.
+  template <typename N>
+  static void RemoveSorted(N *node, uint8_t b) {
+    int i = 0;
+    while (node->keys_[i] != b) {
+      i++;
+    }
+    for (; i + 1 < node->count_; i++) {
+      node->keys_[i] = node->keys_[i + 1];
+      node->children_[i] = node->children_[i + 1];
+    }
+  }
+
+  // Moves count_, prefix_ and terminal_ to a node of another layout.
+  static void MoveHeader(Inner *from, Inner *to) {
+    to->count_ = from->count_;
+    to->prefix_ = std::move(from->prefix_);
+    to->terminal_ = from->terminal_;
+  }
+
+  // Puts a leaf into a fresh Node4, either as the node's terminal leaf or as
+  // a child, depending on whether its key ends at depth.
+  static void Place(Node4 *node, Leaf *leaf, size_t depth) {
+    if (leaf->key_.size() == depth) {
+      node->terminal_ = leaf;
+    } else {
+      InsertSorted(node, static_cast<uint8_t>(leaf->key_[depth]), leaf);
+    }
+  }
+
+  // Adds a child for byte b. If the node is full, it is replaced by the next
+  // larger layout, and ref, the parent's pointer to it, is updated.
+  static void AddChild(Node *&ref, Inner *node, uint8_t b, Node *child) {
+    switch (node->type_) {
+      case Type::kNode4: {
+        Node4 *n = static_cast<Node4 *>(node);
+        if (n->count_ < 4) {
+          InsertSorted(n, b, child);
+          return;
+        }
+        Node16 *bigger = new Node16();
+        MoveHeader(n, bigger);
+        std::copy(n->keys_, n->keys_ + 4, bigger->keys_);
+        std::copy(n->children_, n->children_ + 4, bigger->children_);
+        delete n;
+        ref = bigger;
+        InsertSorted(bigger, b, child);
+        return;
+      }
+      case Type::kNode16: {
+        Node16 *n = static_cast<Node16 *>(node);
+        if (n->count_ < 16) {
+          InsertSorted(n, b, child);
+          return;
+        }
+        Node48 *bigger = new Node48();
+        MoveHeader(n, bigger);
+        for (int i = 0; i < 16; i++) {
+          bigger->index_[n->keys_[i]] = static_cast<uint8_t>(i + 1);
+          bigger->children_[i] = n->children_[i];
+        }
+        delete n;
+        ref = bigger;
+        AddChild(ref, bigger, b, child);
+        return;
+      }
+      case Type::kNode48: {
+        Node48 *n = static_cast<Node48 *>(node);
+        if (n->count_ < 48) {
+          int slot = 0;
+          while (n->children_[slot] != nullptr) {
+            slot++;
+          }
+          n->index_[b] = static_cast<uint8_t>(slot + 1);
+          n->children_[slot] = child;
+          n->count_++;
+          return;
+        }
+        Node256 *bigger = new Node256();
+        MoveHeader(n, bigger);
+        for (int i = 0; i < 256; i++) {
+          if (n->index_[i] != 0) {
+            bigger->children_[i] = n->children_[n->index_[i] - 1];
+          }
+        }
+        delete n;
+        ref = bigger;
+        AddChild(ref, bigger, b, child);
+        return;
+      }
+      case Type::kNode256: {
+        Node256 *n = static_cast<Node256 *>(node);
+        n->children_[b] = child;
+        n->count_++;
+        return;
+      }
+      case Type::kLeaf:
+        return;
+    }
+  }
+
+  // Forgets the child for byte b (the caller has already deleted or moved
+  // it), then shrinks the node if it got small.
+  static void RemoveChild(Node *&ref, Inner *node, uint8_t b) {
+    switch (node->type_) {
+      case Type::kNode4:
+        RemoveSorted(static_cast<Node4 *>(node), b);
+        break;
+      case Type::kNode16:
+        RemoveSorted(static_cast<Node16 *>(node), b);
+        break;
+      case Type::kNode48: {
+        Node48 *n = static_cast<Node48 *>(node);
+        n->children_[n->index_[b] - 1] = nullptr;
+        n->index_[b] = 0;
+        break;
+      }
+      case Type::kNode256:
+        static_cast<Node256 *>(node)->children_[b] = nullptr;
+        break;
+      case Type::kLeaf:
+        return;
+    }
+    node->count_--;
+    Shrink(ref, node);
+  }
+
+  // Switches to the next smaller layout when a node has become much emptier
+  // than it needs to be (with some slack, so that a node at the boundary
+  // doesn't flip back and forth), and collapses a Node4 that no longer has a
+  // reason to exist.
+  static void Shrink(Node *&ref, Inner *node) {
+    switch (node->type_) {
+      case Type::kNode256: {
+        if (node->count_ >= 37) {
+          return;
+        }
+        Node256 *n = static_cast<Node256 *>(node);
+        Node48 *smaller = new Node48();
+        MoveHeader(n, smaller);
+        int slot = 0;
+        for (int b = 0; b < 256; b++) {
+          if (n->children_[b] != nullptr) {
+            smaller->children_[slot] = n->children_[b];
+            smaller->index_[b] = static_cast<uint8_t>(++slot);
+          }
+        }
+        delete n;
+        ref = smaller;
+        return;
+      }
+      case Type::kNode48: {
+        if (node->count_ >= 12) {
+          return;
+        }
+        Node48 *n = static_cast<Node48 *>(node);
+        Node16 *smaller = new Node16();
+        MoveHeader(n, smaller);
+        int i = 0;
+        for (int b = 0; b < 256; b++) {
+          if (n->index_[b] != 0) {
+            smaller->keys_[i] = static_cast<uint8_t>(b);
+            smaller->children_[i] = n->children_[n->index_[b] - 1];
+            i++;
+          }
+        }
+        delete n;
+        ref = smaller;
+        return;
+      }
+      case Type::kNode16: {
+        if (node->count_ >= 3) {
+          return;
+        }
+        Node16 *n = static_cast<Node16 *>(node);
+        Node4 *smaller = new Node4();
+        MoveHeader(n, smaller);
+        std::copy(n->keys_, n->keys_ + n->count_, smaller->keys_);
+        std::copy(n->children_, n->children_ + n->count_, smaller->children_);
+        delete n;
+        ref = smaller;
+        return;
+      }
+      case Type::kNode4: {
+        Node4 *n = static_cast<Node4 *>(node);
+        if (n->count_ == 0) {
+          // Only the terminal leaf (if any) is left, and a leaf can stand
+          // in for the node.
+          ref = n->terminal_;
+          delete n;
+        } else if (n->count_ == 1 && n->terminal_ == nullptr) {
+          // Merge the node into its only child: the child's prefix grows by
+          // this node's prefix and the byte that led to the child.
+          Node *child = n->children_[0];
+          if (child->type_ != Type::kLeaf) {
+            Inner *inner = static_cast<Inner *>(child);
+            inner->prefix_ = n->prefix_ + static_cast<char>(n->keys_[0]) + inner->prefix_;
+          }
+          ref = child;
+          delete n;
+        }
+        return;
+      }
+      case Type::kLeaf:
+        return;
+    }
+  }
+
+  static bool Insert(Node *&ref, const std::string &key, size_t depth, const V &value) {
+    if (ref == nullptr) {
+      ref = new Leaf(key, value);
+      return true;
+    }
+    if (ref->type_ == Type::kLeaf) {
+      Leaf *leaf = static_cast<Leaf *>(ref);
+      if (leaf->key_ == key) {
+        leaf->value_ = value;
+        return false;
+      }
+      // Two keys now share this path: replace the leaf by a node whose
+      // prefix is what the keys have in common.
+      size_t common = depth;
+      while (common < key.size() && common < leaf->key_.size() && key[common] == leaf->key_[common]) {
+        common++;
+      }
+      Node4 *node = new Node4();
+      node->prefix_ = key.substr(depth, common - depth);
+      Place(node, leaf, common);
+      Place(node, new Leaf(key, value), common);
+      ref = node;
+      return true;
+    }
+    Inner *node = static_cast<Inner *>(ref);
+    size_t matched = 0;
+    while (matched < node->prefix_.size() && depth + matched < key.size() &&
+           node->prefix_[matched] == key[depth + matched]) {
+      matched++;
+    }
+    if (matched < node->prefix_.size()) {
+      // The key leaves the compressed path in the middle: split the prefix
+      // with a new node above this one.
+      Node4 *parent = new Node4();
+      parent->prefix_ = node->prefix_.substr(0, matched);
+      uint8_t b = static_cast<uint8_t>(node->prefix_[matched]);
+      node->prefix_.erase(0, matched + 1);
+      InsertSorted(parent, b, node);
+      Place(parent, new Leaf(key, value), depth + matched);
+      ref = parent;
+      return true;
+    }
+    depth += node->prefix_.size();
+    if (depth == key.size()) {
+      if (node->terminal_ != nullptr) {
+        node->terminal_->value_ = value;
+        return false;
+      }
+      node->terminal_ = new Leaf(key, value);
+      return true;
+    }
+    uint8_t b = static_cast<uint8_t>(key[depth]);
+    Node *const *child = FindChild(node, b);
+    if (child != nullptr) {
+      return Insert(*const_cast<Node **>(child), key, depth + 1, value);
+    }
+    AddChild(ref, node, b, new Leaf(key, value));
+    return true;
+  }
+
+  static bool Erase(Node *&ref, const std::string &key, size_t depth) {
+    if (ref == nullptr) {
+      return false;
+    }
+    if (ref->type_ == Type::kLeaf) {
+      if (static_cast<Leaf *>(ref)->key_ != key) {
+        return false;
+      }
+      Delete(ref);
+      ref = nullptr;
+      return true;
+    }
+    Inner *node = static_cast<Inner *>(ref);
+    if (key.compare(depth, node->prefix_.size(), node->prefix_) != 0) {
+      return false;
+    }
+    depth += node->prefix_.size();
+    if (depth == key.size()) {
+      if (node->terminal_ == nullptr) {
+        return false;
+      }
+      Delete(node->terminal_);
+      node->terminal_ = nullptr;
+      Shrink(ref, node);
+      return true;
+    }
+    uint8_t b = static_cast<uint8_t>(key[depth]);
+    Node *const *child = FindChild(node, b);
+    if (child == nullptr || !Erase(*const_cast<Node **>(child), key, depth + 1)) {
+      return false;
+    }
+    if (*child == nullptr) {
+      RemoveChild(ref, node, b);
+    }
+    return true;
+  }
+
+  Node *root_ = nullptr;
+  size_t size_ = 0;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns nanoseconds per lookup, and adds the values found to *checksum so
+// that the compiler can't skip the lookups.
+template <typename Find>
+double lookup_ns(const std::vector<std::string> &probes, Find find, long *checksum) {
+  auto start = std::chrono::steady_clock::now();
+  long sum = 0;
+  for (const std::string &probe : probes) {
+    sum += find(probe);
+  }
+  double ns = seconds_since(start) * 1e9 / static_cast<double>(probes.size());
+  *checksum += sum;
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+  // The keys from unordered_maps.cpp, in a radix tree.
+  RadixTree<int> tree;
+  tree.insert("foo", 2);
+  tree.insert("jignesh", 445);
+  tree.insert("spam", 1);
+  tree.insert("eggs", 2);
+  tree.insert("garlic rice", 3);
+  tree.insert("garlic", 4);
+  tree.insert("bacon", 5);
+  tree.insert("spam", 15);
+  const int *result = tree.find("jignesh");
+  if (result != nullptr) {
+    std::cout << "Found key jignesh with value " << *result << std::endl;
+  }
+  tree.erase("eggs");
+  std::cout << "In order:";
+  tree.for_each([](const std::string &key, int value) { std::cout << " " << key << "=" << value; });
+  std::cout << "\nStarting with \"gar\":";
+  tree.for_each_with_prefix("gar", [](const std::string &key, int) { std::cout << " " << key; });
+  std::cout << std::endl;
+
+  // The benchmark keys, like "spam:12345", in five families.
+  const char *families[] = {"bacon:", "eggs:", "garlic rice:", "jignesh:", "spam:"};
+  std::mt19937_64 rng(42);
+  std::vector<std::string> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    keys.push_back(families[rng() % 5] + std::to_string(rng() % 100000000));
+  }
+
+  RadixTree<int> art;
+  std::map<std::string, int> ordered;
+  std::unordered_map<std::string, int> unordered;
+  unordered.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    art.insert(keys[i], static_cast<int>(i));
+    ordered[keys[i]] = static_cast<int>(i);
+    unordered[keys[i]] = static_cast<int>(i);
+  }
+
+  // Check the tree against std::map: same keys, same order.
+  std::vector<std::string> sorted;
+  sorted.reserve(art.size());
+  art.for_each([&](const std::string &key, int) { sorted.push_back(key); });
+  auto same_key = [](const std::string &a, const std::pair<const std::string, int> &b) { return a == b.first; };
+  bool same_order =
+      sorted.size() == ordered.size() && std::equal(sorted.begin(), sorted.end(), ordered.begin(), same_key);
+  std::cout << art.size() << " distinct keys; ordered iteration matches std::map: " << (same_order ? "yes" : "no")
+            << "\n";
+
+  // Point lookups of random keys, all present.
+  std::vector<std::string> probes;
+  probes.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    probes.push_back(keys[rng() % n]);
+  }
+  long checksum = 0;
+  std::cout << "Point lookups:\n  std::unordered_map: "
+            << lookup_ns(probes, [&](const std::string &k) { return unordered.find(k)->second; }, &checksum)
+            << " ns\n  std::map: "
+            << lookup_ns(probes, [&](const std::string &k) { return ordered.find(k)->second; }, &checksum)
+            << " ns\n  RadixTree: " << lookup_ns(probes, [&](const std::string &k) { return *art.find(k); }, &checksum)
+            << " ns\n";
+
+  // Ordered iteration.
+  auto start = std::chrono::steady_clock::now();
+  long sum = 0;
+  for (const auto &[key, value] : ordered) {
+    sum += value;
+  }
+  double map_ms = seconds_since(start) * 1e3;
+  start = std::chrono::steady_clock::now();
+  art.for_each([&](const std::string &, int value) { sum += value; });
+  double art_ms = seconds_since(start) * 1e3;
+  std::cout << "Ordered iteration over all keys: std::map " << map_ms << " ms, RadixTree " << art_ms << " ms\n";
+
+  // Prefix queries like "spam:123". The full scan is so slow that it only
+  // gets a few queries.
+  std::vector<std::string> prefixes;
+  for (int i = 0; i < 1000; i++) {
+    prefixes.push_back(families[rng() % 5] + std::to_string(100 + rng() % 900));
+  }
+  size_t matches = 0;
+  const size_t scan_queries = 10;
+  start = std::chrono::steady_clock::now();
+  for (size_t q = 0; q < scan_queries; q++) {
+    for (const auto &[key, value] : unordered) {
+      matches += key.compare(0, prefixes[q].size(), prefixes[q]) == 0;
+    }
+  }
+  double scan_us = seconds_since(start) * 1e6 / scan_queries;
+  start = std::chrono::steady_clock::now();
+  for (const std::string &prefix : prefixes) {
+    for (auto it = ordered.lower_bound(prefix); it != ordered.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+      matches++;
+    }
+  }
+  double map_us = seconds_since(start) * 1e6 / prefixes.size();
+  start = std::chrono::steady_clock::now();
+  for (const std::string &prefix : prefixes) {
+    art.for_each_with_prefix(prefix, [&](const std::string &, int) { matches++; });
+  }
+  double art_us = seconds_since(start) * 1e6 / prefixes.size();
+  std::cout << "Prefix queries:\n  std::unordered_map full scan: " << scan_us
+            << " us\n  std::map lower_bound: " << map_us << " us\n  RadixTree: " << art_us << " us per query\n";
+
+  // Erase every other key, and check the rest.
+  for (size_t i = 0; i < n; i += 2) {
+    art.erase(keys[i]);
+    ordered.erase(keys[i]);
+  }
+  size_t wrong = 0;
+  for (size_t i = 0; i < n; i++) {
+    const int *value = art.find(keys[i]);
+    auto it = ordered.find(keys[i]);
+    wrong += (value == nullptr) != (it == ordered.end()) || (value != nullptr && *value != it->second);
+  }
+  std::cout << "After erasing half: " << art.size() << " keys, " << wrong << " mismatches with std::map"
+            << " (checksum " << checksum + sum + static_cast<long>(matches) << ")" << std::endl;
+  return 0;
+}
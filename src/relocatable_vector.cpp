@@ -0,0 +1,495 @@
+/**
+ * @file relocatable_vector.cpp
+ * @brief Tutorial code for trivially relocatable types, and a vector that
+ * grows with memcpy instead of calling move constructors.
+ */
+
+// When a std::vector runs out of capacity, it allocates a bigger buffer and
+// then, for every element, calls the move constructor into the new buffer and
+// the destructor on the old element. For the Person class in
+// move_constructors.cpp, that is one call to Person(Person &&) per element
+// (which prints a line and flips valid_), followed by one call to ~Person().
+
+// For many move-only types, this dance is pointless. IntPtrManager from
+// wrapper_class.cpp and Pointer<T> from spring2024/s24_my_ptr.cpp each hold a
+// single pointer. "Move-construct into the new slot, then destroy the old slot"
+// has exactly the same effect as copying the bytes of the object and then
+// forgetting about the old bytes. Types where this is true are called
+// "trivially relocatable". Nothing in the type system (as of C++23) tells us
+// that a type is trivially relocatable, so we add our own trait that types opt
+// into, and a vector, RelocatingVector, that uses memcpy/memmove to grow,
+// insert and erase when the trait is true.
+
+// Be careful: not every type is trivially relocatable! A type that stores a
+// pointer to itself (or into itself) breaks if its bytes are moved. The most
+// famous example is std::string in libstdc++, which points into its own
+// small-string buffer. That is why the opt-in for Person below goes through a
+// layout check of its members instead of just asserting "yes".
+
+// This program compares RelocatingVector with std::vector on push_back growth
+// and on inserting into the middle, for IntPtrManager, Pointer<int> and
+// Person. Pass a different element count as the first argument to change the
+// benchmark size (default 1,000,000).
+
+// Includes std::rotate, used by the non-relocatable insert path.
+#include <algorithm>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint32_t.
+#include <cstdint>
+// Includes std::memcpy and std::memmove.
+#include <cstring>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::allocator, std::unique_ptr and std::default_delete.
+#include <memory>
+// Includes the C++ string library.
+#include <string>
+// Includes std::is_trivially_copyable and friends.
+#include <type_traits>
+// Includes the utility header for std::move.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// The trait. By default, a type is trivially relocatable exactly when it is
+// trivially copyable (ints, pointers, plain structs). Other types opt in by
+// specializing this template, just like FooSpecial<float> specializes
+// FooSpecial<T> in templated_classes.cpp.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// The customary _v shorthand that every standard type trait has.
+template <typename T>
+inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+// std::unique_ptr with the default deleter is a single pointer, so it is
+// trivially relocatable.
+template <typename T>
+struct is_trivially_relocatable<std::unique_ptr<T>> : std::true_type {};
+
+// std::vector is three pointers into a heap buffer in libstdc++ and libc++, so
+// its bytes can be moved freely regardless of its element type (the elements
+// live on the heap and don't move). MSVC's debug builds keep a proxy object
+// that points back at the vector, so we only opt in elsewhere.
+#if !defined(_MSC_VER)
+template <typename T>
+struct is_trivially_relocatable<std::vector<T>> : std::true_type {};
+#endif
+
+// Helper for the layout check: true when every listed member type is
+// trivially relocatable.
+template <typename... Members>
+inline constexpr bool members_trivially_relocatable_v = (is_trivially_relocatable_v<Members> && ...);
+
+// IntPtrManager from wrapper_class.cpp, unchanged.
+class IntPtrManager {
+  public:
+    IntPtrManager() {
+      ptr_ = new int;
+      *ptr_ = 0;
+    }
+
+    IntPtrManager(int val) {
+      ptr_ = new int;
+      *ptr_ = val;
+    }
+
+    ~IntPtrManager() {
+      if (ptr_) {
+        delete ptr_;
+      }
+    }
+
+    IntPtrManager(IntPtrManager&& other) {
+      ptr_ = other.ptr_;
+      other.ptr_ = nullptr;
+    }
+
+    IntPtrManager &operator=(IntPtrManager &&other) {
+      if (ptr_ == other.ptr_) {
+        return *this;
+      }
+      if (ptr_) {
+        delete ptr_;
+      }
+      ptr_ = other.ptr_;
+      other.ptr_ = nullptr;
+      return *this;
+    }
+
+    IntPtrManager(const IntPtrManager &) = delete;
+    IntPtrManager &operator=(const IntPtrManager &) = delete;
+
+    void SetVal(int val) {
+      *ptr_ = val;
+    }
+
+    int GetVal() const {
+      return *ptr_;
+    }
+
+  private:
+    int *ptr_;
+};
+
+// IntPtrManager holds nothing but an int*, so we opt it in.
+template <>
+struct is_trivially_relocatable<IntPtrManager> : std::true_type {};
+
+// Pointer<T> from spring2024/s24_my_ptr.cpp, minus the print statements (we
+// create millions of them below).
+template <typename T>
+class Pointer {
+ public:
+  Pointer() : ptr_(new T()) {}
+  Pointer(T val) : ptr_(new T(val)) {}
+  ~Pointer() { delete ptr_; }
+
+  Pointer(const Pointer<T> &) = delete;
+  Pointer<T> &operator=(const Pointer<T> &) = delete;
+
+  Pointer(Pointer<T> &&another) : ptr_(another.ptr_) { another.ptr_ = nullptr; }
+  Pointer<T> &operator=(Pointer<T> &&another) {
+    if (ptr_ == another.ptr_) {
+      return *this;
+    }
+    delete ptr_;
+    ptr_ = another.ptr_;
+    another.ptr_ = nullptr;
+    return *this;
+  }
+
+  T &operator*() { return *ptr_; }
+  T get_val() const { return *ptr_; }
+
+ private:
+  T *ptr_;
+};
+
+// Pointer<T> owns a T* and nothing else, so every Pointer<T> is opted in.
+template <typename T>
+struct is_trivially_relocatable<Pointer<T>> : std::true_type {};
+
+// Counts calls to Person's move constructor, so the demo can show how many
+// times std::vector calls it while growing. This replaces the print statement
+// in move_constructors.cpp.
+size_t person_move_constructions = 0;
+
+// The Person class from move_constructors.cpp, with the print in the move
+// constructor replaced by the counter above.
+class Person {
+public:
+  Person() : age_(0), nicknames_({}), valid_(true) {}
+
+  Person(uint32_t age, std::vector<std::string> &&nicknames)
+      : age_(age), nicknames_(std::move(nicknames)), valid_(true) {}
+
+  Person(Person &&person)
+      : age_(person.age_), nicknames_(std::move(person.nicknames_)),
+        valid_(true) {
+    person_move_constructions += 1;
+    person.valid_ = false;
+  }
+
+  Person &operator=(Person &&other) {
+    age_ = other.age_;
+    nicknames_ = std::move(other.nicknames_);
+    valid_ = true;
+    other.valid_ = false;
+    return *this;
+  }
+
+  Person(const Person &) = delete;
+  Person &operator=(const Person &) = delete;
+
+  uint32_t GetAge() const { return age_; }
+  bool IsValid() const { return valid_; }
+
+private:
+  uint32_t age_;
+  std::vector<std::string> nicknames_;
+  bool valid_;
+
+  // The layout check needs to name Person's member types.
+  friend struct is_trivially_relocatable<Person>;
+};
+
+// Opting Person in via a layout check. Person is trivially relocatable if all
+// of its members are, and if it has no hidden state (like a vtable pointer)
+// beyond them. The second condition is checked by comparing Person's size with
+// a plain struct holding the same members in the same order. Nothing here
+// falls back quietly when Person changes: removing a member fails to compile
+// because the specialization names it, and adding a member (a std::string,
+// say) or a virtual function changes Person's size, so the static_assert
+// below fires, as does the static_assert(is_trivially_relocatable_v<Person>)
+// after RelocatingVector if a listed member stops being trivially
+// relocatable. Either way, the member list here has to be updated by hand.
+// The one change the size check can't see is a small member that fits into
+// Person's trailing padding (a second bool after valid_).
+template <>
+struct is_trivially_relocatable<Person>
+    : std::bool_constant<members_trivially_relocatable_v<decltype(Person::age_), decltype(Person::nicknames_),
+                                                         decltype(Person::valid_)>> {
+  struct Layout {
+    decltype(Person::age_) age_;
+    decltype(Person::nicknames_) nicknames_;
+    decltype(Person::valid_) valid_;
+  };
+  static_assert(sizeof(Layout) == sizeof(Person) && alignof(Layout) == alignof(Person) &&
+                    !std::is_polymorphic_v<Person>,
+                "Person has members the relocation layout check doesn't know about");
+};
+
+// RelocatingVector is a minimal, move-only dynamic array. Its interface is a
+// small subset of std::vector's. Every operation that shifts elements around
+// (growing, inserting, erasing) has two implementations, chosen at compile
+// time with if constexpr: a memcpy/memmove one for trivially relocatable
+// types, and the usual move-construct-then-destroy one for everything else.
+template <typename T>
+class RelocatingVector {
+ public:
+  RelocatingVector() = default;
+
+  ~RelocatingVector() {
+    Clear();
+    Deallocate(data_, capacity_);
+  }
+
+  RelocatingVector(RelocatingVector &&other)
+      : data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+  }
+
+  RelocatingVector &operator=(RelocatingVector &&other) {
+    if (this != &other) {
+      Clear();
+      Deallocate(data_, capacity_);
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      capacity_ = std::exchange(other.capacity_, 0);
+    }
+    return *this;
+  }
+
+  RelocatingVector(const RelocatingVector &) = delete;
+  RelocatingVector &operator=(const RelocatingVector &) = delete;
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+
+  T &operator[](size_t i) { return data_[i]; }
+  const T &operator[](size_t i) const { return data_[i]; }
+
+  T *begin() { return data_; }
+  T *end() { return data_ + size_; }
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+
+  void reserve(size_t new_capacity) {
+    if (new_capacity > capacity_) {
+      Reallocate(new_capacity);
+    }
+  }
+
+  template <typename... Args>
+  T &emplace_back(Args &&...args) {
+    if (size_ == capacity_) {
+      // args may refer to an element of this vector, which growing would
+      // move away, so build the new element first.
+      T tmp(std::forward<Args>(args)...);
+      Reallocate(GrowthCapacity());
+      T *slot = new (data_ + size_) T(std::move(tmp));
+      size_ += 1;
+      return *slot;
+    }
+    T *slot = new (data_ + size_) T(std::forward<Args>(args)...);
+    size_ += 1;
+    return *slot;
+  }
+
+  void push_back(T &&value) { emplace_back(std::move(value)); }
+
+  // Inserts value before position pos. For relocatable types, the tail of
+  // the array is shifted with a single memmove instead of size_ - pos move
+  // assignments.
+  T *insert(T *pos, T &&value) {
+    size_t index = static_cast<size_t>(pos - data_);
+    // value may refer to an element of this vector, so take it out before
+    // anything moves.
+    T tmp(std::move(value));
+    if constexpr (is_trivially_relocatable_v<T>) {
+      if (size_ == capacity_) {
+        Reallocate(GrowthCapacity());
+      }
+      std::memmove(static_cast<void *>(data_ + index + 1), static_cast<const void *>(data_ + index),
+                   (size_ - index) * sizeof(T));
+      new (data_ + index) T(std::move(tmp));
+      size_ += 1;
+    } else {
+      emplace_back(std::move(tmp));
+      std::rotate(data_ + index, data_ + size_ - 1, data_ + size_);
+    }
+    return data_ + index;
+  }
+
+  // Erases the element at pos and closes the gap.
+  T *erase(T *pos) {
+    size_t index = static_cast<size_t>(pos - data_);
+    if constexpr (is_trivially_relocatable_v<T>) {
+      pos->~T();
+      std::memmove(static_cast<void *>(data_ + index), static_cast<const void *>(data_ + index + 1),
+                   (size_ - index - 1) * sizeof(T));
+    } else {
+      std::move(data_ + index + 1, data_ + size_, data_ + index);
+      data_[size_ - 1].~T();
+    }
+    size_ -= 1;
+    return data_ + index;
+  }
+
+  void Clear() {
+    for (size_t i = 0; i < size_; i++) {
+      data_[i].~T();
+    }
+    size_ = 0;
+  }
+
+ private:
+  size_t GrowthCapacity() const { return capacity_ == 0 ? 4 : capacity_ * 2; }
+
+  // The heart of this file. For relocatable types, moving the elements into
+  // the new buffer is a single memcpy and no destructors run on the old
+  // buffer: the objects now live in the new buffer, and the old bytes are
+  // simply freed.
+  void Reallocate(size_t new_capacity) {
+    T *new_data = std::allocator<T>().allocate(new_capacity);
+    if constexpr (is_trivially_relocatable_v<T>) {
+      if (size_ > 0) {
+        std::memcpy(static_cast<void *>(new_data), static_cast<const void *>(data_), size_ * sizeof(T));
+      }
+    } else {
+      for (size_t i = 0; i < size_; i++) {
+        new (new_data + i) T(std::move(data_[i]));
+        data_[i].~T();
+      }
+    }
+    Deallocate(data_, capacity_);
+    data_ = new_data;
+    capacity_ = new_capacity;
+  }
+
+  static void Deallocate(T *data, size_t capacity) {
+    if (data != nullptr) {
+      std::allocator<T>().deallocate(data, capacity);
+    }
+  }
+
+  T *data_{nullptr};
+  size_t size_{0};
+  size_t capacity_{0};
+};
+
+static_assert(is_trivially_relocatable_v<int>);
+static_assert(is_trivially_relocatable_v<IntPtrManager>);
+static_assert(is_trivially_relocatable_v<Pointer<int>>);
+static_assert(is_trivially_relocatable_v<Person>);
+static_assert(!is_trivially_relocatable_v<std::string>);
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs the growth and insert benchmarks for one element type. make(i) creates
+// the i-th element. The checksum keeps the compiler from optimizing the work
+// away and checks that both containers end up with the same contents.
+template <typename T, typename Make, typename Value>
+void benchmark(const char *name, size_t n, Make make, Value value) {
+  size_t inserts = n / 1000;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<T> std_vec;
+  for (size_t i = 0; i < n; i++) {
+    std_vec.push_back(make(i));
+  }
+  double std_grow = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < inserts; i++) {
+    std_vec.insert(std_vec.begin() + static_cast<std::ptrdiff_t>(std_vec.size() / 2), make(i));
+  }
+  double std_insert = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  RelocatingVector<T> reloc_vec;
+  for (size_t i = 0; i < n; i++) {
+    reloc_vec.push_back(make(i));
+  }
+  double reloc_grow = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < inserts; i++) {
+    reloc_vec.insert(reloc_vec.begin() + reloc_vec.size() / 2, make(i));
+  }
+  double reloc_insert = seconds_since(start);
+
+  long long std_sum = 0;
+  long long reloc_sum = 0;
+  for (size_t i = 0; i < std_vec.size(); i++) {
+    std_sum += value(std_vec[i]) * static_cast<long long>(i % 7);
+    reloc_sum += value(reloc_vec[i]) * static_cast<long long>(i % 7);
+  }
+
+  std::cout << name << " (" << n << " push_backs, " << inserts << " middle inserts)\n"
+            << "  std::vector       grow " << std_grow << " s, insert " << std_insert << " s\n"
+            << "  RelocatingVector  grow " << reloc_grow << " s, insert " << reloc_insert << " s\n"
+            << "  checksums " << (std_sum == reloc_sum ? "match" : "DIFFER") << "\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+  // First, let's count how many times each vector calls Person's move
+  // constructor while growing to 1000 elements.
+  {
+    person_move_constructions = 0;
+    std::vector<Person> std_vec;
+    for (uint32_t i = 0; i < 1000; i++) {
+      std_vec.emplace_back(i, std::vector<std::string>{"andy", "pavlo"});
+    }
+    std::cout << "std::vector<Person> called the move constructor " << person_move_constructions
+              << " times while growing to 1000 elements.\n";
+
+    person_move_constructions = 0;
+    RelocatingVector<Person> reloc_vec;
+    for (uint32_t i = 0; i < 1000; i++) {
+      reloc_vec.emplace_back(i, std::vector<std::string>{"andy", "pavlo"});
+    }
+    std::cout << "RelocatingVector<Person> called the move constructor " << person_move_constructions
+              << " times while growing to 1000 elements.\n";
+
+    // Every relocated Person is still valid; relocation never leaves a
+    // moved-from object behind.
+    bool all_valid = true;
+    for (const Person &person : reloc_vec) {
+      all_valid = all_valid && person.IsValid();
+    }
+    std::cout << "All relocated Person objects valid: " << (all_valid ? "yes" : "no") << "\n\n";
+  }
+
+  // Now the benchmark on our three move-only types.
+  benchmark<IntPtrManager>(
+      "IntPtrManager", n, [](size_t i) { return IntPtrManager(static_cast<int>(i)); },
+      [](const IntPtrManager &p) { return static_cast<long long>(p.GetVal()); });
+  benchmark<Pointer<int>>(
+      "Pointer<int>", n, [](size_t i) { return Pointer<int>(static_cast<int>(i)); },
+      [](const Pointer<int> &p) { return static_cast<long long>(p.get_val()); });
+  benchmark<Person>(
+      "Person", n, [](size_t i) { return Person(static_cast<uint32_t>(i), {}); },
+      [](const Person &p) { return static_cast<long long>(p.GetAge()); });
+
+  return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file seqlock.cpp
+ * @brief Tutorial code for seqlocks, which let readers read shared data
+ * without writing to shared memory.
+ */
+
+// In rwlock.cpp, the readers take a std::shared_lock just to read an int.
+// Taking a shared lock means incrementing a reader count inside the
+// std::shared_mutex, and releasing it means decrementing it again. Those
+// are writes, so every reader pulls the lock's cache line into its own core
+// in exclusive state, and with many readers that cache line bounces between
+// cores constantly. Adding readers makes every reader slower.
+
+// A seqlock (sequence lock) avoids this for small, trivially copyable
+// values. It keeps a sequence number next to the value:
+//   - A writer makes the sequence number odd, writes the value, and makes
+//     it even again.
+//   - A reader reads the sequence number, copies the value, and reads the
+//     sequence number again. If the two numbers are equal and even, no
+//     writer touched the value in between, and the copy is good. Otherwise,
+//     it simply tries again.
+// Readers never write to shared memory, so they never slow each other down.
+// The trade-offs: readers may retry while a writer is busy, and readers get
+// a copy, so this only suits small values like the Point class from
+// vectors.cpp.
+
+// Copying the value while a writer may be changing it is a data race, which
+// is undefined behavior in C++ even if we throw the copy away afterwards. So
+// seqlock<T> stores the value as an array of relaxed std::atomic words, as
+// recommended by Hans Boehm in "Can Seqlocks Get Along With Programming
+// Language Memory Models?". On x86 and ARM, relaxed atomic loads and stores
+// compile to plain loads and stores, so this costs nothing.
+
+// The benchmark runs the 24-thread mix from rwlock.cpp (every third thread
+// is a writer) with both a seqlock<Point> and a Point behind a
+// std::shared_mutex, and then scales the number of readers from 1 to 16
+// next to a single writer. Readers check that x == y in every Point they
+// read, which a torn read would violate. Pass a different run time per
+// configuration in milliseconds as the first argument (default 200).
+
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes the header for uint64_t.
+#include <cstdint>
+// Includes std::memcpy.
+#include <cstring>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes the mutex library header.
+#include <mutex>
+// Includes the shared mutex library header.
+#include <shared_mutex>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes std::is_trivially_copyable_v.
+#include <type_traits>
+// Includes the header for std::vector.
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+// Includes _mm_pause.
+#include <immintrin.h>
+#endif
+
+// Tells the CPU that we are in a spin loop.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+template <typename T>
+class seqlock {
+  static_assert(std::is_trivially_copyable_v<T>, "seqlock<T> requires a trivially copyable T");
+
+ public:
+  explicit seqlock(const T &value = T()) { Store(value); }
+
+  seqlock(const seqlock &) = delete;
+  seqlock &operator=(const seqlock &) = delete;
+
+  // Returns a consistent copy of the value. Never blocks writers, and never
+  // writes to shared memory.
+  T load() const {
+    Words copy;
+    while (true) {
+      uint64_t before = sequence_.load(std::memory_order_acquire);
+      if (before % 2 == 1) {
+        // A writer is in the middle of a write.
+        cpu_relax();
+        continue;
+      }
+      for (size_t i = 0; i < kWords; i++) {
+        copy[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      // The fence keeps the second read of the sequence number from moving
+      // before the reads of the words.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+    T value;
+    std::memcpy(&value, copy, sizeof(T));
+    return value;
+  }
+
+  // Replaces the value. Writers exclude each other through the sequence
+  // number itself: a writer waits for it to be even and then makes it odd.
+  void store(const T &value) {
+    uint64_t sequence = BeginWrite();
+    Store(value);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Replaces the value with f(old value), atomically with respect to other
+  // writers.
+  template <typename F>
+  void update(F f) {
+    uint64_t sequence = BeginWrite();
+    T value = Load();
+    f(value);
+    Store(value);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+ private:
+  static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  using Words = uint64_t[kWords];
+
+  // Returns the (even) sequence number from before this write, after
+  // making the shared one odd.
+  uint64_t BeginWrite() {
+    uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+    while (sequence % 2 == 1 ||
+           !sequence_.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+      cpu_relax();
+      sequence = sequence_.load(std::memory_order_relaxed);
+    }
+    // The fence keeps the writes of the words from moving before the
+    // sequence number becomes odd.
+    std::atomic_thread_fence(std::memory_order_release);
+    return sequence;
+  }
+
+  // Only called by the thread that made the sequence number odd.
+  void Store(const T &value) {
+    Words copy{};
+    std::memcpy(copy, &value, sizeof(T));
+    for (size_t i = 0; i < kWords; i++) {
+      words_[i].store(copy[i], std::memory_order_relaxed);
+    }
+  }
+
+  T Load() const {
+    Words copy;
+    for (size_t i = 0; i < kWords; i++) {
+      copy[i] = words_[i].load(std::memory_order_relaxed);
+    }
+    T value;
+    std::memcpy(&value, copy, sizeof(T));
+    return value;
+  }
+
+  std::atomic<uint64_t> sequence_{0};
+  std::atomic<uint64_t> words_[kWords];
+};
+
+// The Point class from vectors.cpp, without the print statements in its
+// constructors.
+class Point {
+public:
+  Point() : x_(0), y_(0) {}
+  Point(int x, int y) : x_(x), y_(y) {}
+
+  inline int GetX() const { return x_; }
+  inline int GetY() const { return y_; }
+  inline void SetX(int x) { x_ = x; }
+  inline void SetY(int y) { y_ = y; }
+
+private:
+  int x_;
+  int y_;
+};
+
+// A Point behind a std::shared_mutex, with the same interface, for
+// comparison. This is the rwlock.cpp way.
+class SharedMutexPoint {
+ public:
+  Point load() const {
+    std::shared_lock lk(m_);
+    return point_;
+  }
+
+  template <typename F>
+  void update(F f) {
+    std::unique_lock lk(m_);
+    f(point_);
+  }
+
+ private:
+  mutable std::shared_mutex m_;
+  Point point_;
+};
+
+struct Result {
+  double reads_per_second_;
+  double writes_per_second_;
+  long long torn_;
+};
+
+// Runs `readers` reader threads and `writers` writer threads for the given
+// time. Writers move the point diagonally, so x == y must always hold; they
+// pause briefly between writes, since the data is read-mostly.
+template <typename Shared>
+Result run(int readers, int writers, int millis) {
+  Shared point;
+  std::atomic<bool> stop{false};
+  std::atomic<long long> reads{0};
+  std::atomic<long long> writes{0};
+  std::atomic<long long> torn{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < readers + writers; t++) {
+    // Interleave readers and writers like rwlock.cpp does.
+    bool writer = t % 3 == 1 && t / 3 < writers;
+    threads.emplace_back([&, writer] {
+      long long local_ops = 0;
+      long long local_torn = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (writer) {
+          point.update([](Point &p) {
+            p.SetX(p.GetX() + 3);
+            p.SetY(p.GetY() + 3);
+          });
+          for (int i = 0; i < 100; i++) {
+            cpu_relax();
+          }
+        } else {
+          Point p = point.load();
+          local_torn += p.GetX() != p.GetY();
+        }
+        local_ops += 1;
+      }
+      (writer ? writes : reads).fetch_add(local_ops);
+      torn.fetch_add(local_torn);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+  stop.store(true);
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double seconds = millis / 1000.0;
+  return {reads.load() / seconds, writes.load() / seconds, torn.load()};
+}
+
+template <typename Shared>
+void report(const char *name, int readers, int writers, int millis) {
+  Result r = run<Shared>(readers, writers, millis);
+  std::cout << "  " << name << r.reads_per_second_ / 1e6 << " M reads/s ("
+            << r.reads_per_second_ / 1e6 / readers << " per reader), " << r.writes_per_second_ / 1e6
+            << " M writes/s, " << r.torn_ << " torn reads\n";
+}
+
+int main(int argc, char **argv) {
+  const int millis = argc > 1 ? std::stoi(argv[1]) : 200;
+
+  // rwlock.cpp's count, as a seqlock<int>.
+  seqlock<int> count(0);
+  std::thread writer([&] { count.update([](int &c) { c += 3; }); });
+  std::thread reader([&] { std::cout << "Reading value " + std::to_string(count.load()) + "\n" << std::flush; });
+  writer.join();
+  reader.join();
+  std::cout << "Final value " << count.load() << std::endl;
+
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n";
+  std::cout << "rwlock.cpp mix, 16 readers and 8 writers:\n";
+  report<SharedMutexPoint>("std::shared_mutex: ", 16, 8, millis);
+  report<seqlock<Point>>("seqlock:           ", 16, 8, millis);
+
+  for (int readers = 1; readers <= 16; readers *= 2) {
+    std::cout << readers << " readers, 1 writer:\n";
+    report<SharedMutexPoint>("std::shared_mutex: ", readers, 1, millis);
+    report<seqlock<Point>>("seqlock:           ", readers, 1, millis);
+  }
+  return 0;
+}
@@ -0,0 +1,561 @@
+/**
+ * @file sharded_cache.cpp
+ * @brief Tutorial code for a sharded in-memory cache with a memory budget,
+ * LRU or CLOCK eviction and TinyLFU admission.
+ */
+
+// The textbook LRU cache combines the two data structures from
+// iterator.cpp and unordered_maps.cpp: a doubly linked list like DLL keeps
+// the entries in order of last use, and a std::unordered_map finds the list
+// node for a key. A hit moves the node to the front of the list; when the
+// cache is full, the node at the back is evicted. Put one std::mutex around
+// both, and it is thread-safe.
+
+// That cache has three problems, and this file fixes each of them:
+//   1. One mutex serializes every thread. ShardedCache splits the key space
+//      into independent shards, each with its own mutex, map and list, and
+//      picks the shard from the key's hash, so threads mostly take
+//      different locks.
+//   2. LRU writes to the list on every hit (moving the node to the front),
+//      which is a lot of pointer chasing under the lock. CLOCK approximates
+//      LRU with a "referenced" bit per entry: a hit just sets the bit, and
+//      eviction sweeps a hand around a circular list, giving referenced
+//      entries a second chance.
+//   3. LRU and CLOCK admit every new key, even one that is used once and
+//      never again, evicting something that was popular. TinyLFU (Einziger,
+//      Friedman and Manes, 2017) keeps an approximate access count for every
+//      key in a small count-min sketch, and only admits a new key if it has
+//      been accessed more often than the entry it would evict.
+// Eviction and admission are template parameters, so they can be combined
+// freely. The cache has a memory budget in bytes rather than a number of
+// entries, and counts hits, misses, insertions, evictions and rejected
+// insertions.
+
+// The benchmark replays a Zipfian key trace (a few keys are very popular and
+// most are rare, like real cache workloads) with 1 to 32 threads (pass a
+// different maximum as the second argument), using the cache as a
+// read-through cache: every miss is followed by a Put. It reports the hit
+// rate and throughput of each configuration. Pass a different number of
+// operations per configuration as the first argument (default 1,000,000).
+
+// Includes std::lower_bound.
+#include <algorithm>
+// Includes std::array, for the sketch rows.
+#include <array>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::pow.
+#include <cmath>
+// Includes the header for uint64_t.
+#include <cstdint>
+// Includes std::hash.
+#include <functional>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::unique_ptr.
+#include <memory>
+// Includes the mutex library header.
+#include <mutex>
+// Includes std::optional, returned by Get.
+#include <optional>
+// Includes std::mt19937_64.
+#include <random>
+// Includes std::invalid_argument.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes the unordered map container library header.
+#include <unordered_map>
+// Includes the utility header for std::move.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+// Spreads the bits of a hash. std::hash<int> is the identity on most
+// standard libraries, which would put consecutive keys into consecutive
+// shards and sketch counters.
+inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// The entry, and the node of the intrusive list used by the eviction
+// policies, like Node in iterator.cpp.
+template <typename K, typename V>
+struct CacheNode {
+  CacheNode(K key, V value, size_t charge, uint64_t hash)
+      : key_(std::move(key)), value_(std::move(value)), charge_(charge), hash_(hash) {}
+
+  K key_;
+  V value_;
+  size_t charge_;
+  uint64_t hash_;
+  CacheNode *prev_{nullptr};
+  CacheNode *next_{nullptr};
+  bool referenced_{false};
+};
+
+// Eviction policies. Each one keeps the nodes of one shard in some order
+// and implements:
+//   OnInsert(node), OnHit(node), OnErase(node): keep track of the node.
+//   Victim(): the node to evict next. It is not removed; the shard calls
+//     OnErase when it actually evicts it.
+//   Spare(node): Victim() returned node, but it must stay; treat it as used
+//     so that the next Victim() looks elsewhere.
+// Both policies below link the nodes into a circular doubly linked list
+// through prev_ and next_.
+
+// Least recently used. The list is ordered by last use; head_ is the most
+// recently used node, and head_->prev_ (the tail) is the victim.
+template <typename Node>
+class LruPolicy {
+ public:
+  void OnInsert(Node *node) {
+    LinkBefore(node, head_);
+    head_ = node;
+  }
+
+  void OnHit(Node *node) {
+    if (node != head_) {
+      Unlink(node);
+      LinkBefore(node, head_);
+      head_ = node;
+    }
+  }
+
+  void OnErase(Node *node) { Unlink(node); }
+
+  Node *Victim() { return head_ == nullptr ? nullptr : head_->prev_; }
+
+  void Spare(Node *node) { OnHit(node); }
+
+ protected:
+  // Inserts node before `at` in the circular list (at the tail if `at` is
+  // the head), or makes it the only node if the list is empty.
+  void LinkBefore(Node *node, Node *at) {
+    if (at == nullptr) {
+      node->prev_ = node->next_ = node;
+      head_ = node;
+      return;
+    }
+    node->next_ = at;
+    node->prev_ = at->prev_;
+    at->prev_->next_ = node;
+    at->prev_ = node;
+  }
+
+  void Unlink(Node *node) {
+    if (node->next_ == node) {
+      head_ = nullptr;
+    } else {
+      node->prev_->next_ = node->next_;
+      node->next_->prev_ = node->prev_;
+      if (head_ == node) {
+        head_ = node->next_;
+      }
+    }
+    node->prev_ = node->next_ = nullptr;
+  }
+
+  Node *head_{nullptr};
+};
+
+// CLOCK. New nodes go just behind the hand, so they are the last to be
+// looked at. A hit only sets the referenced bit. To find a victim, the hand
+// clears referenced bits until it finds a node without one.
+template <typename Node>
+class ClockPolicy : protected LruPolicy<Node> {
+ public:
+  void OnInsert(Node *node) {
+    this->LinkBefore(node, this->head_);
+    node->referenced_ = false;
+  }
+
+  void OnHit(Node *node) { node->referenced_ = true; }
+
+  void OnErase(Node *node) { this->Unlink(node); }
+
+  // head_ serves as the hand.
+  Node *Victim() {
+    Node *&hand = this->head_;
+    if (hand == nullptr) {
+      return nullptr;
+    }
+    while (hand->referenced_) {
+      hand->referenced_ = false;
+      hand = hand->next_;
+    }
+    return hand;
+  }
+
+  // Gives the node its referenced bit back and moves the hand past it.
+  void Spare(Node *node) {
+    node->referenced_ = true;
+    if (this->head_ == node) {
+      this->head_ = node->next_;
+    }
+  }
+};
+
+// Admission policies decide whether a new key may evict an existing entry.
+// Record(hash) is called on every access, hit or miss.
+class AlwaysAdmit {
+ public:
+  explicit AlwaysAdmit(size_t) {}
+  void Record(uint64_t) {}
+  bool Admit(uint64_t, uint64_t) { return true; }
+};
+
+// TinyLFU. A count-min sketch with 4 rows of 8-bit saturating counters
+// estimates how often each key was accessed: a key's estimate is the
+// minimum of its 4 counters, which is never too low and rarely much too
+// high. To forget old popularity, all counters are halved after every
+// 10 * width recorded accesses.
+class TinyLfuAdmission {
+ public:
+  // Sized for about `entries` entries.
+  explicit TinyLfuAdmission(size_t entries) {
+    size_t width = 64;
+    while (width < entries) {
+      width *= 2;
+    }
+    mask_ = width - 1;
+    reset_after_ = 10 * width;
+    for (std::vector<uint8_t> &row : rows_) {
+      row.assign(width, 0);
+    }
+  }
+
+  void Record(uint64_t hash) {
+    for (size_t r = 0; r < kRows; r++) {
+      uint8_t &counter = rows_[r][Index(hash, r)];
+      if (counter < 255) {
+        counter += 1;
+      }
+    }
+    if (++samples_ == reset_after_) {
+      for (std::vector<uint8_t> &row : rows_) {
+        for (uint8_t &counter : row) {
+          counter /= 2;
+        }
+      }
+      samples_ = 0;
+    }
+  }
+
+  bool Admit(uint64_t candidate, uint64_t victim) { return Estimate(candidate) > Estimate(victim); }
+
+ private:
+  static constexpr size_t kRows = 4;
+
+  // Each row remixes the hash with its own seed. Slicing the hash directly
+  // would reuse the low bits, which also pick the shard, so within a shard
+  // row 0 would only ever reach 1/shards of its counters.
+  size_t Index(uint64_t hash, size_t row) const { return mix(hash + (row + 1) * 0x9e3779b97f4a7c15ULL) & mask_; }
+
+  uint8_t Estimate(uint64_t hash) const {
+    uint8_t estimate = 255;
+    for (size_t r = 0; r < kRows; r++) {
+      estimate = std::min(estimate, rows_[r][Index(hash, r)]);
+    }
+    return estimate;
+  }
+
+  std::array<std::vector<uint8_t>, kRows> rows_;
+  size_t mask_;
+  size_t reset_after_;
+  size_t samples_{0};
+};
+
+struct CacheStats {
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+  uint64_t insertions_{0};
+  uint64_t evictions_{0};
+  uint64_t rejections_{0};
+  size_t bytes_used_{0};
+
+  double HitRate() const { return hits_ + misses_ == 0 ? 0 : static_cast<double>(hits_) / (hits_ + misses_); }
+};
+
+template <typename K, typename V, template <typename> class Eviction = LruPolicy, typename Admission = AlwaysAdmit,
+          typename Hash = std::hash<K>>
+class ShardedCache {
+ public:
+  using Node = CacheNode<K, V>;
+
+  // The default charge of an entry: the node, plus roughly what
+  // std::unordered_map spends per element (a bucket pointer and a map node
+  // holding the key, the Node pointer and a next pointer).
+  static constexpr size_t kEntryCharge = sizeof(Node) + sizeof(K) + 4 * sizeof(void *);
+
+  // budget_bytes is shared evenly by the shards; shards must be a power of
+  // two.
+  explicit ShardedCache(size_t budget_bytes, size_t shards = 16) : shard_mask_(shards - 1) {
+    if (shards == 0 || (shards & (shards - 1)) != 0) {
+      throw std::invalid_argument("ShardedCache: the number of shards must be a power of two");
+    }
+    for (size_t i = 0; i < shards; i++) {
+      shards_.push_back(std::make_unique<Shard>(budget_bytes / shards));
+    }
+  }
+
+  std::optional<V> Get(const K &key) {
+    uint64_t hash = mix(Hash{}(key));
+    return ShardFor(hash).Get(key, hash);
+  }
+
+  // Inserts or replaces the entry for key. charge is what the entry counts
+  // against the budget; pass a larger charge for values that own heap
+  // memory. Returns false if the admission policy rejected the entry.
+  bool Put(const K &key, V value, size_t charge = kEntryCharge) {
+    uint64_t hash = mix(Hash{}(key));
+    return ShardFor(hash).Put(key, std::move(value), charge, hash);
+  }
+
+  bool Erase(const K &key) {
+    uint64_t hash = mix(Hash{}(key));
+    return ShardFor(hash).Erase(key);
+  }
+
+  CacheStats Stats() {
+    CacheStats total;
+    for (std::unique_ptr<Shard> &shard : shards_) {
+      std::scoped_lock lk(shard->m_);
+      total.hits_ += shard->stats_.hits_;
+      total.misses_ += shard->stats_.misses_;
+      total.insertions_ += shard->stats_.insertions_;
+      total.evictions_ += shard->stats_.evictions_;
+      total.rejections_ += shard->stats_.rejections_;
+      total.bytes_used_ += shard->stats_.bytes_used_;
+    }
+    return total;
+  }
+
+ private:
+  // One shard: the map and list of the textbook LRU cache, behind its own
+  // mutex. alignas keeps two shards' mutexes off the same cache line.
+  struct alignas(64) Shard {
+    explicit Shard(size_t budget) : budget_(budget), admission_(budget / kEntryCharge) {}
+
+    ~Shard() {
+      for (auto &[key, node] : map_) {
+        delete node;
+      }
+    }
+
+    std::optional<V> Get(const K &key, uint64_t hash) {
+      std::scoped_lock lk(m_);
+      admission_.Record(hash);
+      auto it = map_.find(key);
+      if (it == map_.end()) {
+        stats_.misses_ += 1;
+        return std::nullopt;
+      }
+      stats_.hits_ += 1;
+      eviction_.OnHit(it->second);
+      return it->second->value_;
+    }
+
+    bool Put(const K &key, V value, size_t charge, uint64_t hash) {
+      std::scoped_lock lk(m_);
+      auto it = map_.find(key);
+      if (it != map_.end()) {
+        Node *node = it->second;
+        stats_.bytes_used_ = stats_.bytes_used_ - node->charge_ + charge;
+        node->value_ = std::move(value);
+        node->charge_ = charge;
+        eviction_.OnHit(node);
+        EvictUntilWithinBudget(node);
+        return true;
+      }
+      if (charge > budget_) {
+        stats_.rejections_ += 1;
+        return false;
+      }
+      // Decide on admission before evicting anything, so a rejected key
+      // never costs an entry. As in TinyLFU, the candidate is compared with
+      // the first victim; the rest are evicted only to make room.
+      if (stats_.bytes_used_ + charge > budget_ && !admission_.Admit(hash, eviction_.Victim()->hash_)) {
+        stats_.rejections_ += 1;
+        return false;
+      }
+      while (stats_.bytes_used_ + charge > budget_) {
+        Evict(eviction_.Victim());
+      }
+      Node *node = new Node(key, std::move(value), charge, hash);
+      map_.emplace(key, node);
+      eviction_.OnInsert(node);
+      stats_.bytes_used_ += charge;
+      stats_.insertions_ += 1;
+      return true;
+    }
+
+    bool Erase(const K &key) {
+      std::scoped_lock lk(m_);
+      auto it = map_.find(key);
+      if (it == map_.end()) {
+        return false;
+      }
+      Node *node = it->second;
+      map_.erase(it);
+      eviction_.OnErase(node);
+      stats_.bytes_used_ -= node->charge_;
+      delete node;
+      return true;
+    }
+
+    // Used when a replaced value grew; never evicts `keep`. When every
+    // entry is hot, a CLOCK hand clears all the referenced bits and comes
+    // back around to keep, so keep is spared and the search goes on; it
+    // only stops when keep is the last entry left.
+    void EvictUntilWithinBudget(Node *keep) {
+      while (stats_.bytes_used_ > budget_ && map_.size() > 1) {
+        Node *victim = eviction_.Victim();
+        if (victim == keep) {
+          eviction_.Spare(keep);
+        } else {
+          Evict(victim);
+        }
+      }
+    }
+
+    void Evict(Node *victim) {
+      map_.erase(victim->key_);
+      eviction_.OnErase(victim);
+      stats_.bytes_used_ -= victim->charge_;
+      stats_.evictions_ += 1;
+      delete victim;
+    }
+
+    std::mutex m_;
+    const size_t budget_;
+    std::unordered_map<K, Node *, Hash> map_;
+    Eviction<Node> eviction_;
+    Admission admission_;
+    CacheStats stats_;
+  };
+
+  // The low bits of the mixed hash pick the shard; the sketch remixes the
+  // hash, so its counters don't depend on them.
+  Shard &ShardFor(uint64_t hash) { return *shards_[hash & shard_mask_]; }
+
+  const size_t shard_mask_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// Draws keys 0..n-1 with probability proportional to 1 / (rank + 1)^s. We
+// precompute the cumulative distribution and binary search it.
+class ZipfGenerator {
+ public:
+  ZipfGenerator(size_t n, double s) : cdf_(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+      cdf_[i] = sum;
+    }
+    for (double &c : cdf_) {
+      c /= sum;
+    }
+  }
+
+  template <typename Rng>
+  uint64_t operator()(Rng &rng) const {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+template <typename Cache>
+void benchmark(const char *name, const std::vector<std::vector<uint64_t>> &traces, size_t budget, size_t shards) {
+  Cache cache(budget, shards);
+  const size_t num_threads = traces.size();
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      for (uint64_t key : traces[t]) {
+        if (!cache.Get(key)) {
+          cache.Put(key, key * 2);
+        }
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  CacheStats stats = cache.Stats();
+  std::cout << "  " << name << "hit rate " << stats.HitRate() * 100 << "%, "
+            << static_cast<double>(stats.hits_ + stats.misses_) / seconds / 1e6 << " M ops/s, "
+            << stats.evictions_ << " evictions, " << stats.rejections_ << " rejections\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t ops = argc > 1 ? std::stoull(argv[1]) : 1000000;
+  const size_t max_threads = argc > 2 ? std::stoull(argv[2]) : 32;
+
+  // A small demo: a cache with room for about 3 entries.
+  using DemoCache = ShardedCache<int, std::string>;
+  DemoCache demo(3 * DemoCache::kEntryCharge, 1);
+  demo.Put(1, "one");
+  demo.Put(2, "two");
+  demo.Put(3, "three");
+  demo.Get(1);
+  demo.Put(4, "four");
+  std::cout << "Key 2 was least recently used, so it was evicted: " << (demo.Get(2) ? "no" : "yes") << "\n";
+  std::cout << "Key 1 is still cached: " << demo.Get(1).value_or("(evicted)") << "\n";
+
+  // With CLOCK, replace the value under the hand with one twice the size
+  // while every entry is hot: the hand clears all three referenced bits and
+  // comes back around to the replaced entry, which must be skipped so that
+  // another entry makes room.
+  using ClockDemoCache = ShardedCache<int, std::string, ClockPolicy>;
+  ClockDemoCache clock_demo(3 * ClockDemoCache::kEntryCharge, 1);
+  clock_demo.Put(1, "one");
+  clock_demo.Put(2, "two");
+  clock_demo.Put(3, "three");
+  clock_demo.Get(1);
+  clock_demo.Get(2);
+  clock_demo.Get(3);
+  clock_demo.Put(1, "one, twice the size", 2 * ClockDemoCache::kEntryCharge);
+  std::cout << "CLOCK, after key 1 grew: key 1 " << (clock_demo.Get(1) ? "cached" : "evicted") << ", within budget: "
+            << (clock_demo.Stats().bytes_used_ <= 3 * ClockDemoCache::kEntryCharge ? "yes" : "no") << "\n";
+
+  // The workload: one million keys, a Zipf exponent typical of web caches,
+  // and a budget for 5% of the keys.
+  const size_t keys = 1000000;
+  ZipfGenerator zipf(keys, 0.9);
+  using Key = uint64_t;
+  using LruCache = ShardedCache<Key, uint64_t, LruPolicy>;
+  const size_t budget = keys / 20 * LruCache::kEntryCharge;
+
+  std::cout << "Zipf(0.9) over " << keys << " keys, budget " << budget / (1 << 20) << " MB (~" << keys / 20
+            << " entries), " << ops << " operations\n";
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    // Each thread gets its own slice of one trace, so every configuration
+    // and thread count sees the same keys.
+    std::vector<std::vector<uint64_t>> traces(threads);
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i < ops; i++) {
+      traces[i % threads].push_back(zipf(rng));
+    }
+    std::cout << threads << " threads:\n";
+    benchmark<LruCache>("LRU, 1 shard:          ", traces, budget, 1);
+    benchmark<LruCache>("LRU, 64 shards:        ", traces, budget, 64);
+    benchmark<ShardedCache<Key, uint64_t, ClockPolicy>>("CLOCK, 64 shards:      ", traces, budget, 64);
+    benchmark<ShardedCache<Key, uint64_t, LruPolicy, TinyLfuAdmission>>("LRU + TinyLFU, 64:     ", traces, budget, 64);
+    benchmark<ShardedCache<Key, uint64_t, ClockPolicy, TinyLfuAdmission>>("CLOCK + TinyLFU, 64:   ", traces, budget,
+                                                                          64);
+  }
+  return 0;
+}
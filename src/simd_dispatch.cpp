@@ -0,0 +1,436 @@
+/**
+ * @file simd_dispatch.cpp
+ * @brief Tutorial code for SIMD kernels specialized per instruction set, and
+ * selected once at startup based on what the CPU supports.
+ */
+
+// templated_classes.cpp shows FooSpecial<float>, a full specialization of
+// FooSpecial<T> that replaces the generic implementation for one type. In
+// this file, we use exactly the same mechanism to write kernels for different
+// CPU instruction sets. SimdKernels<Isa> is a generic, portable implementation
+// of four kernels (sum, min/max, dot product and a memchr-like find), and
+// SimdKernels<Sse2>, SimdKernels<Avx2> and SimdKernels<Avx512> are full
+// specializations written with the intrinsics of each instruction set.
+
+// The problem with SIMD code is that a binary compiled with AVX2 instructions
+// crashes on a CPU without AVX2, while a binary compiled without them leaves
+// performance on the table on newer CPUs. To run optimally on a mixed fleet
+// from a single binary, we:
+//   1. Compile each specialization for its own instruction set only, using
+//      the __attribute__((target("..."))) function attribute (supported by
+//      GCC and Clang). The rest of the program stays baseline x86-64.
+//   2. Ask the CPU which instruction sets it supports (the cpuid instruction,
+//      wrapped by __builtin_cpu_supports), once, at startup.
+//   3. Store the best supported kernels in a table of function pointers that
+//      the rest of the program calls through.
+// Set the SIMD_ISA environment variable (scalar, sse2, avx2 or avx512) to
+// force a lower path, e.g. for testing.
+
+// On CPUs other than x86 (e.g. Apple silicon), only the generic kernels are
+// compiled. The benchmark sizes can be changed with the first argument (the
+// number of elements, default 16,000,000).
+
+// Includes std::min and std::max.
+#include <algorithm>
+// Includes std::chrono for timing the benchmark.
+#include <chrono>
+// Includes std::abs.
+#include <cmath>
+// Includes the header for int32_t and int64_t.
+#include <cstdint>
+// Includes std::getenv.
+#include <cstdlib>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::numeric_limits.
+#include <limits>
+// Includes std::mt19937, used to generate the benchmark data.
+#include <random>
+// Includes the C++ string library.
+#include <string>
+// Includes std::pair.
+#include <utility>
+// Includes the header for std::vector.
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_DISPATCH_X86 1
+// Includes the Intel intrinsics for SSE2, AVX2 and AVX-512.
+#include <immintrin.h>
+#endif
+
+// Tag types, one per instruction set. They carry no data; they only exist to
+// be template arguments, like float in FooSpecial<float>.
+struct Scalar {
+  static constexpr const char *kName = "scalar";
+};
+struct Sse2 {
+  static constexpr const char *kName = "sse2";
+};
+struct Avx2 {
+  static constexpr const char *kName = "avx2";
+};
+struct Avx512 {
+  static constexpr const char *kName = "avx512";
+};
+
+// The generic kernels. Any Isa without a specialization gets these plain
+// loops, which is also what runs on non-x86 CPUs.
+template <typename Isa>
+struct SimdKernels {
+  static int64_t Sum(const int32_t *data, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += data[i];
+    }
+    return sum;
+  }
+
+  static std::pair<int32_t, int32_t> MinMax(const int32_t *data, size_t n) {
+    int32_t lo = std::numeric_limits<int32_t>::max();
+    int32_t hi = std::numeric_limits<int32_t>::min();
+    for (size_t i = 0; i < n; i++) {
+      lo = std::min(lo, data[i]);
+      hi = std::max(hi, data[i]);
+    }
+    return {lo, hi};
+  }
+
+  static float Dot(const float *a, const float *b, size_t n) {
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += a[i] * b[i];
+    }
+    return sum;
+  }
+
+  // Like memchr: returns a pointer to the first byte equal to c, or nullptr.
+  static const char *Find(const char *data, size_t n, char c) {
+    for (size_t i = 0; i < n; i++) {
+      if (data[i] == c) {
+        return data + i;
+      }
+    }
+    return nullptr;
+  }
+};
+
+#ifdef SIMD_DISPATCH_X86
+
+// Every function in a specialization is compiled for that instruction set
+// only, so the compiler accepts its intrinsics without -mavx2 and friends.
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+
+// SSE2 is part of the x86-64 baseline, so every 64-bit x86 CPU has it. It
+// processes 128 bits (four int32_t or float) at a time.
+template <>
+struct SimdKernels<Sse2> {
+  SIMD_TARGET("sse2") static int64_t Sum(const int32_t *data, size_t n) {
+    // SSE2 can't sign-extend int32_t lanes to int64_t directly, so we build
+    // the upper halves from the sign bits and interleave.
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i sign = _mm_srai_epi32(v, 31);
+      acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+      acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    alignas(16) int64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    return lanes[0] + lanes[1] + SimdKernels<Scalar>::Sum(data + i, n - i);
+  }
+
+  SIMD_TARGET("sse2") static std::pair<int32_t, int32_t> MinMax(const int32_t *data, size_t n) {
+    // SSE2 has no 32-bit integer min/max instructions either (they arrived in
+    // SSE4.1), so we select with a comparison mask.
+    __m128i lo = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+    __m128i hi = _mm_set1_epi32(std::numeric_limits<int32_t>::min());
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i lt = _mm_cmplt_epi32(v, lo);
+      lo = _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, lo));
+      __m128i gt = _mm_cmpgt_epi32(v, hi);
+      hi = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, hi));
+    }
+    alignas(16) int32_t lo_lanes[4];
+    alignas(16) int32_t hi_lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lo_lanes), lo);
+    _mm_store_si128(reinterpret_cast<__m128i *>(hi_lanes), hi);
+    auto [tail_lo, tail_hi] = SimdKernels<Scalar>::MinMax(data + i, n - i);
+    return {std::min({lo_lanes[0], lo_lanes[1], lo_lanes[2], lo_lanes[3], tail_lo}),
+            std::max({hi_lanes[0], hi_lanes[1], hi_lanes[2], hi_lanes[3], tail_hi})};
+  }
+
+  SIMD_TARGET("sse2") static float Dot(const float *a, const float *b, size_t n) {
+    // Two accumulators, so consecutive additions don't wait on each other.
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, _mm_add_ps(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SimdKernels<Scalar>::Dot(a + i, b + i, n - i);
+  }
+
+  SIMD_TARGET("sse2") static const char *Find(const char *data, size_t n, char c) {
+    // Compare 16 bytes at once, then turn the comparison result into a 16-bit
+    // mask. The index of its lowest set bit is the position of the match.
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+      if (mask != 0) {
+        return data + i + __builtin_ctz(static_cast<unsigned>(mask));
+      }
+    }
+    return SimdKernels<Scalar>::Find(data + i, n - i, c);
+  }
+};
+
+// AVX2 doubles the width to 256 bits, and adds fused multiply-add (FMA is a
+// separate feature flag, but every AVX2 CPU we care about has it; we check
+// both anyway).
+template <>
+struct SimdKernels<Avx2> {
+  SIMD_TARGET("avx2") static int64_t Sum(const int32_t *data, size_t n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 4));
+      acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(lo));
+      acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(hi));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SimdKernels<Scalar>::Sum(data + i, n - i);
+  }
+
+  SIMD_TARGET("avx2") static std::pair<int32_t, int32_t> MinMax(const int32_t *data, size_t n) {
+    __m256i lo = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+    __m256i hi = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      lo = _mm256_min_epi32(lo, v);
+      hi = _mm256_max_epi32(hi, v);
+    }
+    alignas(32) int32_t lo_lanes[8];
+    alignas(32) int32_t hi_lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lo_lanes), lo);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(hi_lanes), hi);
+    auto [result_lo, result_hi] = SimdKernels<Scalar>::MinMax(data + i, n - i);
+    for (int k = 0; k < 8; k++) {
+      result_lo = std::min(result_lo, lo_lanes[k]);
+      result_hi = std::max(result_hi, hi_lanes[k]);
+    }
+    return {result_lo, result_hi};
+  }
+
+  SIMD_TARGET("avx2,fma") static float Dot(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, _mm256_add_ps(acc0, acc1));
+    float sum = 0;
+    for (float lane : lanes) {
+      sum += lane;
+    }
+    return sum + SimdKernels<Scalar>::Dot(a + i, b + i, n - i);
+  }
+
+  SIMD_TARGET("avx2") static const char *Find(const char *data, size_t n, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+      if (mask != 0) {
+        return data + i + __builtin_ctz(mask);
+      }
+    }
+    return SimdKernels<Scalar>::Find(data + i, n - i, c);
+  }
+};
+
+// AVX-512 doubles the width again to 512 bits, and compares produce compact
+// bit masks directly. We need the F (foundation) and BW (byte/word)
+// extensions; BW is what provides 8-bit compares for Find.
+template <>
+struct SimdKernels<Avx512> {
+  SIMD_TARGET("avx512f") static int64_t Sum(const int32_t *data, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      acc = _mm512_add_epi64(acc, _mm512_cvtepi32_epi64(values));
+    }
+    return _mm512_reduce_add_epi64(acc) + SimdKernels<Scalar>::Sum(data + i, n - i);
+  }
+
+  SIMD_TARGET("avx512f") static std::pair<int32_t, int32_t> MinMax(const int32_t *data, size_t n) {
+    __m512i lo = _mm512_set1_epi32(std::numeric_limits<int32_t>::max());
+    __m512i hi = _mm512_set1_epi32(std::numeric_limits<int32_t>::min());
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m512i v = _mm512_loadu_si512(data + i);
+      lo = _mm512_min_epi32(lo, v);
+      hi = _mm512_max_epi32(hi, v);
+    }
+    auto [tail_lo, tail_hi] = SimdKernels<Scalar>::MinMax(data + i, n - i);
+    return {std::min(tail_lo, _mm512_reduce_min_epi32(lo)), std::max(tail_hi, _mm512_reduce_max_epi32(hi))};
+  }
+
+  SIMD_TARGET("avx512f") static float Dot(const float *a, const float *b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+      acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + SimdKernels<Scalar>::Dot(a + i, b + i, n - i);
+  }
+
+  SIMD_TARGET("avx512f,avx512bw") static const char *Find(const char *data, size_t n, char c) {
+    __m512i needle = _mm512_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+      __mmask64 mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(data + i), needle);
+      if (mask != 0) {
+        return data + i + __builtin_ctzll(mask);
+      }
+    }
+    return SimdKernels<Scalar>::Find(data + i, n - i, c);
+  }
+};
+
+#endif  // SIMD_DISPATCH_X86
+
+// The table of function pointers the rest of the program calls through.
+struct KernelTable {
+  const char *isa_;
+  int64_t (*sum_)(const int32_t *, size_t);
+  std::pair<int32_t, int32_t> (*min_max_)(const int32_t *, size_t);
+  float (*dot_)(const float *, const float *, size_t);
+  const char *(*find_)(const char *, size_t, char);
+};
+
+template <typename Isa>
+KernelTable make_kernel_table() {
+  return {Isa::kName, &SimdKernels<Isa>::Sum, &SimdKernels<Isa>::MinMax, &SimdKernels<Isa>::Dot,
+          &SimdKernels<Isa>::Find};
+}
+
+// Every kernel table this CPU can run, from the most generic to the best.
+std::vector<KernelTable> supported_kernel_tables() {
+  std::vector<KernelTable> tables = {make_kernel_table<Scalar>()};
+#ifdef SIMD_DISPATCH_X86
+  __builtin_cpu_init();
+  tables.push_back(make_kernel_table<Sse2>());
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    tables.push_back(make_kernel_table<Avx2>());
+  }
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    tables.push_back(make_kernel_table<Avx512>());
+  }
+#endif
+  return tables;
+}
+
+// The kernels the program uses. The function-local static is initialized
+// exactly once (thread-safely), the first time this is called; after that,
+// every call is just a load of the table.
+const KernelTable &active_kernels() {
+  static const KernelTable table = [] {
+    std::vector<KernelTable> tables = supported_kernel_tables();
+    if (const char *forced = std::getenv("SIMD_ISA")) {
+      for (const KernelTable &t : tables) {
+        if (std::string(t.isa_) == forced) {
+          return t;
+        }
+      }
+    }
+    return tables.back();
+  }();
+  return table;
+}
+
+// Runs fn reps times and returns the average time per run in seconds.
+template <typename Fn>
+double time_seconds(int reps, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++) {
+    fn();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main(int argc, char **argv) {
+  const size_t n = argc > 1 ? std::stoull(argv[1]) : 16000000;
+  const int reps = 10;
+
+  std::mt19937 gen(445);
+  std::uniform_int_distribution<int32_t> int_dist(-1000000, 1000000);
+  std::uniform_real_distribution<float> float_dist(-1.0f, 1.0f);
+  std::vector<int32_t> ints(n);
+  std::vector<float> xs(n), ys(n);
+  for (size_t i = 0; i < n; i++) {
+    ints[i] = int_dist(gen);
+    xs[i] = float_dist(gen);
+    ys[i] = float_dist(gen);
+  }
+  // For Find, a buffer of 'a's with a single 'z' at the very end, so every
+  // kernel has to scan the whole thing.
+  std::vector<char> bytes(n * sizeof(int32_t), 'a');
+  bytes.push_back('z');
+
+  // Most programs would only ever call active_kernels().
+  const KernelTable &chosen = active_kernels();
+  std::cout << "Selected kernels: " << chosen.isa_ << "\n";
+
+  // Reference results from the generic kernels (and, for the dot product, a
+  // more precise double-precision loop).
+  const int64_t expected_sum = SimdKernels<Scalar>::Sum(ints.data(), n);
+  const auto expected_min_max = SimdKernels<Scalar>::MinMax(ints.data(), n);
+  double expected_dot = 0;
+  for (size_t i = 0; i < n; i++) {
+    expected_dot += static_cast<double>(xs[i]) * ys[i];
+  }
+
+  const double int_gb = static_cast<double>(n * sizeof(int32_t)) / 1e9;
+  for (const KernelTable &t : supported_kernel_tables()) {
+    int64_t sum = 0;
+    std::pair<int32_t, int32_t> min_max;
+    float dot = 0;
+    const char *found = nullptr;
+
+    double sum_s = time_seconds(reps, [&] { sum = t.sum_(ints.data(), n); });
+    double min_max_s = time_seconds(reps, [&] { min_max = t.min_max_(ints.data(), n); });
+    double dot_s = time_seconds(reps, [&] { dot = t.dot_(xs.data(), ys.data(), n); });
+    double find_s = time_seconds(reps, [&] { found = t.find_(bytes.data(), bytes.size(), 'z'); });
+
+    // Different paths add floats in different orders, so the dot products
+    // only agree approximately.
+    bool ok = sum == expected_sum && min_max == expected_min_max && found == &bytes.back() &&
+              std::abs(dot - expected_dot) <= 1e-3 * std::max(1.0, std::abs(expected_dot));
+    std::cout << t.isa_ << (t.isa_ == chosen.isa_ ? " (selected)" : "") << ": "
+              << "sum " << int_gb / sum_s << " GB/s, "
+              << "min/max " << int_gb / min_max_s << " GB/s, "
+              << "dot " << 2 * int_gb / dot_s << " GB/s, "
+              << "find " << int_gb / find_s << " GB/s" << (ok ? "" : "  RESULTS DIFFER") << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,633 @@
+/**
+ * @file skip_list.cpp
+ * @brief Tutorial code for a lock-free skip list: an ordered set that many
+ * threads can insert into, erase from and scan at the same time, without
+ * locks.
+ */
+
+// sets.cpp's std::set<int> is a red-black tree. Sharing one between threads
+// takes a lock around every operation, as in rwlock.cpp, and then all the
+// writers take turns, and every reader writes to the lock's reader count.
+
+// A skip list is an ordered linked list with express lanes. Every node is
+// on level 0, a sorted list of all keys. About half of the nodes are also
+// on level 1, a quarter on level 2, and so on. A search starts at the top
+// level, moves right while the next key is smaller, and drops a level when
+// it isn't, so it skips most of the list, like a binary search; O(log n)
+// steps on average.
+
+// Because every level is a plain singly linked list, each change is a
+// compare-and-swap on one next pointer, and the list can be made lock-free
+// (Herlihy and Shavit, "The Art of Multiprocessor Programming", ch. 14,
+// after Fraser, 2004):
+//   - Insert links the new node into level 0 with one CAS. From then on the
+//     key is in the set. It then links the node into the higher levels,
+//     one CAS each, searching again whenever a CAS fails.
+//   - Erase first marks the node's next pointers, top level to level 0,
+//     by setting their lowest bit (nodes are aligned, so pointer bits 0
+//     are free). A marked pointer can't be the target of a successful CAS,
+//     so nothing can be linked behind a node being erased. Whoever marks
+//     level 0 has erased the key.
+//   - Every search unlinks marked nodes it passes ("snips" them), so erased
+//     nodes disappear from the lists as threads walk by.
+// Readers never write anything, except when they help snip.
+
+// The hard part is freeing erased nodes: another thread may be looking at
+// a node right now, even after it is unlinked. We use epoch-based
+// reclamation (Fraser, 2004). There is a global epoch number, and every
+// operation runs inside an EpochGuard, which announces "I am reading, and
+// I started in epoch e". Unlinked nodes are retired, not freed: they wait in
+// a per-thread list tagged with the current epoch. The epoch only advances
+// when every thread that is inside an operation has announced the current
+// epoch, so once it has advanced twice past a node's tag, no operation that
+// could have seen the node is still running, and the node is freed.
+// Retiring is the job of whoever finishes last with the node: the eraser,
+// or the inserter if it is still linking the node into higher levels.
+
+// Range scans walk level 0 from the first key >= lo, skipping marked
+// nodes. They are weakly consistent: keys inserted or erased during the
+// scan may or may not be seen, but every key that is in the set for the
+// whole scan is seen, in order.
+
+// The benchmark runs 89% lookups, 5% inserts, 5% erases and 1% scans of 100
+// keys over keys 0 to 1,000,000, with 1 to 64 threads, against std::set
+// behind a std::shared_mutex. Pass a different run time per configuration in
+// milliseconds as the first argument (default 200). On one thread the skip
+// list is somewhat slower: a search visits about twice as many nodes as a
+// red-black tree lookup, with a cache miss for most of them. Its advantage is
+// that it keeps scaling with cores, while the locked set stays at about one
+// core's worth of writes.
+
+// Includes std::atomic.
+#include <atomic>
+// Includes std::chrono::milliseconds.
+#include <chrono>
+// Includes the header for uint64_t and uintptr_t.
+#include <cstdint>
+// Includes std::cout (printing) for demo purposes.
+#include <iostream>
+// Includes std::numeric_limits.
+#include <limits>
+// Includes the mutex library header.
+#include <mutex>
+// Includes placement new.
+#include <new>
+// Includes std::mt19937_64.
+#include <random>
+// Includes the set container library header, for the comparison.
+#include <set>
+// Includes the shared mutex library header.
+#include <shared_mutex>
+// Includes std::runtime_error.
+#include <stdexcept>
+// Includes the C++ string library.
+#include <string>
+// Includes the thread library header.
+#include <thread>
+// Includes the header for std::vector.
+#include <vector>
+
+// Epoch-based reclamation, shared by all skip lists in the process.
+class Epochs {
+ public:
+  static constexpr size_t kMaxThreads = 256;
+
+  // Marks the calling thread as inside an operation. Guards may nest.
+  class Guard {
+   public:
+    Guard() { Enter(); }
+    ~Guard() { Leave(); }
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+  };
+
+  // Frees p with destroy(p) once no operation that could see it is running.
+  // Must be called inside a Guard.
+  static void Retire(void *p, void (*destroy)(void *)) {
+    ThreadState &state = Local();
+    state.bags_[state.epoch_ % 3].push_back({p, destroy});
+    if (++state.retired_since_advance_ >= kRetiresPerAdvance) {
+      state.retired_since_advance_ = 0;
+      TryAdvance();
+    }
+  }
+
+ private:
+  // Epochs start at 1, so a zero-initialized slot reads as inactive.
+  static constexpr uint64_t kInactive = 0;
+  static constexpr size_t kRetiresPerAdvance = 64;
+
+  struct Retired {
+    void *p_;
+    void (*destroy_)(void *);
+  };
+
+  // One cache line per thread, so announcing doesn't contend.
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch_;
+  };
+
+  // Retired pointers of threads that exited, tagged with the epoch at exit.
+  // Whatever is still retired when the process exits is left to the OS.
+  struct Orphan {
+    Retired retired_;
+    uint64_t epoch_;
+  };
+
+  // Each thread's announcement slot and retired pointers. bags_[e % 3]
+  // holds what the thread retired while it was in epoch e.
+  struct ThreadState {
+    ThreadState() {
+      std::scoped_lock lk(m);
+      while (slot_ < kMaxThreads && used[slot_]) {
+        slot_++;
+      }
+      if (slot_ == kMaxThreads) {
+        throw std::runtime_error("Epochs supports at most 256 concurrent threads");
+      }
+      used[slot_] = true;
+    }
+
+    ~ThreadState() {
+      std::scoped_lock lk(m);
+      uint64_t epoch = global_epoch.load();
+      for (auto &bag : bags_) {
+        for (const Retired &retired : bag) {
+          orphans.push_back({retired, epoch});
+        }
+      }
+      used[slot_] = false;
+    }
+
+    size_t slot_ = 0;
+    int depth_ = 0;
+    uint64_t epoch_ = 0;
+    std::vector<Retired> bags_[3];
+    uint64_t bag_epochs_[3] = {0, 0, 0};
+    size_t retired_since_advance_ = 0;
+  };
+
+  static ThreadState &Local() {
+    thread_local ThreadState state;
+    return state;
+  }
+
+  static void Enter() {
+    ThreadState &state = Local();
+    if (state.depth_++ > 0) {
+      return;
+    }
+    uint64_t epoch = global_epoch.load();
+    slots[state.slot_].epoch_.store(epoch);
+    // The announcement must be visible before we read any node.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    state.epoch_ = epoch;
+    // The bag for this epoch, if it is from an earlier epoch, is at least 3
+    // epochs old, so nobody can still see its pointers.
+    std::vector<Retired> &bag = state.bags_[epoch % 3];
+    if (state.bag_epochs_[epoch % 3] != epoch) {
+      for (const Retired &retired : bag) {
+        retired.destroy_(retired.p_);
+      }
+      bag.clear();
+      state.bag_epochs_[epoch % 3] = epoch;
+    }
+  }
+
+  static void Leave() {
+    ThreadState &state = Local();
+    if (--state.depth_ == 0) {
+      slots[state.slot_].epoch_.store(kInactive, std::memory_order_release);
+    }
+  }
+
+  // Advances the epoch if every thread inside an operation has announced
+  // the current one, and then frees orphans old enough.
+  static void TryAdvance() {
+    uint64_t epoch = global_epoch.load();
+    for (const Slot &slot : slots) {
+      uint64_t announced = slot.epoch_.load();
+      if (announced != kInactive && announced != epoch) {
+        return;
+      }
+    }
+    if (!global_epoch.compare_exchange_strong(epoch, epoch + 1)) {
+      return;
+    }
+    std::scoped_lock lk(m);
+    size_t kept = 0;
+    for (const Orphan &orphan : orphans) {
+      if (orphan.epoch_ + 2 <= epoch + 1) {
+        orphan.retired_.destroy_(orphan.retired_.p_);
+      } else {
+        orphans[kept++] = orphan;
+      }
+    }
+    orphans.resize(kept);
+  }
+
+  static inline std::atomic<uint64_t> global_epoch{1};
+  static inline Slot slots[kMaxThreads];
+  static inline std::mutex m;
+  static inline bool used[kMaxThreads];
+  static inline std::vector<Orphan> orphans;
+};
+
+template <typename K>
+class ConcurrentSkipList {
+ public:
+  ConcurrentSkipList() : head_(NewNode(K(), kMaxHeight)) {}
+
+  ConcurrentSkipList(const ConcurrentSkipList &) = delete;
+  ConcurrentSkipList &operator=(const ConcurrentSkipList &) = delete;
+
+  // Not thread safe: no other operation may be running.
+  ~ConcurrentSkipList() {
+    Node *node = head_;
+    while (node != nullptr) {
+      Node *next = Ptr(node->next_[0].load(std::memory_order_relaxed));
+      FreeNode(node);
+      node = next;
+    }
+  }
+
+  bool contains(const K &key) const {
+    Epochs::Guard guard;
+    Node *pred = head_;
+    Node *curr = nullptr;
+    for (int level = kMaxHeight - 1; level >= 0; level--) {
+      curr = Ptr(pred->next_[level].load(std::memory_order_acquire));
+      while (curr != nullptr) {
+        uintptr_t succ = curr->next_[level].load(std::memory_order_acquire);
+        // Step over marked nodes without snipping them.
+        while (curr != nullptr && Marked(succ)) {
+          curr = Ptr(succ);
+          succ = curr != nullptr ? curr->next_[level].load(std::memory_order_acquire) : 0;
+        }
+        if (curr == nullptr || !(curr->key_ < key)) {
+          break;
+        }
+        pred = curr;
+        curr = Ptr(succ);
+      }
+    }
+    return curr != nullptr && !(key < curr->key_);
+  }
+
+  // Returns false if the key was already there.
+  bool insert(const K &key) {
+    Epochs::Guard guard;
+    const int height = RandomHeight();
+    Node *preds[kMaxHeight];
+    Node *succs[kMaxHeight];
+    Node *node = nullptr;
+    while (true) {
+      if (Find(key, preds, succs)) {
+        if (node != nullptr) {
+          FreeNode(node);
+        }
+        return false;
+      }
+      if (node == nullptr) {
+        node = NewNode(key, height);
+      }
+      for (int level = 0; level < height; level++) {
+        node->next_[level].store(Raw(succs[level]), std::memory_order_relaxed);
+      }
+      uintptr_t expected = Raw(succs[0]);
+      if (preds[0]->next_[0].compare_exchange_strong(expected, Raw(node), std::memory_order_release,
+                                                     std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+
+    // The key is in the set. Link the higher levels, unless an eraser
+    // marks the node first.
+    for (int level = 1; level < height; level++) {
+      bool linked = false;
+      while (!linked) {
+        uintptr_t next = node->next_[level].load(std::memory_order_acquire);
+        if (Marked(next) || (next != Raw(succs[level]) &&
+                             !node->next_[level].compare_exchange_strong(next, Raw(succs[level])))) {
+          Release(node);
+          return true;
+        }
+        uintptr_t expected = Raw(succs[level]);
+        linked = preds[level]->next_[level].compare_exchange_strong(expected, Raw(node), std::memory_order_release,
+                                                                    std::memory_order_relaxed);
+        if (!linked) {
+          Find(key, preds, succs);
+        }
+      }
+    }
+    Release(node);
+    return true;
+  }
+
+  // Returns false if the key wasn't there.
+  bool erase(const K &key) {
+    Epochs::Guard guard;
+    Node *preds[kMaxHeight];
+    Node *succs[kMaxHeight];
+    if (!Find(key, preds, succs)) {
+      return false;
+    }
+    Node *node = succs[0];
+    for (int level = node->height_ - 1; level >= 1; level--) {
+      uintptr_t next = node->next_[level].load(std::memory_order_acquire);
+      while (!Marked(next) && !node->next_[level].compare_exchange_weak(next, next | 1)) {
+      }
+    }
+    uintptr_t next = node->next_[0].load(std::memory_order_acquire);
+    while (true) {
+      if (Marked(next)) {
+        // Another thread erased it first.
+        return false;
+      }
+      if (node->next_[0].compare_exchange_weak(next, next | 1)) {
+        break;
+      }
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    Release(node);
+    return true;
+  }
+
+  // Calls f(key) for the keys >= lo in order, until f returns false.
+  template <typename F>
+  void for_each_from(const K &lo, F &&f) const {
+    Epochs::Guard guard;
+    Node *pred = head_;
+    for (int level = kMaxHeight - 1; level >= 0; level--) {
+      Node *curr = Ptr(pred->next_[level].load(std::memory_order_acquire));
+      while (curr != nullptr && curr->key_ < lo) {
+        pred = curr;
+        curr = Ptr(curr->next_[level].load(std::memory_order_acquire));
+      }
+    }
+    Node *curr = Ptr(pred->next_[0].load(std::memory_order_acquire));
+    while (curr != nullptr) {
+      uintptr_t succ = curr->next_[0].load(std::memory_order_acquire);
+      if (!Marked(succ) && !(curr->key_ < lo) && !f(curr->key_)) {
+        return;
+      }
+      curr = Ptr(succ);
+    }
+  }
+
+  // Erases the keys in [lo, hi). Returns how many this call erased.
+  size_t erase_range(const K &lo, const K &hi) {
+    std::vector<K> keys;
+    for_each_from(lo, [&](const K &key) {
+      if (!(key < hi)) {
+        return false;
+      }
+      keys.push_back(key);
+      return true;
+    });
+    size_t erased = 0;
+    for (const K &key : keys) {
+      erased += erase(key);
+    }
+    return erased;
+  }
+
+  size_t size() const { return static_cast<size_t>(size_.load(std::memory_order_relaxed)); }
+
+ private:
+  static constexpr int kMaxHeight = 24;
+
+  // next_ points at height_ atomic words right behind the node, in the same
+  // allocation. Each holds a Node pointer, with bit 0 set once the node is
+  // erased from that level.
+  struct Node {
+    Node(const K &key, int height) : key_(key), height_(height) {}
+    K key_;
+    int height_;
+    // The inserter and the eraser each give up their vote when they are
+    // done with the node; the last one retires it.
+    std::atomic<int> votes_{2};
+    std::atomic<uintptr_t> *next_ = nullptr;
+  };
+
+  static Node *NewNode(const K &key, int height) {
+    void *memory = ::operator new(sizeof(Node) + height * sizeof(std::atomic<uintptr_t>));
+    Node *node = new (memory) Node(key, height);
+    node->next_ = reinterpret_cast<std::atomic<uintptr_t> *>(static_cast<char *>(memory) + sizeof(Node));
+    for (int level = 0; level < height; level++) {
+      new (&node->next_[level]) std::atomic<uintptr_t>(0);
+    }
+    return node;
+  }
+
+  static void FreeNode(Node *node) {
+    node->~Node();
+    ::operator delete(node);
+  }
+
+  static void DestroyNode(void *p) { FreeNode(static_cast<Node *>(p)); }
+
+  static Node *Ptr(uintptr_t raw) { return reinterpret_cast<Node *>(raw & ~uintptr_t{1}); }
+  static uintptr_t Raw(Node *node) { return reinterpret_cast<uintptr_t>(node); }
+  static bool Marked(uintptr_t raw) { return (raw & 1) != 0; }
+
+  // A geometric height: 1 with probability 1/2, 2 with 1/4, and so on.
+  static int RandomHeight() {
+    thread_local uint64_t state = std::random_device{}() | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    int height = 1;
+    for (uint64_t bits = state; (bits & 1) != 0 && height < kMaxHeight; bits >>= 1) {
+      height++;
+    }
+    return height;
+  }
+
+  // Fills preds and succs (if not null) with the nodes around key on every
+  // level, snipping marked nodes on the way. Returns true if succs[0] holds
+  // key.
+  bool Find(const K &key, Node **preds, Node **succs) const {
+    while (true) {
+      bool retry = false;
+      Node *pred = head_;
+      Node *curr = nullptr;
+      for (int level = kMaxHeight - 1; level >= 0 && !retry; level--) {
+        curr = Ptr(pred->next_[level].load(std::memory_order_acquire));
+        while (curr != nullptr) {
+          uintptr_t succ = curr->next_[level].load(std::memory_order_acquire);
+          while (Marked(succ)) {
+            uintptr_t expected = Raw(curr);
+            if (!pred->next_[level].compare_exchange_strong(expected, succ & ~uintptr_t{1})) {
+              retry = true;
+              break;
+            }
+            curr = Ptr(succ);
+            if (curr == nullptr) {
+              break;
+            }
+            succ = curr->next_[level].load(std::memory_order_acquire);
+          }
+          if (retry || curr == nullptr || !(curr->key_ < key)) {
+            break;
+          }
+          pred = curr;
+          curr = Ptr(succ);
+        }
+        if (preds != nullptr) {
+          preds[level] = pred;
+          succs[level] = curr;
+        }
+      }
+      if (!retry) {
+        return curr != nullptr && !(key < curr->key_);
+      }
+    }
+  }
+
+  // Gives up one vote on an erased or inserted node. The last vote snips
+  // the node from every level it may still be on and retires it.
+  void Release(Node *node) {
+    if (node->votes_.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+        Marked(node->next_[0].load(std::memory_order_acquire))) {
+      Find(node->key_, nullptr, nullptr);
+      Epochs::Retire(node, &DestroyNode);
+    }
+  }
+
+  Node *const head_;
+  std::atomic<long> size_{0};
+};
+
+// std::set<int> behind a std::shared_mutex, with the same interface.
+class LockedSet {
+ public:
+  bool contains(int key) const {
+    std::shared_lock lk(m_);
+    return set_.count(key) != 0;
+  }
+  bool insert(int key) {
+    std::unique_lock lk(m_);
+    return set_.insert(key).second;
+  }
+  bool erase(int key) {
+    std::unique_lock lk(m_);
+    return set_.erase(key) != 0;
+  }
+  template <typename F>
+  void for_each_from(int lo, F &&f) const {
+    std::shared_lock lk(m_);
+    for (auto it = set_.lower_bound(lo); it != set_.end() && f(*it); ++it) {
+    }
+  }
+
+ private:
+  mutable std::shared_mutex m_;
+  std::set<int> set_;
+};
+
+// Runs the operation mix on `threads` threads for `ms` milliseconds.
+// Returns millions of operations per second.
+template <typename Set>
+double run_mix(Set &set, int threads, int ms) {
+  constexpr int kKeys = 1000000;
+  std::atomic<bool> stop{false};
+  std::atomic<long> ops{0};
+  // Summing the results keeps the compiler from dropping the lookups.
+  std::atomic<long> found{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937_64 rng(t);
+      long local_ops = 0;
+      long local_found = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 100; i++) {
+          int key = static_cast<int>(rng() % kKeys);
+          int dice = static_cast<int>(rng() % 100);
+          if (dice < 89) {
+            local_found += set.contains(key);
+          } else if (dice < 94) {
+            local_found += set.insert(key);
+          } else if (dice < 99) {
+            local_found += set.erase(key);
+          } else {
+            int seen = 0;
+            set.for_each_from(key, [&](int) { return ++seen < 100; });
+            local_found += seen;
+          }
+        }
+        local_ops += 100;
+      }
+      ops.fetch_add(local_ops);
+      found.fetch_add(local_found);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  stop.store(true);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  if (found.load() < 0) {
+    std::cout << "unreachable\n";
+  }
+  return static_cast<double>(ops.load()) / (ms * 1e3);
+}
+
+int main(int argc, char **argv) {
+  const int ms = argc > 1 ? std::stoi(argv[1]) : 200;
+
+  // sets.cpp, on a concurrent skip list.
+  ConcurrentSkipList<int> int_set;
+  for (int i = 1; i <= 10; ++i) {
+    int_set.insert(i);
+  }
+  if (int_set.contains(2)) {
+    std::cout << "Element 2 is in int_set.\n";
+  }
+  int_set.erase(4);
+  // Like int_set.erase(int_set.find(9), int_set.end()), but safe while
+  // other threads use the set.
+  int_set.erase_range(9, std::numeric_limits<int>::max());
+  std::cout << "Elements of int_set:";
+  int_set.for_each_from(std::numeric_limits<int>::min(), [](int key) {
+    std::cout << " " << key;
+    return true;
+  });
+  std::cout << std::endl;
+
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n";
+  for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+    // Each set is built on its own, so its nodes aren't interleaved in memory
+    // with the other's.
+    double locked_rate = 0;
+    {
+      LockedSet locked;
+      for (int key = 0; key < 1000000; key += 2) {
+        locked.insert(key);
+      }
+      locked_rate = run_mix(locked, threads, ms);
+    }
+    ConcurrentSkipList<int> skip_list;
+    for (int key = 0; key < 1000000; key += 2) {
+      skip_list.insert(key);
+    }
+    double skip_list_rate = run_mix(skip_list, threads, ms);
+
+    // Check the skip list: strictly increasing keys, as many as size().
+    size_t count = 0;
+    bool sorted = true;
+    int last = -1;
+    skip_list.for_each_from(std::numeric_limits<int>::min(), [&](int key) {
+      sorted = sorted && key > last;
+      last = key;
+      count++;
+      return true;
+    });
+    std::cout << "  " << threads << " threads: lock-free skip list " << skip_list_rate
+              << " M ops/s, std::set + std::shared_mutex " << locked_rate << " M ops/s"
+              << (sorted && count == skip_list.size() ? "" : " (SKIP LIST INCONSISTENT)") << "\n";
+  }
+  return 0;
+}